@@ -0,0 +1,734 @@
+// Microbenchmarks for every stage of the conversion pipeline.
+//
+// Usage: hikari_bench [--corpus <dir or file>]... [--filter <substring>]
+//                     [--min-time <seconds>] [--min-iterations <count>] [--json <file>]
+//                     [--scaling <max size>] [--check-tuplets <count>]
+//
+// With --scaling, synthetic scores from 1 KB up to the given size are generated instead of
+// loading the corpus, and the growth of the parse and export times with the input size is reported.
+// With --check-tuplets, the given number of generated tuplet segments are partitioned by the library and
+// by the original rational implementation of the partitioning, and any difference between them is an error.
+// Otherwise, the allocations of every stage of a full parse and export are also reported per input,
+// and converting every input again with a warm hkr::Engine is checked to barely allocate.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <span>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+#include <clu/file.h>
+
+#include "hikari/api.h"
+#include "hikari/engine.h"
+#include "hikari/statistics.h"
+#include "parser/measurifier.h"
+#include "lilypond/music_converter.h"
+#include "svg/engraver.h"
+#include "score_generator.h"
+
+// Allocation counting
+
+namespace
+{
+    std::atomic<std::size_t> allocation_count{0};
+    std::atomic<std::size_t> allocation_bytes{0};
+
+    // Every allocation is prefixed with its size, so that the deallocations can also be reported
+    // to the per-stage allocation statistics of the library
+    constexpr std::size_t header_size = alignof(std::max_align_t);
+
+    void* counted_allocate(const std::size_t size)
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        hkr::record_allocation(size);
+        if (void* ptr = std::malloc(size + header_size))
+        {
+            *static_cast<std::size_t*>(ptr) = size;
+            return static_cast<char*>(ptr) + header_size;
+        }
+        throw std::bad_alloc();
+    }
+
+    void counted_deallocate(void* ptr) noexcept
+    {
+        if (!ptr)
+            return;
+        void* base = static_cast<char*>(ptr) - header_size;
+        hkr::record_deallocation(*static_cast<const std::size_t*>(base));
+        std::free(base);
+    }
+} // namespace
+
+void* operator new(const std::size_t size) { return counted_allocate(size); }
+void* operator new[](const std::size_t size) { return counted_allocate(size); }
+void operator delete(void* ptr) noexcept { counted_deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { counted_deallocate(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { counted_deallocate(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { counted_deallocate(ptr); }
+
+namespace
+{
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+
+    // Inputs of the benchmarks are not bound by the default expansion limit
+    hkr::ResourceBudget unlimited_budget()
+    {
+        return hkr::ResourceBudget(hkr::ParseOptions{.max_expanded_bytes = hkr::unlimited});
+    }
+
+    class NullBuffer final : public std::streambuf
+    {
+    public:
+        std::size_t size() const noexcept { return size_; }
+
+    protected:
+        std::streamsize xsputn(const char*, const std::streamsize count) override
+        {
+            size_ += static_cast<std::size_t>(count);
+            return count;
+        }
+
+        int_type overflow(const int_type ch) override
+        {
+            size_++;
+            return ch;
+        }
+
+    private:
+        std::size_t size_ = 0;
+    };
+
+    struct CorpusEntry
+    {
+        std::string name;
+        std::string text;
+        std::size_t n_notes = 0;
+    };
+
+    struct Result
+    {
+        std::string stage;
+        std::string input;
+        std::size_t input_bytes = 0;
+        std::size_t n_notes = 0;
+        std::size_t iterations = 0;
+        double ns_per_iteration = 0;
+        double allocations_per_iteration = 0;
+        double allocated_bytes_per_iteration = 0;
+
+        double ns_per_byte() const { return input_bytes == 0 ? 0 : ns_per_iteration / static_cast<double>(input_bytes); }
+        double ns_per_note() const { return n_notes == 0 ? 0 : ns_per_iteration / static_cast<double>(n_notes); }
+    };
+
+    struct StageAllocations
+    {
+        std::string input;
+        hkr::Stage stage{};
+        hkr::AllocationStatistics allocations;
+    };
+
+    struct Options
+    {
+        std::vector<fs::path> corpus;
+        std::string filter;
+        double min_time = 0.2;
+        std::size_t min_iterations = 5;
+        fs::path json;
+        std::size_t scaling_max_size = 0;
+        std::size_t n_tuplet_checks = 0;
+    };
+
+    std::size_t count_notes(const hkr::Music& music)
+    {
+        std::size_t res = 0;
+        for (const auto& section : music)
+            for (const auto& staff : section.staves)
+                for (const auto& beat : staff)
+                    for (const auto& voice : beat)
+                        for (const auto& chord : voice)
+                            res += section.chords[chord.notes].size();
+        return res;
+    }
+
+    hkr::PreprocessedText preprocess(const std::string_view text)
+    {
+        auto budget = unlimited_budget();
+        return hkr::Preprocessor(budget).process(text);
+    }
+
+    hkr::Music parse_music(const std::string_view text)
+    {
+        auto budget = unlimited_budget();
+        auto unmeasured = hkr::Parser(budget).parse(preprocess(text));
+        return hkr::Measurifier(budget).process(unmeasured);
+    }
+
+    hkr::ly::LyMusic unroll(const hkr::Music& music)
+    {
+        auto budget = unlimited_budget();
+        return hkr::ly::LyMusicConverter(budget).unroll(music);
+    }
+
+    hkr::ly::LyMusic convert(const hkr::Music& music)
+    {
+        auto budget = unlimited_budget();
+        return hkr::ly::convert_to_ly(music, budget);
+    }
+
+    void place_clefs(hkr::ly::LyMusic& music)
+    {
+        hkr::ly::ClefChangePlacer placer;
+        for (auto& staff : music.staves)
+            placer.place(staff, music.chords);
+    }
+
+    void partition_durations(hkr::ly::LyMusic& music)
+    {
+        auto budget = unlimited_budget();
+        hkr::ly::DurationPartitioner::Scratch scratch;
+        for (auto& staff : music.staves)
+            for (auto& measure : staff)
+                hkr::ly::DurationPartitioner(measure, budget, scratch).partition();
+    }
+
+    std::vector<CorpusEntry> load_corpus(const std::vector<fs::path>& paths)
+    {
+        std::vector<fs::path> files;
+        for (const auto& path : paths)
+        {
+            if (fs::is_directory(path))
+            {
+                for (const auto& entry : fs::directory_iterator(path))
+                    if (entry.is_regular_file() && entry.path().extension() == ".hkr")
+                        files.push_back(entry.path());
+            }
+            else
+                files.push_back(path);
+        }
+        std::ranges::sort(files);
+
+        std::vector<CorpusEntry> res;
+        for (const auto& file : files)
+        {
+            CorpusEntry entry{.name = file.stem().string(), .text = clu::read_all_text(file)};
+            try
+            {
+                entry.n_notes = count_notes(parse_music(entry.text));
+            }
+            catch (const std::exception& exc)
+            {
+                fmt::print(stderr, "Skipping {}: {}\n", file.string(), exc.what());
+                continue;
+            }
+            res.push_back(std::move(entry));
+        }
+        return res;
+    }
+
+    // A warm engine converting an input it has already seen should barely touch the heap
+    constexpr std::size_t max_steady_state_allocations = 16;
+
+    class Runner
+    {
+    public:
+        explicit Runner(const Options& options): options_(options) {}
+
+        // Prepare the input of a stage outside of the timed region, then time the stage itself
+        template <typename Prepare, typename Run>
+        const Result* run(const std::string_view stage, const CorpusEntry& entry, Prepare&& prepare, Run&& run)
+        {
+            const std::string name = fmt::format("{}/{}", stage, entry.name);
+            if (!options_.filter.empty() && name.find(options_.filter) == std::string::npos)
+                return nullptr;
+
+            std::vector<double> samples;
+            std::size_t allocations = 0, allocated_bytes = 0;
+            double total = 0;
+            while (total < options_.min_time || samples.size() < options_.min_iterations)
+            {
+                auto input = prepare();
+                const auto count_before = allocation_count.load(std::memory_order_relaxed);
+                const auto bytes_before = allocation_bytes.load(std::memory_order_relaxed);
+                const auto begin = Clock::now();
+                run(input);
+                const auto end = Clock::now();
+                allocations += allocation_count.load(std::memory_order_relaxed) - count_before;
+                allocated_bytes += allocation_bytes.load(std::memory_order_relaxed) - bytes_before;
+                const double seconds = std::chrono::duration<double>(end - begin).count();
+                samples.push_back(seconds);
+                total += seconds;
+            }
+
+            std::ranges::nth_element(samples, samples.begin() + static_cast<std::ptrdiff_t>(samples.size() / 2));
+            const auto n = static_cast<double>(samples.size());
+            Result& res = results_.emplace_back(Result{
+                .stage = std::string(stage),
+                .input = entry.name,
+                .input_bytes = entry.text.size(),
+                .n_notes = entry.n_notes,
+                .iterations = samples.size(),
+                .ns_per_iteration = samples[samples.size() / 2] * 1e9,
+                .allocations_per_iteration = static_cast<double>(allocations) / n,
+                .allocated_bytes_per_iteration = static_cast<double>(allocated_bytes) / n //
+            });
+            fmt::print("{:<40} {:>12.0f} ns {:>9.2f} ns/B {:>9.2f} ns/note {:>10.1f} allocs {:>12.0f} B\n", name,
+                res.ns_per_iteration, res.ns_per_byte(), res.ns_per_note(), res.allocations_per_iteration,
+                res.allocated_bytes_per_iteration);
+            return &res;
+        }
+
+        // Parse and export once with statistics, and report the allocations of every stage
+        void report_allocations(const CorpusEntry& entry)
+        {
+            const std::string name = fmt::format("allocations/{}", entry.name);
+            if (!options_.filter.empty() && name.find(options_.filter) == std::string::npos)
+                return;
+
+            hkr::Statistics stats;
+            NullBuffer buffer;
+            std::ostream stream(&buffer);
+            hkr::export_to_lilypond(stream,
+                hkr::parse_music(entry.text, {.max_expanded_bytes = hkr::unlimited, .statistics = &stats}),
+                {.statistics = &stats});
+
+            for (std::size_t i = 0; i < hkr::stage_count; i++)
+            {
+                const auto stage = static_cast<hkr::Stage>(i);
+                const auto& allocs = stats.allocations(stage);
+                fmt::print("{:<56} {:>10} allocs {:>12} B {:>12} B peak\n",
+                    fmt::format("{}/{}", name, hkr::to_string(stage)), allocs.count, allocs.bytes, allocs.peak_bytes);
+                allocations_.push_back({.input = entry.name, .stage = stage, .allocations = allocs});
+            }
+        }
+
+        // Convert the input again with a warm engine, which should barely allocate. The allocations left
+        // are the entries of the macro table and the rare pieces of text too long for the inline buffers.
+        void check_steady_state_allocations(const CorpusEntry& entry) const
+        {
+            const std::string name = fmt::format("steady_state/{}", entry.name);
+            if (!options_.filter.empty() && name.find(options_.filter) == std::string::npos)
+                return;
+
+            hkr::Engine engine;
+            NullBuffer buffer;
+            std::ostream stream(&buffer);
+            const auto convert = [&]
+            { engine.convert_to_lilypond(stream, entry.text, {.max_expanded_bytes = hkr::unlimited}); };
+            convert(); // Warm up
+            convert();
+            const auto count_before = allocation_count.load(std::memory_order_relaxed);
+            convert();
+            const auto allocations = allocation_count.load(std::memory_order_relaxed) - count_before;
+            fmt::print("{:<40} {:>10} allocs\n", name, allocations);
+            if (allocations > max_steady_state_allocations)
+                throw std::runtime_error(fmt::format(
+                    "A warm engine made {} allocations converting {}, expecting at most {}", //
+                    allocations, entry.name, max_steady_state_allocations));
+        }
+
+        void write_json(std::ostream& stream) const
+        {
+            stream << "{\n  \"benchmarks\": [";
+            for (std::size_t i = 0; const auto& res : results_)
+            {
+                stream << (i++ == 0 ? "\n" : ",\n");
+                stream << fmt::format(R"(    {{"stage": "{}", "input": "{}", "input_bytes": {}, "notes": {}, )"
+                                      R"("iterations": {}, "ns": {:.1f}, "ns_per_byte": {:.4f}, )"
+                                      R"("ns_per_note": {:.4f}, "allocations": {:.1f}, "allocated_bytes": {:.1f}}})",
+                    res.stage, res.input, res.input_bytes, res.n_notes, res.iterations, res.ns_per_iteration,
+                    res.ns_per_byte(), res.ns_per_note(), res.allocations_per_iteration,
+                    res.allocated_bytes_per_iteration);
+            }
+            stream << "\n  ],\n  \"stage_allocations\": [";
+            for (std::size_t i = 0; const auto& [input, stage, allocs] : allocations_)
+            {
+                stream << (i++ == 0 ? "\n" : ",\n");
+                stream << fmt::format(
+                    R"(    {{"input": "{}", "stage": "{}", "allocations": {}, "bytes": {}, "peak_bytes": {}}})", //
+                    input, hkr::to_string(stage), allocs.count, allocs.bytes, allocs.peak_bytes);
+            }
+            stream << "\n  ]\n}\n";
+        }
+
+    private:
+        const Options& options_;
+        std::vector<Result> results_;
+        std::vector<StageAllocations> allocations_;
+    };
+
+    void run_benchmarks(Runner& runner, const CorpusEntry& entry)
+    {
+        using namespace hkr;
+        const auto preprocessed = preprocess(entry.text);
+        auto budget = unlimited_budget();
+        const auto unmeasured = Parser(budget).parse(preprocessed);
+        auto measurified = unmeasured;
+        const auto music = Measurifier(budget).process(measurified);
+        const auto unrolled = unroll(music);
+        auto placed = unrolled;
+        place_clefs(placed);
+        auto converted = placed;
+        partition_durations(converted);
+
+        runner.run(
+            "preprocess", entry, [] { return 0; }, [&](int) { preprocess(entry.text); });
+        runner.run(
+            "parse", entry, [] { return 0; },
+            [&](int)
+            {
+                auto parse_budget = unlimited_budget();
+                Parser(parse_budget).parse(preprocessed);
+            });
+        runner.run(
+            "measurify", entry, [&] { return unmeasured; },
+            [](UnmeasuredMusic& input)
+            {
+                auto measurify_budget = unlimited_budget();
+                Measurifier(measurify_budget).process(input);
+            });
+        runner.run(
+            "convert", entry, [] { return 0; }, [&](int) { convert(music); });
+        runner.run(
+            "unroll", entry, [] { return 0; }, [&](int) { unroll(music); });
+        runner.run(
+            "place_clefs", entry, [&] { return unrolled; }, place_clefs);
+        runner.run(
+            "partition", entry, [&] { return placed; }, partition_durations);
+        runner.run(
+            "format", entry, [] { return 0; },
+            [&](int)
+            {
+                NullBuffer buffer;
+                std::ostream stream(&buffer);
+                ly::write_to_stream(stream, converted);
+            });
+        runner.run(
+            "engrave", entry, [] { return 0; },
+            [&](int)
+            {
+                NullBuffer buffer;
+                std::ostream stream(&buffer);
+                svg::write_to_stream(stream, converted);
+            });
+        runner.run(
+            "piano_roll", entry, [] { return 0; },
+            [&](int)
+            {
+                NullBuffer buffer;
+                std::ostream stream(&buffer);
+                export_to_piano_roll(stream, music);
+            });
+        runner.run(
+            "pipeline", entry, [] { return 0; },
+            [&](int)
+            {
+                NullBuffer buffer;
+                std::ostream stream(&buffer);
+                ly::write_to_stream(stream, convert(parse_music(entry.text)));
+            });
+        Engine engine;
+        runner.run(
+            "engine", entry, [] { return 0; },
+            [&](int)
+            {
+                NullBuffer buffer;
+                std::ostream stream(&buffer);
+                engine.convert_to_lilypond(stream, entry.text, {.max_expanded_bytes = unlimited});
+            });
+        runner.report_allocations(entry);
+        runner.check_steady_state_allocations(entry);
+    }
+
+    // Time parsing and exporting on generated scores of growing sizes, and report the exponent of the
+    // time growth between adjacent sizes, which should stay close to 1 for a linear pipeline
+    void run_scaling(Runner& runner, const std::size_t max_size)
+    {
+        struct Point
+        {
+            std::size_t bytes;
+            double parse_ns;
+            double export_ns;
+        };
+        std::vector<Point> points;
+        for (std::size_t size = 1024;; size *= 4)
+        {
+            size = std::min(size, max_size);
+            auto score = hkr::gen::generate_score({.seed = size, .target_size = size});
+            const auto music = parse_music(score.text);
+            std::size_t n_measures = 0;
+            for (const auto& section : music)
+                n_measures += section.measures.size();
+            if (n_measures != score.n_measures)
+                throw std::runtime_error(fmt::format("Generated score of {} bytes has {} measures, expecting {}",
+                    score.text.size(), n_measures, score.n_measures));
+            const CorpusEntry entry{
+                .name = fmt::format("{}K", score.text.size() / 1024),
+                .text = std::move(score.text),
+                .n_notes = count_notes(music) //
+            };
+            const auto* parsed = runner.run(
+                "scaling_parse", entry, [] { return 0; }, [&](int) { parse_music(entry.text); });
+            const auto* exported = runner.run(
+                "scaling_export", entry, [] { return 0; },
+                [&](int)
+                {
+                    NullBuffer buffer;
+                    std::ostream stream(&buffer);
+                    hkr::ly::write_to_stream(stream, convert(music));
+                });
+            if (parsed && exported)
+                points.push_back({entry.text.size(), parsed->ns_per_iteration, exported->ns_per_iteration});
+            if (size == max_size)
+                break;
+        }
+
+        const auto exponent = [](const double t0, const double t1, const double b0, const double b1)
+        { return std::log(t1 / t0) / std::log(b1 / b0); };
+        fmt::print("\n{:>12} {:>12} {:>16} {:>16}\n", "from", "to", "parse exponent", "export exponent");
+        for (std::size_t i = 1; i < points.size(); i++)
+        {
+            const auto& [b0, p0, e0] = points[i - 1];
+            const auto& [b1, p1, e1] = points[i];
+            const auto bytes0 = static_cast<double>(b0), bytes1 = static_cast<double>(b1);
+            fmt::print("{:>12} {:>12} {:>16.2f} {:>16.2f}\n", b0, b1, exponent(p0, p1, bytes0, bytes1),
+                exponent(e0, e1, bytes0, bytes1));
+        }
+    }
+
+    // The tuplet break points found by the original implementation, which counts the break points of every
+    // range with rational arithmetic and removes those of the best range until no range has any
+    std::vector<clu::rational<int>> reference_tuplet_breaks(const std::span<const clu::rational<int>> chords)
+    {
+        enum class Type
+        {
+            chord,
+            break_point,
+            placeholder
+        };
+        struct Position
+        {
+            clu::rational<int> start;
+            Type type;
+        };
+        const auto gcd = [](const clu::rational<int> lhs, const clu::rational<int> rhs)
+        {
+            const int d = std::lcm(lhs.denominator(), rhs.denominator());
+            return clu::rational<int>(
+                std::gcd(lhs.numerator() * (d / lhs.denominator()), rhs.numerator() * (d / rhs.denominator())), d);
+        };
+        const auto gcd_of = [&](const std::span<const Position> subrange)
+        {
+            clu::rational<int> res = 0;
+            const Position* prev = &subrange.front();
+            for (const auto& pos : subrange.subspan(1))
+            {
+                if (pos.type != Type::chord && &pos != &subrange.back())
+                    continue;
+                const auto diff = pos.start - prev->start;
+                res = res == 0 ? diff : gcd(diff, res);
+                prev = &pos;
+            }
+            return res;
+        };
+        const auto for_each_unnecessary_break = [&](const std::span<Position> subrange, auto&& func)
+        {
+            const auto period = gcd_of(subrange);
+            for (auto& pos : subrange.subspan(1, subrange.size() - 2))
+                if (pos.type == Type::break_point && ((pos.start - subrange[0].start) / period).denominator() != 1)
+                    func(pos);
+        };
+
+        std::vector<Position> pos;
+        for (const auto chord : chords)
+            pos.push_back({chord, Type::chord});
+        clu::rational<int> period = gcd_of(pos);
+        const auto den = static_cast<unsigned>(period.denominator());
+        period *= static_cast<int>(den >> std::countr_zero(den));
+        for (auto i = chords.front() + period; i < chords.back(); i += period)
+            pos.push_back({i, Type::break_point});
+        std::ranges::stable_sort(pos, std::less{}, &Position::start);
+
+        const auto is_marker = [](const Position& p)
+        { return p.type != Type::placeholder && std::has_single_bit(static_cast<unsigned>(p.start.denominator())); };
+        while (true)
+        {
+            std::span<Position> best;
+            std::size_t max_count = 0;
+            for (std::size_t begin = 0; begin < pos.size(); begin++)
+            {
+                if (!is_marker(pos[begin]))
+                    continue;
+                for (std::size_t end = begin + 1; end < pos.size(); end++)
+                {
+                    if (!is_marker(pos[end]))
+                        continue;
+                    const std::span subrange(pos.begin() + static_cast<std::ptrdiff_t>(begin), end - begin + 1);
+                    std::size_t count = 0;
+                    for_each_unnecessary_break(subrange, [&](Position&) { count++; });
+                    if (count > max_count)
+                    {
+                        max_count = count;
+                        best = subrange;
+                    }
+                }
+            }
+            if (max_count == 0)
+                break;
+            for_each_unnecessary_break(best, [](Position& p) { p.type = Type::placeholder; });
+        }
+
+        std::vector<clu::rational<int>> res;
+        for (const auto& p : pos)
+            if (p.type == Type::break_point)
+                res.push_back(p.start);
+        return res;
+    }
+
+    // Groups of one or two kinds of tuplets tied over their ends, so that the chords in between are irregular.
+    // Some segments start at their first irregular chord instead, as left after breaking the previous segment.
+    std::vector<clu::rational<int>> generate_tuplet_segment(std::mt19937_64& rng)
+    {
+        const auto uniform = [&](const int min, const int max) { return std::uniform_int_distribution(min, max)(rng); };
+        constexpr int tuplets[] = {3, 5, 6, 7, 9, 10, 15};
+        const int kinds[] = {tuplets[uniform(0, 6)], tuplets[uniform(0, 6)]};
+        const int density = uniform(0, 3);
+
+        std::vector<clu::rational<int>> res{0};
+        clu::rational<int> start = 0;
+        for (int i = uniform(1, 12); i > 0; i--)
+        {
+            const clu::rational length(1 << uniform(0, 2), 2); // Half a beat to two beats
+            const int tuplet = kinds[uniform(0, 1)];
+            for (int j = 1; j < tuplet; j++)
+                if (const auto pos = start + length * j / tuplet;
+                    !std::has_single_bit(static_cast<unsigned>(pos.denominator())) && uniform(0, density) == 0)
+                    res.push_back(pos);
+            start += length;
+        }
+        res.push_back(start);
+        if (res.size() > 2 && uniform(0, 9) == 0)
+            res.erase(res.begin());
+        return res;
+    }
+
+    bool run_tuplet_check(const std::size_t count)
+    {
+        std::mt19937_64 rng(count);
+        auto budget = unlimited_budget();
+        hkr::ly::DurationPartitioner::Scratch scratch;
+        std::size_t n_failures = 0;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            const auto segment = generate_tuplet_segment(rng);
+            const auto expected = reference_tuplet_breaks(segment);
+            hkr::ly::DurationPartitioner::find_tuplet_breaks(segment, budget, scratch);
+            if (scratch.breaks == expected)
+                continue;
+            if (n_failures++ < 10)
+            {
+                fmt::print("Tuplet segment {} differs:", i);
+                for (const auto pos : segment)
+                    fmt::print(" {}/{}", pos.numerator(), pos.denominator());
+                fmt::print("\n");
+            }
+        }
+        fmt::print("{} of {} tuplet segments differ from the reference\n", n_failures, count);
+        return n_failures == 0;
+    }
+
+    std::size_t parse_size(const std::string_view text)
+    {
+        std::size_t pos = 0;
+        const auto value = static_cast<std::size_t>(std::stoull(std::string(text), &pos));
+        const std::string_view suffix = text.substr(pos);
+        if (suffix.empty())
+            return value;
+        if (suffix == "K" || suffix == "k")
+            return value << 10;
+        if (suffix == "M" || suffix == "m")
+            return value << 20;
+        throw std::invalid_argument(fmt::format("Invalid size {}", text));
+    }
+
+    Options parse_options(const int argc, const char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string_view arg = argv[i];
+            const auto next = [&]() -> std::string_view
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(fmt::format("Missing value for option {}", arg));
+                return argv[++i];
+            };
+            if (arg == "--corpus")
+                options.corpus.emplace_back(next());
+            else if (arg == "--filter")
+                options.filter = next();
+            else if (arg == "--min-time")
+                options.min_time = std::stod(std::string(next()));
+            else if (arg == "--min-iterations")
+                options.min_iterations = std::max(parse_size(next()), std::size_t{1});
+            else if (arg == "--json")
+                options.json = next();
+            else if (arg == "--scaling")
+                options.scaling_max_size = std::max(parse_size(next()), std::size_t{1024});
+            else if (arg == "--check-tuplets")
+                options.n_tuplet_checks = parse_size(next());
+            else
+                throw std::invalid_argument(fmt::format("Unknown option {}", arg));
+        }
+        if (options.corpus.empty())
+        {
+            options.corpus.emplace_back(HIKARI_BENCH_CORPUS_DIR);
+            options.corpus.emplace_back(HIKARI_BENCH_SLOW_CORPUS_DIR); // Pathological inputs found by fuzzing
+        }
+        return options;
+    }
+} // namespace
+
+int main(const int argc, const char** argv)
+{
+    try
+    {
+        const Options options = parse_options(argc, argv);
+        if (options.n_tuplet_checks != 0)
+            return run_tuplet_check(options.n_tuplet_checks) ? 0 : 1;
+        Runner runner(options);
+        if (options.scaling_max_size != 0)
+            run_scaling(runner, options.scaling_max_size);
+        else
+            for (const auto& entry : load_corpus(options.corpus))
+                run_benchmarks(runner, entry);
+        if (!options.json.empty())
+        {
+            std::ofstream file(options.json);
+            file.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+            runner.write_json(file);
+        }
+        return 0;
+    }
+    catch (const std::exception& exc)
+    {
+        std::cerr << exc.what() << '\n';
+        std::cerr << "Usage: hikari_bench [--corpus <dir or file>]... [--filter <substring>] "
+                     "[--min-time <seconds>] [--min-iterations <count>] [--json <file>] "
+                     "[--scaling <max size>] [--check-tuplets <count>]\n";
+        return 1;
+    }
+}
@@ -0,0 +1,30 @@
+#include <iostream>
+#include <fstream>
+
+#include <hikari/api.h>
+
+// Generated at build time from scores/playground.hkr by hikari_embed_scores
+#include "embedded_scores.h"
+
+int main()
+{
+    try
+    {
+        // The score is already parsed, reading it involves no parsing work
+        const hkr::archive::MusicView view = scores::playground();
+        std::size_t n_beats = 0;
+        for (const auto section : view)
+            for (const auto staff : section.staves())
+                n_beats += staff.size();
+        std::cout << "Sections: " << view.size() << ", beats: " << n_beats << '\n';
+
+        // The exporters read the archive in place as well
+        std::ofstream of("embedded.ly");
+        hkr::export_to_lilypond(of, view);
+        return 0;
+    }
+    catch (const std::exception& exc)
+    {
+        std::cout << "Exception: " << exc.what() << '\n';
+    }
+}
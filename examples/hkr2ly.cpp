@@ -1,30 +1,299 @@
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
-#include <hikari/api.h>
-#include <clu/file.h>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <hikari/batch.h>
+#include <hikari/mapped_file.h>
 
-int main(const int argc, const char** argv)
+namespace
 {
-    if (argc != 3)
+    namespace fs = std::filesystem;
+
+    constexpr const char* usage = //
+        "Usage: hkr2ly <in_file> <out_file>\n"
+        "       hkr2ly [-j <threads>] [-o <out_dir or out_file>] [-q] [--max-expanded-bytes <bytes>]\n"
+        "              <in_file or dir or ->...\n"
+        "Converts every input file, or every .hkr file in an input directory, into a .ly file next to it or\n"
+        "in the output directory. Two paths without -o are taken as the input and the output as in the first\n"
+        "form only if the second one does not exist or is a .ly file, otherwise both of them are converted.\n"
+        "An input is never overwritten, and inputs that would write the same output fail. '-' reads from\n"
+        "stdin and writes to stdout. -j sets the number of files converted concurrently (default: one per\n"
+        "hardware thread), -q suppresses the timing summary.\n"
+        "--max-expanded-bytes raises the limit of the text length after macro expansion.\n";
+
+    struct Options
     {
-        std::cerr << "Usage: hkr2ly <in_file> <out_file>\n";
-        return 1;
+        std::vector<fs::path> inputs;
+        std::optional<fs::path> output;
+        std::size_t n_threads = 0;
+        bool quiet = false;
+        hkr::ParseOptions parse_options;
+    };
+
+    struct Job
+    {
+        fs::path input; // Empty for stdin
+        fs::path output; // Empty for stdout
+        std::size_t bytes = 0;
+        std::string error; // Set if the job fails before being converted
+    };
+
+    // Number of files open at once, the batches are split into chunks of this size
+    constexpr std::size_t chunk_size = 256;
+
+    Options parse_options(const int argc, const char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string_view arg = argv[i];
+            const auto next = [&]() -> std::string_view
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument("Missing value for option " + std::string(arg));
+                return argv[++i];
+            };
+            if (arg == "-j")
+                options.n_threads = std::stoul(std::string(next()));
+            else if (arg == "-o")
+                options.output = fs::path(next());
+            else if (arg == "-q")
+                options.quiet = true;
+            else if (arg == "--max-expanded-bytes")
+                options.parse_options.max_expanded_bytes = std::stoul(std::string(next()));
+            else if (arg.size() > 1 && arg.starts_with('-'))
+                throw std::invalid_argument("Unknown option " + std::string(arg));
+            else
+                options.inputs.emplace_back(arg);
+        }
+        // The original form: hkr2ly <in_file> <out_file>, but only an output that is new or a Lilypond file
+        // is taken as such, so that running on two scores (e.g. from a glob) converts both of them instead of
+        // overwriting the second one, whatever their extensions are
+        if (const auto& inputs = options.inputs; !options.output && inputs.size() == 2 && inputs[0] != "-" &&
+            inputs[1] != "-" &&
+            (!fs::exists(inputs[1]) || (inputs[1].extension() == ".ly" && !fs::is_directory(inputs[1]))))
+        {
+            options.output = options.inputs[1];
+            options.inputs.pop_back();
+        }
+        if (options.inputs.empty())
+            throw std::invalid_argument("No input is given");
+        return options;
+    }
+
+    fs::path normalized(const fs::path& path)
+    {
+        std::error_code ec;
+        fs::path res = fs::weakly_canonical(path, ec);
+        return ec ? fs::absolute(path).lexically_normal() : res;
+    }
+
+    // Fails the jobs that would overwrite an input, or write the same output as another job,
+    // e.g. x.hkr from two directories converted into the same output directory
+    void mark_conflicting_outputs(std::vector<Job>& jobs)
+    {
+        std::vector<std::pair<fs::path, std::size_t>> outputs; // Output and index of the job
+        std::vector<fs::path> inputs;
+        for (std::size_t i = 0; i < jobs.size(); i++)
+            if (!jobs[i].input.empty())
+            {
+                outputs.emplace_back(normalized(jobs[i].output), i);
+                inputs.push_back(normalized(jobs[i].input));
+            }
+        std::ranges::sort(outputs);
+        std::ranges::sort(inputs);
+        for (std::size_t i = 0; i < outputs.size(); i++)
+        {
+            const auto& [output, index] = outputs[i];
+            if (std::ranges::binary_search(inputs, output))
+                jobs[index].error = "The output " + jobs[index].output.string() + " would overwrite an input";
+            else if ((i > 0 && outputs[i - 1].first == output) ||
+                (i + 1 < outputs.size() && outputs[i + 1].first == output))
+                jobs[index].error = "The output " + jobs[index].output.string() + " is shared by another input";
+        }
+    }
+
+    std::vector<Job> collect_jobs(const Options& options)
+    {
+        std::vector<fs::path> files;
+        bool use_stdin = false;
+        for (const auto& input : options.inputs)
+        {
+            if (input == "-")
+                use_stdin = true;
+            else if (fs::is_directory(input))
+            {
+                std::vector<fs::path> dir_files;
+                for (const auto& entry : fs::directory_iterator(input))
+                    if (entry.is_regular_file() && entry.path().extension() == ".hkr")
+                        dir_files.push_back(entry.path());
+                std::ranges::sort(dir_files);
+                files.insert(files.end(), dir_files.begin(), dir_files.end());
+            }
+            else
+                files.push_back(input);
+        }
+
+        const bool single_file = files.size() == 1 && !use_stdin && options.inputs[0] == files[0];
+        const bool output_is_file = single_file && options.output && !fs::is_directory(*options.output);
+        if (options.output && !output_is_file)
+            fs::create_directories(*options.output);
+
+        std::vector<Job> jobs;
+        if (use_stdin)
+            jobs.push_back({});
+        for (auto& file : files)
+        {
+            fs::path output = file;
+            output.replace_extension(".ly");
+            if (output_is_file)
+                output = *options.output;
+            else if (options.output)
+                output = *options.output / output.filename();
+            jobs.push_back({.input = std::move(file), .output = std::move(output)});
+        }
+        mark_conflicting_outputs(jobs);
+        return jobs;
+    }
+
+    // The outputs are written to temporary files first, which replace the outputs only on success,
+    // so that a failed conversion never destroys a file that existed before the run
+    fs::path temporary_path(const fs::path& output)
+    {
+        fs::path res = output;
+        res += ".hkr2ly.tmp";
+        return res;
     }
+
+    std::string read_stdin()
+    {
+        std::ostringstream stream;
+        stream << std::cin.rdbuf();
+        return std::move(stream).str();
+    }
+
+    // Convert a chunk of the jobs, returns the number of failed ones
+    std::size_t convert_chunk(std::span<Job> jobs, const Options& options, std::ostream& log)
+    {
+        std::vector<hkr::MappedFile> files(jobs.size());
+        std::vector<std::ofstream> streams(jobs.size());
+        std::vector<hkr::BatchItem> items(jobs.size());
+        std::vector<std::string> errors(jobs.size());
+        std::string stdin_text;
+        for (std::size_t i = 0; i < jobs.size(); i++)
+        {
+            try
+            {
+                if (!jobs[i].error.empty())
+                    throw std::runtime_error(jobs[i].error);
+                if (jobs[i].input.empty())
+                {
+                    stdin_text = read_stdin();
+                    items[i] = {.input = stdin_text, .output = &std::cout};
+                }
+                else
+                {
+                    files[i] = hkr::MappedFile(jobs[i].input);
+                    streams[i].open(temporary_path(jobs[i].output), std::ios::binary);
+                    if (!streams[i])
+                        throw std::runtime_error("Failed to open the output file " + jobs[i].output.string());
+                    items[i] = {.input = files[i].text(), .output = &streams[i]};
+                }
+                jobs[i].bytes = items[i].input.size();
+            }
+            catch (const std::exception& exc)
+            {
+                errors[i] = exc.what();
+            }
+        }
+
+        // Files that failed to open are not converted
+        std::vector<hkr::BatchItem> valid_items;
+        std::vector<std::size_t> valid_indices;
+        for (std::size_t i = 0; i < jobs.size(); i++)
+            if (errors[i].empty())
+            {
+                valid_items.push_back(items[i]);
+                valid_indices.push_back(i);
+            }
+        const auto results = hkr::convert_batch(valid_items, //
+            {.n_threads = options.n_threads, .parse_options = options.parse_options});
+
+        std::size_t n_failed = 0;
+        for (std::size_t k = 0; k < valid_indices.size(); k++)
+        {
+            const std::size_t i = valid_indices[k];
+            if (!results[k].succeeded())
+                errors[i] = results[k].message;
+            else if (!items[i].output->flush())
+                errors[i] = "Failed to write the output";
+            else if (streams[i].is_open())
+            {
+                streams[i].close();
+                std::error_code ec;
+                fs::rename(temporary_path(jobs[i].output), jobs[i].output, ec);
+                if (ec)
+                    errors[i] = "Failed to replace the output file " + jobs[i].output.string() + ": " + ec.message();
+            }
+            if (!options.quiet)
+                log << (jobs[i].input.empty() ? "<stdin>" : jobs[i].input.string()) << ": " << jobs[i].bytes
+                    << " bytes, " << static_cast<double>(results[k].nanoseconds) / 1e6 << " ms"
+                    << (errors[i].empty() ? "" : ", failed") << '\n';
+        }
+        for (std::size_t i = 0; i < jobs.size(); i++)
+            if (!errors[i].empty())
+            {
+                // Don't leave the partial outputs of the failed files behind, the jobs rejected beforehand have none
+                if (!jobs[i].input.empty() && jobs[i].error.empty())
+                {
+                    streams[i].close();
+                    std::error_code ec;
+                    fs::remove(temporary_path(jobs[i].output), ec);
+                }
+                n_failed++;
+                std::cerr << (jobs[i].input.empty() ? "<stdin>" : jobs[i].input.string()) << ": " << errors[i]
+                          << '\n';
+            }
+        return n_failed;
+    }
+} // namespace
+
+int main(const int argc, const char** argv)
+{
+    std::ios::sync_with_stdio(false);
     try
     {
-        namespace fs = std::filesystem;
-        const fs::path in = argv[1];
-        const fs::path out = argv[2];
-        std::cout << "Input: " << in << "\nOutput: " << out << '\n';
-        hkr::Music music = hkr::parse_music(clu::read_all_text(in));
-        std::ofstream out_file(argv[2]);
-        out_file.exceptions(std::ofstream::badbit | std::ofstream::failbit);
-        export_to_lilypond(out_file, std::move(music));
-        return 0;
+        const Options options = parse_options(argc, argv);
+        auto jobs = collect_jobs(options);
+        // Keep stdout clean for the output if it is used
+        std::ostream& log = !jobs.empty() && jobs[0].input.empty() ? std::cerr : std::cout;
+
+        using Clock = std::chrono::steady_clock;
+        const auto begin = Clock::now();
+        std::size_t n_failed = 0;
+        for (std::size_t i = 0; i < jobs.size(); i += chunk_size)
+            n_failed += convert_chunk(std::span(jobs).subspan(i, std::min(chunk_size, jobs.size() - i)), options, log);
+        const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        if (!options.quiet)
+        {
+            std::size_t total_bytes = 0;
+            for (const auto& job : jobs)
+                total_bytes += job.bytes;
+            log << jobs.size() - n_failed << " of " << jobs.size() << " files converted in " << seconds * 1e3
+                << " ms, " << static_cast<double>(total_bytes) / 1e6 / seconds << " MB/s\n";
+        }
+        return n_failed == 0 ? 0 : 1;
     }
     catch (const std::exception& e)
     {
-        std::cerr << e.what() << '\n';
+        std::cerr << e.what() << '\n' << usage;
         return 1;
     }
 }
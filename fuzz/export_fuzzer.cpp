@@ -0,0 +1,20 @@
+// Fuzz target of parse_music followed by export_to_lilypond, run with libFuzzer or replay inputs
+// with the standalone driver.
+
+#include <sstream>
+#include <hikari/api.h>
+
+#include "fuzz_budget.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, const std::size_t size)
+{
+    const std::string_view input(reinterpret_cast<const char*>(data), size);
+    hkr::fuzz::run_with_budget(input,
+        [](const std::string_view text)
+        {
+            std::ostringstream stream;
+            hkr::export_to_lilypond(stream, hkr::parse_music(std::string(text), hkr::fuzz::parse_options),
+                hkr::fuzz::export_options);
+        });
+    return 0;
+}
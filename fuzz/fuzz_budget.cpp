@@ -0,0 +1,138 @@
+#include "fuzz_budget.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <clu/scope.h>
+
+#include "parser/parser_types.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Every allocation is prefixed with its size, so that the live memory can be tracked without
+    // relying on sized deallocation. The header keeps the alignment of the default operator new.
+    constexpr std::size_t header_size = alignof(std::max_align_t);
+
+    std::atomic<bool> armed{false};
+    std::atomic<std::size_t> live_bytes{0};
+    std::atomic<std::size_t> memory_limit{0};
+    std::atomic<std::int64_t> deadline{0}; // Ticks of Clock, 0 when no input is running
+    std::string_view current_input;
+
+    [[noreturn]] void report_overrun(const char* message)
+    {
+        std::fprintf(stderr, "==hikari-fuzz== %s, input of %zu bytes\n", message, current_input.size());
+        std::abort();
+    }
+
+    void* allocate(const std::size_t size)
+    {
+        const auto live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        if (armed.load(std::memory_order_relaxed) && live > memory_limit.load(std::memory_order_relaxed))
+        {
+            armed.store(false, std::memory_order_relaxed);
+            report_overrun("Memory budget exceeded");
+        }
+        auto* ptr = static_cast<std::byte*>(std::malloc(size + header_size));
+        if (!ptr)
+            throw std::bad_alloc();
+        *reinterpret_cast<std::size_t*>(ptr) = size;
+        return ptr + header_size;
+    }
+
+    void deallocate(void* ptr) noexcept
+    {
+        if (!ptr)
+            return;
+        auto* base = static_cast<std::byte*>(ptr) - header_size;
+        live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(base), std::memory_order_relaxed);
+        std::free(base);
+    }
+
+    std::uint64_t read_env(const char* name, const std::uint64_t default_value)
+    {
+        if (const char* value = std::getenv(name))
+            return std::strtoull(value, nullptr, 10);
+        return default_value;
+    }
+
+    // The watchdog aborts an input in the middle of its run, so that inputs that hang are
+    // reported as well, instead of only being measured after they finally return
+    void start_watchdog()
+    {
+        static const bool started = []
+        {
+            std::thread(
+                []
+                {
+                    while (true)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                        const auto end = deadline.load(std::memory_order_acquire);
+                        if (end != 0 && Clock::now().time_since_epoch().count() > end)
+                            report_overrun("Time budget exceeded");
+                    }
+                })
+                .detach();
+            return true;
+        }();
+        (void)started;
+    }
+} // namespace
+
+void* operator new(const std::size_t size) { return allocate(size); }
+void* operator new[](const std::size_t size) { return allocate(size); }
+void operator delete(void* ptr) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { deallocate(ptr); }
+
+namespace hkr::fuzz
+{
+    const Budget& budget()
+    {
+        static const Budget res{
+            .time_ms = read_env("HIKARI_FUZZ_TIME_MS", Budget{}.time_ms),
+            .memory_bytes = static_cast<std::size_t>(read_env("HIKARI_FUZZ_MEMORY_MB", Budget{}.memory_bytes >> 20))
+                << 20 //
+        };
+        return res;
+    }
+
+    void run_with_budget(const std::string_view input, void (*func)(std::string_view))
+    {
+        const Budget& limits = budget();
+        start_watchdog();
+        current_input = input;
+
+        const auto begin = Clock::now();
+        const auto time_limit = std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(limits.time_ms));
+        memory_limit.store(live_bytes.load(std::memory_order_relaxed) + limits.memory_bytes, std::memory_order_relaxed);
+        deadline.store((begin + time_limit).time_since_epoch().count(), std::memory_order_release);
+        armed.store(true, std::memory_order_relaxed);
+        {
+            clu::scope_exit disarm{[]
+                {
+                    armed.store(false, std::memory_order_relaxed);
+                    deadline.store(0, std::memory_order_release);
+                }};
+            try
+            {
+                func(input);
+            }
+            catch (const ParseError&) {}
+            catch (const LimitExceededError&) {}
+        }
+        const auto end = Clock::now();
+
+        // The watchdog only checks periodically, do not let a slow input slip through between two checks
+        if (end - begin > time_limit)
+            report_overrun("Time budget exceeded");
+    }
+} // namespace hkr::fuzz
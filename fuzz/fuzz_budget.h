@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <hikari/options.h>
+
+namespace hkr::fuzz
+{
+    // Per-input resource budgets of the fuzz targets. The defaults can be overridden with
+    // the environment variables HIKARI_FUZZ_TIME_MS and HIKARI_FUZZ_MEMORY_MB.
+    struct Budget
+    {
+        std::uint64_t time_ms = 250;
+        std::size_t memory_bytes = std::size_t{256} << 20;
+    };
+
+    const Budget& budget();
+
+    // The fuzz targets run with the library limits that a service accepting arbitrary text would
+    // configure, so that the fuzzer looks for inputs which are slow despite these limits
+    inline constexpr ParseOptions parse_options{
+        .max_notes = 1'000'000,
+        .max_beats = 1'000'000,
+        .max_measures = 100'000,
+        .max_voices = 16,
+        .max_subdivision = 64,
+        .max_allocated_bytes = std::size_t{64} << 20 //
+    };
+    inline constexpr ExportOptions export_options{
+        .max_notes = 1'000'000,
+        .max_measures = 100'000,
+        .max_voices = 16,
+        .max_subdivision = 64,
+        .max_allocated_bytes = std::size_t{64} << 20 //
+    };
+
+    // Run a function on an input while enforcing the budgets. Overrunning either budget aborts
+    // the process, so that the fuzzer reports the input as a crash. Parse errors and exceeded
+    // library limits are expected for arbitrary inputs and are swallowed, any other exception
+    // escapes as a crash as well.
+    void run_with_budget(std::string_view input, void (*func)(std::string_view));
+} // namespace hkr::fuzz
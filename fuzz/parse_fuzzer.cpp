@@ -0,0 +1,13 @@
+// Fuzz target of parse_music, run with libFuzzer or replay inputs with the standalone driver.
+
+#include <hikari/api.h>
+
+#include "fuzz_budget.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, const std::size_t size)
+{
+    const std::string_view input(reinterpret_cast<const char*>(data), size);
+    hkr::fuzz::run_with_budget(input,
+        [](const std::string_view text) { (void)hkr::parse_music(std::string(text), hkr::fuzz::parse_options); });
+    return 0;
+}
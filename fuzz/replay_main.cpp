@@ -0,0 +1,50 @@
+// Standalone driver for compilers without libFuzzer. Replays every input file given on the
+// command line (directories are searched recursively) through the fuzz target, with the same
+// budgets as under libFuzzer, and prints the time spent on each input.
+//
+// Usage: <target>_replay <file or dir>...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <clu/file.h>
+
+#include "fuzz_budget.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size);
+
+int main(const int argc, const char** argv)
+{
+    namespace fs = std::filesystem;
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <file or dir>...\n", argv[0]);
+        return 1;
+    }
+    std::vector<fs::path> files;
+    for (int i = 1; i < argc; i++)
+    {
+        if (fs::is_directory(argv[i]))
+        {
+            for (const auto& entry : fs::recursive_directory_iterator(argv[i]))
+                if (entry.is_regular_file())
+                    files.push_back(entry.path());
+        }
+        else
+            files.emplace_back(argv[i]);
+    }
+    std::ranges::sort(files);
+
+    for (const auto& file : files)
+    {
+        const std::string text = clu::read_all_text(file);
+        const auto begin = std::chrono::steady_clock::now();
+        LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(text.data()), text.size());
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+        std::printf("%-60s %10zu B %12.3f ms\n", file.string().c_str(), text.size(), elapsed.count());
+    }
+    return 0;
+}
@@ -3,24 +3,94 @@
 #include <string>
 #include <ostream>
 
+#include "options.h"
 #include "types.h"
 
 HIKARI_SUPPRESS_EXPORT_WARNING
 namespace hkr
 {
+    namespace archive
+    {
+        class MusicView;
+    }
+
     /**
      * \brief Parse a string into a structured form.
      * \details Please refer to the syntax guide for more details.
      * \param text Text input.
+     * \param options Resource limits of the parsing, LimitExceededError is thrown if any of them is exceeded.
      * \return Parsed music structure.
      */
-    HIKARI_API Music parse_music(std::string text);
+    HIKARI_API Music parse_music(std::string text, const ParseOptions& options = {});
 
     /**
      * \brief Convert structured music into Lilypond notation.
+     * \details The music is only read, neither modified nor copied, so the same music can be exported
+     * many times, also from several threads at once.
      * \param stream The output stream to write into.
      * \param music The music to export.
+     * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+     */
+    HIKARI_API void export_to_lilypond(std::ostream& stream, const Music& music, const ExportOptions& options = {});
+
+    /**
+     * \brief Convert music read in place from a binary archive into Lilypond notation.
+     * \details The sections are read directly from the archive instead of being deserialized into a Music first,
+     * the output is the same as that of the deserialized music. Verify archives from untrusted sources first.
+     * \param stream The output stream to write into.
+     * \param music View of the archive.
+     * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+     */
+    HIKARI_API void export_to_lilypond(
+        std::ostream& stream, const archive::MusicView& music, const ExportOptions& options = {});
+
+    /**
+     * \brief Engrave structured music into an SVG image for quick previews.
+     * \details The music goes through the same conversion as export_to_lilypond(), then it is drawn
+     * directly with a fixed-width layout of one system per line, which takes milliseconds instead of
+     * running Lilypond. The engraving is simpler than that of Lilypond and not meant for publication.
+     * The glyphs are drawn with a SMuFL font (e.g. Bravura) if one is available, or other fonts with
+     * the Unicode musical symbols otherwise. Like export_to_lilypond(), the music is neither modified nor copied.
+     * \param stream The output stream to write into.
+     * \param music The music to export.
+     * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+     */
+    HIKARI_API void export_to_svg(std::ostream& stream, const Music& music, const ExportOptions& options = {});
+
+    /**
+     * \brief Engrave music read in place from a binary archive into an SVG image.
+     * \details Like export_to_lilypond(std::ostream&, const archive::MusicView&, const ExportOptions&), the
+     * sections are read directly from the archive.
+     * \param stream The output stream to write into.
+     * \param music View of the archive.
+     * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+     */
+    HIKARI_API void export_to_svg(
+        std::ostream& stream, const archive::MusicView& music, const ExportOptions& options = {});
+
+    /**
+     * \brief Draw structured music as a piano roll PNG image.
+     * \details Every note is a bar with the pitch on the vertical axis and the time on the horizontal axis,
+     * in one colour per staff and voice, with the measures separated by vertical lines. The repeats are
+     * unfolded, and the notes are placed by their notated durations regardless of the tempo. This is much
+     * cheaper than engraving, the image data is stored without compression so that no dependencies are needed.
+     * \param stream The output stream to write into, which should be opened in binary mode.
+     * \param music The music to export.
+     * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+     * \throws std::length_error If the image is wider or taller than the 2^31-1 pixels a PNG file allows.
+     */
+    HIKARI_API void export_to_piano_roll(std::ostream& stream, const Music& music, const ExportOptions& options = {});
+
+    /**
+     * \brief Draw music read in place from a binary archive as a piano roll PNG image.
+     * \details Like export_to_lilypond(std::ostream&, const archive::MusicView&, const ExportOptions&), the
+     * sections are read directly from the archive, only the few repeats of a section are copied out of it.
+     * \param stream The output stream to write into, which should be opened in binary mode.
+     * \param music View of the archive.
+     * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+     * \throws std::length_error If the image is wider or taller than the 2^31-1 pixels a PNG file allows.
      */
-    HIKARI_API void export_to_lilypond(std::ostream& stream, Music music);
+    HIKARI_API void export_to_piano_roll(
+        std::ostream& stream, const archive::MusicView& music, const ExportOptions& options = {});
 } // namespace hkr
 HIKARI_RESTORE_EXPORT_WARNING
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr::archive
+{
+    /// \brief Version of the binary music archive format written by this library.
+    inline constexpr std::uint32_t format_version = 4;
+
+    /// \brief Exception type for malformed or incompatible archives.
+    class HIKARI_API ArchiveError final : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    namespace detail
+    {
+        // On-disk layout of a music archive. Every table is an array of fixed-size records,
+        // and records refer to their children by index ranges into the next table, so that the
+        // archive can be read in place. All fields are little-endian.
+
+        enum class Table : std::uint32_t
+        {
+            sections,
+            staves,
+            measures,
+            beats,
+            voices,
+            chords,
+            note_sets,
+            notes,
+            repeats,
+            alternatives,
+            chord_attributes,
+            count
+        };
+
+        struct TableRef
+        {
+            std::uint32_t offset; // From the start of the archive
+            std::uint32_t count;
+        };
+
+        struct Header
+        {
+            char magic[4]; // "HKRM"
+            std::uint32_t version;
+            std::uint32_t size; // Total size of the archive in bytes
+            std::uint32_t reserved;
+            TableRef tables[static_cast<std::size_t>(Table::count)];
+        };
+
+        struct IndexRange
+        {
+            std::uint32_t first;
+            std::uint32_t count;
+        };
+
+        struct SectionRecord
+        {
+            IndexRange staves;
+            IndexRange measures;
+            IndexRange repeats;
+            IndexRange chord_attributes;
+            IndexRange note_sets; // The chord pool of the section, the IDs of its chords index into this range
+        };
+
+        struct RepeatRecord
+        {
+            std::uint32_t begin_measure;
+            std::uint32_t end_measure;
+            std::uint32_t times;
+            IndexRange alternatives; // Into the table of the measure indices after each ending
+        };
+
+        struct MeasureRecord
+        {
+            std::uint32_t start_beat;
+            std::uint8_t flags; // 1: key, 2: time, 4: partial
+            std::int8_t key;
+            std::uint16_t time[2];
+            std::uint16_t partial[2];
+            std::uint16_t reserved;
+        };
+
+        struct ChordRecord
+        {
+            std::uint32_t notes; // ID in the chord pool of the section
+            std::uint8_t flags; // 1: sustained
+            std::uint8_t reserved[3];
+        };
+
+        struct ChordAttributesRecord
+        {
+            std::uint32_t beat;
+            std::uint32_t staff;
+            std::uint32_t voice;
+            std::uint32_t chord;
+            std::uint8_t flags; // 1: tempo
+            std::uint8_t reserved[3];
+            float tempo;
+        };
+
+        struct NoteRecord
+        {
+            std::uint8_t base;
+            std::int8_t accidental;
+            std::int8_t octave;
+            std::uint8_t reserved;
+        };
+
+        template <typename T>
+        T load(const std::byte* ptr) noexcept
+        {
+            T res;
+            std::memcpy(&res, ptr, sizeof(T));
+            return res;
+        }
+
+        template <typename T>
+        T load_record(const std::byte* base, const Table table, const std::size_t index) noexcept
+        {
+            const auto ref = load<TableRef>(base + offsetof(Header, tables) + //
+                static_cast<std::size_t>(table) * sizeof(TableRef));
+            return load<T>(base + ref.offset + index * sizeof(T));
+        }
+    } // namespace detail
+
+    /**
+     * \brief A random access range of elements read in place from an archive.
+     * \tparam T Element type, which is either a view type or a small value type.
+     */
+    template <typename T>
+    class ArchiveRange
+    {
+    public:
+        class iterator
+        {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using reference = T;
+
+            iterator() noexcept = default;
+            iterator(const std::byte* base, const std::size_t index) noexcept: base_(base), index_(index) {}
+
+            T operator*() const noexcept { return T::load(base_, index_); }
+            T operator[](const difference_type n) const noexcept { return *(*this + n); }
+
+            iterator& operator++() noexcept { return ++index_, *this; }
+            iterator operator++(int) noexcept { return {base_, index_++}; }
+            iterator& operator--() noexcept { return --index_, *this; }
+            iterator operator--(int) noexcept { return {base_, index_--}; }
+            iterator& operator+=(const difference_type n) noexcept
+            {
+                index_ += static_cast<std::size_t>(n);
+                return *this;
+            }
+            iterator& operator-=(const difference_type n) noexcept
+            {
+                index_ -= static_cast<std::size_t>(n);
+                return *this;
+            }
+            friend iterator operator+(iterator it, const difference_type n) noexcept { return it += n; }
+            friend iterator operator+(const difference_type n, iterator it) noexcept { return it += n; }
+            friend iterator operator-(iterator it, const difference_type n) noexcept { return it -= n; }
+            friend difference_type operator-(const iterator lhs, const iterator rhs) noexcept
+            {
+                return static_cast<difference_type>(lhs.index_) - static_cast<difference_type>(rhs.index_);
+            }
+            friend bool operator==(const iterator lhs, const iterator rhs) noexcept = default;
+            friend auto operator<=>(const iterator lhs, const iterator rhs) noexcept
+            {
+                return lhs.index_ <=> rhs.index_;
+            }
+
+        private:
+            const std::byte* base_ = nullptr;
+            std::size_t index_ = 0;
+        };
+
+        ArchiveRange() noexcept = default;
+        ArchiveRange(const std::byte* base, const detail::IndexRange range) noexcept: base_(base), range_(range) {}
+
+        iterator begin() const noexcept { return {base_, range_.first}; }
+        iterator end() const noexcept { return {base_, std::size_t{range_.first} + range_.count}; }
+        std::size_t size() const noexcept { return range_.count; }
+        bool empty() const noexcept { return range_.count == 0; }
+        T operator[](const std::size_t index) const noexcept { return T::load(base_, range_.first + index); }
+        T front() const noexcept { return (*this)[0]; }
+        T back() const noexcept { return (*this)[size() - 1]; }
+        detail::IndexRange index_range() const noexcept { return range_; } ///< Indices of the elements in the archive.
+
+    private:
+        const std::byte* base_ = nullptr;
+        detail::IndexRange range_{};
+    };
+
+    /// \brief A note read from an archive.
+    struct HIKARI_API NoteView : Note
+    {
+        static NoteView load(const std::byte* base, std::size_t index) noexcept;
+    };
+
+    /// \brief A measure read from an archive.
+    struct HIKARI_API MeasureView : Measure
+    {
+        static MeasureView load(const std::byte* base, std::size_t index) noexcept;
+    };
+
+    /// \brief Attributes of a chord read from an archive.
+    struct HIKARI_API ChordAttributesView : ChordAttributes
+    {
+        static ChordAttributesView load(const std::byte* base, std::size_t index) noexcept;
+    };
+
+    /// \brief An in-place view of a repeat in an archive.
+    class HIKARI_API RepeatView
+    {
+    public:
+        static RepeatView load(const std::byte* base, std::size_t index) noexcept;
+
+        std::size_t begin_measure() const noexcept { return record_.begin_measure; } ///< \see Repeat::begin_measure
+        std::size_t end_measure() const noexcept { return record_.end_measure; } ///< \see Repeat::end_measure
+        int times() const noexcept { return static_cast<int>(record_.times); } ///< \see Repeat::times
+        std::size_t alternative_count() const noexcept { return record_.alternatives.count; } ///< Number of endings.
+        std::size_t alternative_end(std::size_t index) const noexcept; ///< \see Repeat::alternative_ends
+        Repeat to_repeat() const; ///< Copy the repeat out of the archive.
+
+        /// \brief Indices of the endings in the archive.
+        detail::IndexRange alternatives_index_range() const noexcept { return record_.alternatives; }
+
+    private:
+        const std::byte* base_ = nullptr;
+        detail::RepeatRecord record_{};
+    };
+
+    /// \brief An in-place view of the notes of a chord in an archive.
+    class HIKARI_API NoteSetView : public ArchiveRange<NoteView>
+    {
+    public:
+        static NoteSetView load(const std::byte* base, std::size_t index) noexcept;
+
+    private:
+        using ArchiveRange::ArchiveRange;
+    };
+
+    /// \brief An in-place view of a chord in an archive.
+    class HIKARI_API ChordView
+    {
+    public:
+        static ChordView load(const std::byte* base, std::size_t index) noexcept;
+
+        ChordId notes() const noexcept { return record_.notes; } ///< \see Chord::notes
+        bool sustained() const noexcept { return (record_.flags & 1) != 0; } ///< \see Chord::sustained
+        Chord to_chord() const; ///< Copy the chord out of the archive.
+
+    private:
+        const std::byte* base_ = nullptr;
+        detail::ChordRecord record_{};
+    };
+
+    /// \brief An in-place view of a voice in an archive.
+    class HIKARI_API VoiceView : public ArchiveRange<ChordView>
+    {
+    public:
+        static VoiceView load(const std::byte* base, std::size_t index) noexcept;
+        Voice to_voice() const; ///< Copy the voice out of the archive.
+
+    private:
+        using ArchiveRange::ArchiveRange;
+    };
+
+    /// \brief An in-place view of a beat in an archive.
+    class HIKARI_API BeatView : public ArchiveRange<VoiceView>
+    {
+    public:
+        static BeatView load(const std::byte* base, std::size_t index) noexcept;
+        Beat to_beat() const; ///< Copy the beat out of the archive.
+
+    private:
+        using ArchiveRange::ArchiveRange;
+    };
+
+    /// \brief An in-place view of a staff in an archive.
+    class HIKARI_API StaffView : public ArchiveRange<BeatView>
+    {
+    public:
+        static StaffView load(const std::byte* base, std::size_t index) noexcept;
+        Staff to_staff() const; ///< Copy the staff out of the archive.
+
+    private:
+        using ArchiveRange::ArchiveRange;
+    };
+
+    /// \brief An in-place view of a section in an archive.
+    class HIKARI_API SectionView
+    {
+    public:
+        static SectionView load(const std::byte* base, std::size_t index) noexcept;
+
+        ArchiveRange<StaffView> staves() const noexcept { return {base_, record_.staves}; } ///< \see Section::staves
+        ArchiveRange<MeasureView> measures() const noexcept { return {base_, record_.measures}; } ///< \see Section::measures
+        ArchiveRange<RepeatView> repeats() const noexcept { return {base_, record_.repeats}; } ///< \see Section::repeats
+
+        /// \see Section::chord_attributes
+        ArchiveRange<ChordAttributesView> chord_attributes() const noexcept
+        {
+            return {base_, record_.chord_attributes};
+        }
+
+        /// \brief The chord pool of the section, indexed by the IDs of the chords. \see Section::chords
+        ArchiveRange<NoteSetView> chords() const noexcept { return {base_, record_.note_sets}; }
+
+        /// \see Section::beat_index_range_of_measure
+        std::pair<std::size_t, std::size_t> beat_index_range_of_measure(std::size_t measure) const noexcept;
+
+        Section to_section() const; ///< Copy the section out of the archive.
+
+    private:
+        const std::byte* base_ = nullptr;
+        detail::SectionRecord record_{};
+    };
+
+    /**
+     * \brief An in-place view of a whole piece of music in an archive.
+     * \details Opening a view only validates the archive header, the music data itself is read
+     * lazily through the view types, so that opening a memory-mapped archive costs nearly nothing.
+     * The viewed bytes must be kept alive and 4-byte aligned while the view is in use.
+     */
+    class HIKARI_API MusicView : public ArchiveRange<SectionView>
+    {
+    public:
+        MusicView() noexcept = default;
+
+        /**
+         * \brief Open an archive.
+         * \param bytes The archive data.
+         * \throws ArchiveError If the header is malformed, or the format version is not supported.
+         */
+        explicit MusicView(std::span<const std::byte> bytes);
+
+        /**
+         * \brief Validate every index and value in the archive.
+         * \details Opening an archive only checks the header, use this function before reading
+         * archives from untrusted sources. Besides the index ranges, the music is checked against
+         * everything the parser guarantees: equal beat counts over the staves, measures covering the
+         * beats in order and no longer than their time signatures, valid key and time signatures,
+         * sorted repeats and chord attributes that refer to existing chords, chords that refer to the
+         * distinct note sets of their sections, and notes in range.
+         * \throws ArchiveError If any part of the archive is out of range or malformed.
+         */
+        void verify() const;
+
+        std::span<const std::byte> bytes() const noexcept { return bytes_; } ///< Get the viewed bytes.
+        Music to_music() const; ///< Deserialize the whole music structure.
+
+    private:
+        std::span<const std::byte> bytes_;
+    };
+
+    /**
+     * \brief Serialize a piece of music into the binary archive format.
+     * \param music The music to serialize.
+     * \return The archive data.
+     */
+    HIKARI_API std::vector<std::byte> serialize(const Music& music);
+
+    /**
+     * \brief Builder of packs, each of which holds many music archives indexed by their names.
+     */
+    class HIKARI_API PackBuilder
+    {
+    public:
+        /**
+         * \brief Add a piece of music to the pack.
+         * \param name Name of the entry.
+         * \param music The music to serialize into the pack.
+         * \throws ArchiveError If another entry with the same name already exists.
+         */
+        void add(std::string name, const Music& music);
+
+        /**
+         * \brief Add a serialized archive to the pack.
+         * \param name Name of the entry.
+         * \param archive The archive data, which is validated before being added.
+         * \throws ArchiveError If the archive is malformed, or another entry with the same name exists.
+         */
+        void add_archive(std::string name, std::span<const std::byte> archive);
+
+        std::size_t size() const noexcept { return entries_.size(); } ///< Number of entries in the pack.
+
+        /// \brief Build the pack.
+        std::vector<std::byte> build() const;
+
+    private:
+        struct Entry
+        {
+            std::uint64_t hash;
+            std::string name;
+            std::vector<std::byte> data;
+        };
+
+        std::vector<Entry> entries_;
+    };
+
+    /**
+     * \brief An in-place view of a pack of music archives.
+     * \details Looking up an entry is a binary search over the name hashes stored in the pack index.
+     * The viewed bytes must be kept alive and 8-byte aligned while the view is in use.
+     */
+    class HIKARI_API PackView
+    {
+    public:
+        PackView() noexcept = default;
+
+        /**
+         * \brief Open a pack.
+         * \param bytes The pack data.
+         * \throws ArchiveError If the pack is malformed, or the format version is not supported.
+         */
+        explicit PackView(std::span<const std::byte> bytes);
+
+        std::size_t size() const noexcept { return size_; } ///< Number of entries in the pack.
+        std::string_view name(std::size_t index) const noexcept; ///< Name of an entry.
+        MusicView operator[](std::size_t index) const; ///< Get the music view of an entry.
+
+        /**
+         * \brief Find an entry by its name.
+         * \param name Name of the entry.
+         * \return View of the music, or std::nullopt if no entry has the given name.
+         */
+        std::optional<MusicView> find(std::string_view name) const;
+
+    private:
+        std::span<const std::byte> bytes_;
+        std::size_t size_ = 0;
+    };
+} // namespace hkr::archive
+HIKARI_RESTORE_EXPORT_WARNING
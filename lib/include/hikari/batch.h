@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "options.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /// \brief An input of a batch conversion.
+    struct HIKARI_API BatchItem
+    {
+        std::string_view input; ///< Text input, which should stay valid until the batch finishes.
+        std::ostream* output = nullptr; ///< Stream to write the Lilypond output into, distinct for every item.
+    };
+
+    /// \brief Outcome of converting an item of a batch.
+    struct HIKARI_API BatchResult
+    {
+        std::exception_ptr error; ///< The exception thrown while converting the item, or null on success.
+        std::string message; ///< Description of the error, empty on success.
+        std::uint64_t nanoseconds = 0; ///< Wall time spent on parsing and exporting the item.
+
+        bool succeeded() const noexcept { return !error; } ///< Check whether the item is converted.
+    };
+
+    /// \brief Options of a batch conversion.
+    struct HIKARI_API BatchOptions
+    {
+        /// \brief Number of worker threads, 0 to use one per hardware thread.
+        std::size_t n_threads = 0;
+
+        /// \brief Maximum number of items being converted or waiting for a worker, 0 for twice the thread count.
+        std::size_t max_in_flight = 0;
+
+        /**
+         * \brief Options of parsing every item.
+         * \details The statistics of the items are collected per worker and added into the
+         * statistics object once the batch finishes, so the object needs no synchronization.
+         */
+        ParseOptions parse_options;
+
+        ExportOptions export_options; ///< Options of exporting every item, statistics are collected as above.
+    };
+
+    /**
+     * \brief Parse and export many inputs concurrently on a pool of worker threads.
+     * \details Every item produces the same output as calling parse_music() and then
+     * export_to_lilypond() on it. An item writes its output only when it converts successfully,
+     * and errors are reported per item without stopping the batch. This function returns after
+     * all the items are done.
+     * \param items The inputs and their output streams.
+     * \param options Thread count, in-flight bound and the options of the conversions.
+     * \return The results of the items, in the order of the inputs.
+     */
+    HIKARI_API std::vector<BatchResult> convert_batch(std::span<const BatchItem> items, const BatchOptions& options = {});
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
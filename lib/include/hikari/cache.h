@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "options.h"
+#include "types.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /// \brief A cached result of parsing and exporting a piece of music.
+    struct HIKARI_API CachedResult
+    {
+        Music music; ///< The parsed music.
+        std::string lilypond; ///< The music exported into Lilypond notation.
+    };
+
+    /// \brief Counters of a result cache.
+    struct HIKARI_API CacheStatistics
+    {
+        std::uint64_t hits = 0; ///< Number of lookups that found a cached result.
+        std::uint64_t misses = 0; ///< Number of lookups that did not find a cached result.
+        std::uint64_t evictions = 0; ///< Number of entries evicted to stay within the byte budget.
+        std::size_t entries = 0; ///< Number of entries currently in the cache.
+        std::size_t bytes = 0; ///< Estimated memory usage of the cached entries in bytes.
+    };
+
+    /**
+     * \brief A thread-safe cache of parse and export results keyed by the input text.
+     * \details The cache is split into shards by the hash of the input, each shard is guarded by
+     * its own lock and evicts its least recently used entries when it exceeds its share of the
+     * byte budget, so that concurrent requests for different inputs rarely contend.
+     */
+    class HIKARI_API ResultCache
+    {
+    public:
+        /**
+         * \brief Create an empty cache.
+         * \param byte_budget Maximum estimated memory usage of all the cached entries.
+         * \param n_shards Number of independently locked shards.
+         * \param parse_options Resource limits of parsing every input that is not cached, the statistics
+         * pointer is ignored since the lookups may convert inputs concurrently.
+         * \param export_options Resource limits of exporting every input that is not cached, the statistics
+         * pointer is ignored likewise.
+         */
+        explicit ResultCache(std::size_t byte_budget, std::size_t n_shards = 16,
+            const ParseOptions& parse_options = {}, const ExportOptions& export_options = {});
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+        ~ResultCache() noexcept;
+
+        /**
+         * \brief Get the result for an input, parsing and exporting it if it is not cached.
+         * \details Exceptions from parsing or exporting are propagated, failed inputs are not cached.
+         * Inputs exceeding the limits of the cache throw LimitExceededError.
+         * \param text Text input.
+         * \return The cached result.
+         */
+        std::shared_ptr<const CachedResult> get(std::string_view text);
+
+        /**
+         * \brief Find the result for an input without computing it.
+         * \param text Text input.
+         * \return The cached result, or nullptr if the input is not cached.
+         */
+        std::shared_ptr<const CachedResult> find(std::string_view text);
+
+        void clear(); ///< Remove every entry from the cache.
+        CacheStatistics statistics() const; ///< Get the counters of this cache.
+
+    private:
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
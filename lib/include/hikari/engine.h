@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+#include "options.h"
+#include "types.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /**
+     * \brief A long-lived pipeline for parsing and exporting many pieces of music one after another.
+     * \details The engine owns every stage of the pipeline together with its scratch buffers, which are
+     * reset between requests but keep their capacity, so that once the engine has warmed up, processing
+     * inputs of similar sizes barely allocates. An engine is not thread-safe, use one engine per thread.
+     */
+    class HIKARI_API Engine
+    {
+    public:
+        Engine(); ///< Create an engine with empty buffers.
+        Engine(Engine&&) noexcept; ///< Move constructor.
+        Engine& operator=(Engine&&) noexcept; ///< Move assignment.
+        ~Engine() noexcept; ///< Destructor.
+
+        /**
+         * \brief Parse a string into a structured form, the same as parse_music().
+         * \param text Text input.
+         * \param options Resource limits of the parsing, LimitExceededError is thrown if any of them is exceeded.
+         * \return Parsed music structure, which is owned by the engine and stays valid until the next parse.
+         */
+        const Music& parse(std::string_view text, const ParseOptions& options = {});
+
+        /**
+         * \brief Convert structured music into Lilypond notation, the same as hkr::export_to_lilypond().
+         * \param stream The output stream to write into.
+         * \param music The music to export, which may be the result of parse().
+         * \param options Resource limits of the exporting, LimitExceededError is thrown if any of them is exceeded.
+         */
+        void export_to_lilypond(std::ostream& stream, const Music& music, const ExportOptions& options = {});
+
+        /**
+         * \brief Parse a string and convert the music into Lilypond notation.
+         * \param stream The output stream to write into.
+         * \param text Text input.
+         * \param parse_options Resource limits of the parsing.
+         * \param export_options Resource limits of the exporting.
+         */
+        void convert_to_lilypond(std::ostream& stream, std::string_view text, const ParseOptions& parse_options = {},
+            const ExportOptions& export_options = {});
+
+    private:
+        class Impl;
+        std::unique_ptr<Impl> impl_;
+    };
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
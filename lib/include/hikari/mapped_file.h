@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <string_view>
+
+#include "export.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /**
+     * \brief A read-only memory mapping of a whole file.
+     * \details The mapping is shared with every other process that maps the same file, so
+     * the pages are backed by the system page cache instead of private heap memory.
+     */
+    class HIKARI_API MappedFile
+    {
+    public:
+        MappedFile() noexcept = default; ///< Create an empty mapping.
+
+        /**
+         * \brief Map a file into memory.
+         * \param path Path to the file.
+         * \throws std::system_error If the file cannot be opened or mapped.
+         */
+        explicit MappedFile(const std::filesystem::path& path);
+
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+        ~MappedFile() noexcept;
+
+        /// \brief Get the mapped bytes.
+        std::span<const std::byte> bytes() const noexcept { return {data_, size_}; }
+
+        /// \brief Get the mapped bytes as text.
+        std::string_view text() const noexcept { return {reinterpret_cast<const char*>(data_), size_}; }
+
+        std::size_t size() const noexcept { return size_; } ///< Size of the file in bytes.
+        bool empty() const noexcept { return size_ == 0; } ///< Checks whether the mapping is empty.
+
+    private:
+        const std::byte* data_ = nullptr;
+        std::size_t size_ = 0;
+#ifdef _WIN32
+        void* mapping_ = nullptr;
+#endif
+
+        void unmap() noexcept;
+    };
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "export.h"
+#include "statistics.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /// \brief Value of a limit that is never exceeded.
+    inline constexpr std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+
+    /// \brief Kinds of resource limits that can be exceeded while parsing or exporting.
+    enum class Limit : std::uint8_t
+    {
+        expanded_bytes, ///< Length of the main text or of any macro after macro expansion.
+        notes, ///< Total number of notes.
+        beats, ///< Total number of beats, counted in every staff.
+        measures, ///< Total number of measures.
+        voices, ///< Number of voices in a multi-voiced segment or a measure.
+        subdivision, ///< Number of chords in a beat of a voice, i.e. the denominator of the positions.
+        allocated_bytes ///< Estimated total size of the data structures allocated for the request.
+    };
+
+    /**
+     * \brief Resource limits and statistics collection of parsing.
+     * \details Every limit is checked where that quantity is produced, so an input that exceeds
+     * a limit is rejected before the pipeline spends more time or memory on it.
+     */
+    struct HIKARI_API ParseOptions
+    {
+        std::size_t max_expanded_bytes = 65535; ///< Maximum length of the main text or any macro after expansion.
+        std::size_t max_notes = unlimited; ///< Maximum total number of notes.
+        std::size_t max_beats = unlimited; ///< Maximum total number of beats over all the staves.
+        std::size_t max_measures = unlimited; ///< Maximum total number of measures.
+        std::size_t max_voices = unlimited; ///< Maximum number of voices in a multi-voiced segment.
+        std::size_t max_subdivision = unlimited; ///< Maximum number of chords in a beat of a voice.
+        std::size_t max_allocated_bytes = unlimited; ///< Maximum estimated size of the parsed structures.
+        Statistics* statistics = nullptr; ///< If not null, statistics of the parsing are added into this object.
+    };
+
+    /// \brief Resource limits and statistics collection of exporting.
+    struct HIKARI_API ExportOptions
+    {
+        std::size_t max_notes = unlimited; ///< Maximum total number of notes in the exported music.
+        std::size_t max_measures = unlimited; ///< Maximum total number of measures over all the staves.
+        std::size_t max_voices = unlimited; ///< Maximum number of voices in a measure.
+        std::size_t max_subdivision = unlimited; ///< Maximum denominator of the chord positions in a beat.
+        std::size_t max_allocated_bytes = unlimited; ///< Maximum estimated size of the intermediate structures.
+        Statistics* statistics = nullptr; ///< If not null, statistics of the exporting are added into this object.
+    };
+
+    /// \brief Exception type for inputs that exceed one of the resource limits.
+    class HIKARI_API LimitExceededError final : public std::runtime_error
+    {
+    public:
+        /**
+         * \brief Create an exception for an exceeded limit.
+         * \param limit The kind of limit that was exceeded.
+         * \param max_value The value of that limit.
+         * \param message Description of the error.
+         */
+        LimitExceededError(const Limit limit, const std::size_t max_value, const std::string& message):
+            std::runtime_error(message), limit_(limit), max_value_(max_value)
+        {
+        }
+
+        Limit limit() const noexcept { return limit_; } ///< The kind of limit that was exceeded.
+        std::size_t max_value() const noexcept { return max_value_; } ///< The value of the exceeded limit.
+
+    private:
+        Limit limit_;
+        std::size_t max_value_;
+    };
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
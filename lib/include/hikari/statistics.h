@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "export.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /// \brief Stages of the parsing and exporting pipeline.
+    enum class Stage : std::uint8_t
+    {
+        preprocess, ///< Removing whitespaces and expanding macros.
+        parse, ///< Parsing the preprocessed text into staves of beats.
+        measurify, ///< Grouping the beats into measures.
+        unroll, ///< Unrolling the music into Lilypond measures and voices, or into the notes of a piano roll.
+        place_clefs, ///< Placing clef changes.
+        partition_durations, ///< Partitioning the chords into notated durations, including tuplets.
+        partition_tuplets, ///< Partitioning tuplets, a part of partition_durations.
+        format ///< Writing the Lilypond text, the SVG image or the piano roll image.
+    };
+
+    /// \brief Number of pipeline stages.
+    inline constexpr std::size_t stage_count = static_cast<std::size_t>(Stage::format) + 1;
+
+    /// \brief Get the name of a pipeline stage, e.g. "place_clefs".
+    HIKARI_API std::string_view to_string(Stage stage) noexcept;
+
+    /// \brief Allocations made in a pipeline stage.
+    struct HIKARI_API AllocationStatistics
+    {
+        std::uint64_t count = 0; ///< Number of allocations.
+        std::uint64_t bytes = 0; ///< Total number of bytes allocated.
+        std::uint64_t peak_bytes = 0; ///< Maximum number of bytes live at once, counted from the start of the stage.
+    };
+
+    /**
+     * \brief Statistics of parsing and exporting requests.
+     * \details Pass a pointer to this structure in ParseOptions or ExportOptions to collect the
+     * statistics, the values are added to the existing ones so that one object may accumulate
+     * several requests. If the library is built without HIKARI_ENABLE_STATISTICS, nothing is
+     * collected and the statistics code is compiled out of the pipeline.
+     */
+    struct HIKARI_API Statistics
+    {
+        std::array<std::uint64_t, stage_count> stage_nanoseconds{}; ///< Wall time spent in each stage.
+        std::array<AllocationStatistics, stage_count> stage_allocations{}; ///< Allocations made in each stage.
+
+        std::uint64_t macro_expansions = 0; ///< Number of macro references expanded.
+        std::uint64_t expanded_bytes = 0; ///< Number of bytes written into the main text and macros.
+        std::uint64_t chords = 0; ///< Number of chords parsed, including rests and sustains.
+        std::uint64_t notes = 0; ///< Number of notes parsed.
+        std::uint64_t distinct_chords = 0; ///< Number of distinct note sets stored for the export.
+        std::uint64_t break_at_calls = 0; ///< Number of attempts to break a chord into tied ones.
+        std::uint64_t tuplet_iterations = 0; ///< Number of removals of unnecessary tuplet break points.
+        std::uint64_t tuplet_ranges = 0; ///< Number of ranges examined to find those removals.
+        std::uint64_t clef_changes = 0; ///< Number of clef changes in the staves after placing them.
+        std::uint64_t output_bytes = 0; ///< Number of bytes of Lilypond text, SVG or PNG written.
+
+        /// \brief Get the wall time spent in a stage in nanoseconds.
+        std::uint64_t& nanoseconds(const Stage stage) noexcept
+        {
+            return stage_nanoseconds[static_cast<std::size_t>(stage)];
+        }
+
+        /// \brief Get the wall time spent in a stage in nanoseconds.
+        std::uint64_t nanoseconds(const Stage stage) const noexcept
+        {
+            return stage_nanoseconds[static_cast<std::size_t>(stage)];
+        }
+
+        /// \brief Get the allocations made in a stage.
+        AllocationStatistics& allocations(const Stage stage) noexcept
+        {
+            return stage_allocations[static_cast<std::size_t>(stage)];
+        }
+
+        /// \brief Get the allocations made in a stage.
+        const AllocationStatistics& allocations(const Stage stage) const noexcept
+        {
+            return stage_allocations[static_cast<std::size_t>(stage)];
+        }
+
+        /// \brief Add the statistics of other requests into these, taking the maximum of the peaks.
+        Statistics& operator+=(const Statistics& other) noexcept;
+    };
+
+    /**
+     * \brief Report an allocation to the stage running on the calling thread.
+     * \details The library cannot observe the allocations by itself, so allocation statistics are
+     * opt-in: an application that wants them calls this function and record_deallocation() from its
+     * replacements of the global operator new and operator delete. Neither function allocates, and
+     * they do nothing unless a stage collecting statistics is running on the calling thread. The
+     * allocations of a nested stage, like partition_tuplets, are also counted in its parent stage.
+     * \param bytes Size of the allocation.
+     */
+    HIKARI_API void record_allocation(std::size_t bytes) noexcept;
+
+    /**
+     * \brief Report a deallocation to the stage running on the calling thread.
+     * \param bytes Size of the deallocated memory.
+     */
+    HIKARI_API void record_deallocation(std::size_t bytes) noexcept;
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
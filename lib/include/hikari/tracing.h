@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string_view>
+
+#include "export.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr::trace
+{
+    /**
+     * \brief Callback receiving trace events.
+     * \details Every call receives a single Chrome trace event as a JSON object, e.g.
+     * `{"name":"parse section","cat":"hikari","ph":"X","ts":12.5,"dur":3.25,"pid":1,"tid":2}`.
+     * Calls are serialized, but they may come from any thread that runs the pipeline.
+     */
+    using Callback = std::function<void(std::string_view event)>;
+
+    /**
+     * \brief Check whether the library is built with tracing support.
+     * \details Tracing is enabled by the HIKARI_ENABLE_TRACING CMake option. Without it, the trace
+     * zones are compiled out of the pipeline and starting a trace does nothing.
+     */
+    HIKARI_API bool is_supported() noexcept;
+
+    /**
+     * \brief Start writing trace events into a file in the Chrome trace event format.
+     * \details The file can be loaded into Perfetto or chrome://tracing. Any trace that is already
+     * started is stopped first.
+     * \param path Path of the JSON file.
+     */
+    HIKARI_API void start(const std::filesystem::path& path);
+
+    /**
+     * \brief Start sending trace events to a callback.
+     * \details Any trace that is already started is stopped first.
+     * \param callback The callback receiving the events.
+     */
+    HIKARI_API void start(Callback callback);
+
+    /// \brief Stop the current trace, completing and closing the trace file if there is one.
+    HIKARI_API void stop();
+} // namespace hkr::trace
+HIKARI_RESTORE_EXPORT_WARNING
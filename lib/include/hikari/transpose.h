@@ -0,0 +1,38 @@
+#pragma once
+
+#include "types.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /**
+     * \brief Transpose a whole piece of music up by an interval in place.
+     * \details The notes keep their spelling relative to the interval, e.g. F# up a minor third is A, and the key
+     * signatures of the measures are changed to the transposed keys. Keys beyond 7 sharps or flats are written
+     * as their enharmonic equivalents, and the notes under them are respelled to match, e.g. D# F## A# under D
+     * sharp major become Eb G Bb under E flat major. Notes that would get more than two sharps or flats are
+     * respelled enharmonically, e.g. F## up a major third is B# instead of A###. Music without a key signature
+     * at its start is taken to be in C major, and gets the transposed key signature on its first measure.
+     * \param music The music to transpose.
+     * \param interval The interval to transpose by.
+     * \throws std::out_of_range If a transposed note gets out of the MIDI range 0 to 127, in which case the music
+     * is left partially transposed. Copy the music first if it should be kept intact on failure.
+     */
+    HIKARI_API void transpose_up(Music& music, Interval interval);
+
+    /**
+     * \brief Transpose a whole piece of music down by an interval in place.
+     * \see transpose_up(Music&, Interval)
+     */
+    HIKARI_API void transpose_down(Music& music, Interval interval);
+
+    /**
+     * \brief Transpose a whole piece of music by a number of semitones in place.
+     * \details The notes are spelled like Note::transposed_up(int) does, and the key signatures are changed to
+     * match. \see transpose_up(Music&, Interval)
+     * \param music The music to transpose.
+     * \param semitones Number of semitones, positive for transposing up and negative for down.
+     */
+    HIKARI_API void transpose(Music& music, int semitones);
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <span>
 #include <vector>
+#include <compare>
 #include <cstdint>
 #include <optional>
 
@@ -48,6 +50,51 @@ namespace hkr
         std::int8_t pitch_id() const; ///< Get the MIDI pitch ID of the note.
     };
 
+    using ChordId = std::uint32_t; ///< ID of a set of notes in a chord pool.
+
+    /**
+     * \brief A hash-consed pool of the note sets of chords.
+     * \details Every distinct sequence of notes is stored once, so that the repeated chords of a score share
+     * their storage, and comparing two chords of the same pool is comparing their IDs.
+     */
+    class HIKARI_API ChordPool
+    {
+    public:
+        static constexpr ChordId rest = 0; ///< ID of the empty note set, which is always in the pool.
+
+        /**
+         * \brief Find the ID of a set of notes, adding the notes to the pool if they are not in it yet.
+         * \param notes The notes of the chord.
+         * \return ID of the notes in this pool.
+         * \throws std::length_error If the pool would hold more than 2^32 notes.
+         */
+        ChordId intern(std::span<const Note> notes);
+
+        /// \brief Get the notes of an ID in this pool.
+        std::span<const Note> operator[](const ChordId id) const noexcept
+        {
+            if (id == rest) // Also the only note set of an empty pool
+                return {};
+            return std::span(notes_).subspan(offsets_[id], offsets_[id + 1] - offsets_[id]);
+        }
+
+        /// \brief Number of note sets, including the rest.
+        std::size_t size() const noexcept { return offsets_.empty() ? 1 : offsets_.size() - 1; }
+        std::size_t memory_usage() const noexcept; ///< Bytes taken by the pool.
+
+        void clear() noexcept; ///< Remove every note set but the rest, keeping the allocated memory.
+
+    private:
+        std::vector<Note> notes_;
+        // Notes of chord i are [offsets_[i], offsets_[i + 1]), empty until the first non-empty chord is added,
+        // so that empty and moved-from pools allocate nothing
+        std::vector<std::uint32_t> offsets_;
+        std::vector<std::uint64_t> hashes_; // Hash of every chord, to skip the comparisons and to rehash
+        std::vector<ChordId> slots_; // Open addressing table, rest (0) marks an empty slot
+
+        void grow();
+    };
+
     /// \brief A chord containing multiple notes.
     struct HIKARI_API Chord
     {
@@ -55,11 +102,13 @@ namespace hkr
         struct HIKARI_API Attributes
         {
             std::optional<float> tempo; ///< Tempo marking of this chord.
+
+            /// \brief Checks whether this attribute set is completely empty.
+            bool is_null() const noexcept { return !tempo; }
         };
 
-        std::vector<Note> notes; ///< Constituents of this chord.
+        ChordId notes = ChordPool::rest; ///< Constituents of this chord, as an ID in the chord pool of the section.
         bool sustained = false; ///< Whether this chord is a prolongation of the previous one.
-        Attributes attributes; ///< Attributes of this chord.
     };
 
     using Voice = std::vector<Chord>; ///< A voice containing multiple chords.
@@ -91,11 +140,74 @@ namespace hkr
         Attributes attributes; ///< Attributes of this measure.
     };
 
+    /**
+     * \brief A repeated passage in a section.
+     * \details The measures of a repeat are written only once in the section, a repeat refers to them by
+     * their indices. The body is followed by the alternative endings, which are laid out one after another.
+     * When there are fewer endings than times the body is played, the first ending is taken by the extra
+     * early passes, e.g. a body played 3 times with 2 endings is played as body, 1st, body, 1st, body, 2nd.
+     */
+    struct HIKARI_API Repeat
+    {
+        std::size_t begin_measure = 0; ///< Index of the first measure of the repeated body.
+        std::size_t end_measure = 0; ///< Index of the measure after the body, i.e. the first one of the endings.
+        int times = 2; ///< Number of times the body is played.
+        std::vector<std::size_t> alternative_ends; ///< Index of the measure after each of the endings.
+
+        /// \brief Index of the first measure of an ending.
+        std::size_t begin_of_alternative(const std::size_t index) const noexcept
+        {
+            return index == 0 ? end_measure : alternative_ends[index - 1];
+        }
+
+        /// \brief Index of the measure after the whole repeated passage, including the endings.
+        std::size_t end_of_alternatives() const noexcept
+        {
+            return alternative_ends.empty() ? end_measure : alternative_ends.back();
+        }
+
+        /**
+         * \brief Find the ending taken in a pass of the body.
+         * \param pass Index of the pass, starting from 0.
+         * \return Index of the ending, or 0 if there are no endings.
+         */
+        std::size_t alternative_of_pass(int pass) const noexcept;
+    };
+
+    /// \brief Position of a chord in a section.
+    struct HIKARI_API ChordPosition
+    {
+        std::size_t beat = 0; ///< Index of the beat in the staff.
+        std::size_t staff = 0; ///< Index of the staff in the section.
+        std::size_t voice = 0; ///< Index of the voice in the beat.
+        std::size_t chord = 0; ///< Index of the chord in the voice.
+
+        /// \brief Positions are ordered by their beats first, then by the staves, the voices and the chords.
+        friend auto operator<=>(const ChordPosition&, const ChordPosition&) noexcept = default;
+    };
+
+    /// \brief Attributes of a chord, together with the position of the chord.
+    struct HIKARI_API ChordAttributes
+    {
+        ChordPosition position; ///< Position of the chord in its section.
+        Chord::Attributes attributes; ///< Attributes of the chord, never completely empty.
+    };
+
     /// \brief A music section, containing multiple staves.
     struct HIKARI_API Section
     {
         std::vector<Staff> staves; ///< The staves
         std::vector<Measure> measures; ///< Measure information
+        std::vector<Repeat> repeats; ///< Repeated passages, sorted by their positions and never overlapping.
+
+        /**
+         * \brief Attributes of the chords, sorted by the positions of the chords.
+         * \details Only the few chords that have any attributes are listed, so that the chords themselves stay
+         * small, and the attribute changes of a section can be walked through without visiting every chord.
+         */
+        std::vector<ChordAttributes> chord_attributes;
+
+        ChordPool chords; ///< Notes of the chords in the staves.
 
         /**
          * \brief Find the starting and ending beat indices of a measure in this section.
@@ -103,6 +215,21 @@ namespace hkr
          * \return A pair of std::size_t being the starting (inclusive) and ending (exclusive) beats' indices.
          */
         std::pair<std::size_t, std::size_t> beat_index_range_of_measure(std::size_t measure) const;
+
+        /**
+         * \brief Find the attributes of a chord in this section.
+         * \param position Position of the chord.
+         * \return Pointer to the attributes, or nullptr if the chord has no attributes.
+         */
+        const Chord::Attributes* attributes_of(const ChordPosition& position) const noexcept;
+
+        /**
+         * \brief Find the tempo in effect at a beat in this section.
+         * \param beat Index of the beat.
+         * \return The tempo of the last tempo marking on a chord in this beat or in an earlier one,
+         * or std::nullopt if there is no such marking in this section.
+         */
+        std::optional<float> tempo_at(std::size_t beat) const noexcept;
     };
 
     using Music = std::vector<Section>; ///< Music structure, containing multiple sections.
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <span>
+
+#include "types.h"
+
+HIKARI_SUPPRESS_EXPORT_WARNING
+namespace hkr
+{
+    /**
+     * \brief A lazily unfolded view of the measures of a section, in the order they are played.
+     * \details The repeated passages are followed without copying any of the measures, so that playback or
+     * timeline consumers can walk through the played music with constant memory. The section, or the repeats
+     * the view is created from, must outlive the view and its iterators.
+     */
+    class HIKARI_API UnfoldedMeasures
+    {
+    public:
+        /// \brief Forward iterator yielding the indices of the played measures.
+        class HIKARI_API iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::size_t;
+            using difference_type = std::ptrdiff_t;
+            using reference = std::size_t;
+
+            iterator() noexcept = default;
+
+            /// \brief Create an iterator pointing to the first played measure of a section.
+            explicit iterator(const Section& section) noexcept: iterator(section.repeats, section.measures.size()) {}
+
+            /// \brief Create an iterator pointing to the first played measure of a sequence of measures with repeats.
+            iterator(std::span<const Repeat> repeats, std::size_t n_measures) noexcept;
+
+            std::size_t operator*() const noexcept { return measure_; } ///< Index of the current measure.
+
+            /// \brief Number of the current pass through a repeated passage starting from 1, or 0 outside of repeats.
+            int pass() const noexcept { return pass_; }
+
+            iterator& operator++() noexcept;
+            iterator operator++(int) noexcept
+            {
+                iterator res = *this;
+                ++*this;
+                return res;
+            }
+
+            friend bool operator==(const iterator& lhs, const iterator& rhs) noexcept
+            {
+                return lhs.measure_ == rhs.measure_ && lhs.repeat_ == rhs.repeat_ && lhs.pass_ == rhs.pass_;
+            }
+            friend bool operator==(const iterator& it, std::default_sentinel_t) noexcept
+            {
+                return it.measure_ == it.n_measures_;
+            }
+
+        private:
+            std::span<const Repeat> repeats_;
+            std::size_t n_measures_ = 0;
+            std::size_t measure_ = 0;
+            std::size_t repeat_ = 0; // The current repeat, or the next one if we are not in a repeat
+            int pass_ = 0;
+
+            void enter_repeat() noexcept;
+        };
+
+        /// \brief Create a view of a section.
+        explicit UnfoldedMeasures(const Section& section) noexcept:
+            UnfoldedMeasures(section.repeats, section.measures.size()) {}
+
+        /**
+         * \brief Create a view of a sequence of measures with repeats, e.g. those of a section read from an archive.
+         * \param repeats The repeats, sorted like those of a section.
+         * \param n_measures Number of the measures.
+         */
+        UnfoldedMeasures(const std::span<const Repeat> repeats, const std::size_t n_measures) noexcept:
+            repeats_(repeats), n_measures_(n_measures) {}
+
+        iterator begin() const noexcept { return iterator(repeats_, n_measures_); }
+        std::default_sentinel_t end() const noexcept { return {}; }
+
+        /// \brief Number of the played measures, computed without unfolding the repeats.
+        std::size_t size() const noexcept;
+
+    private:
+        std::span<const Repeat> repeats_;
+        std::size_t n_measures_;
+    };
+
+    /**
+     * \brief Unfold the repeats of a section lazily.
+     * \param section The section, which must outlive the returned view.
+     * \return A view of the indices of the measures in the order they are played.
+     */
+    inline UnfoldedMeasures unfold(const Section& section) noexcept { return UnfoldedMeasures(section); }
+} // namespace hkr
+HIKARI_RESTORE_EXPORT_WARNING
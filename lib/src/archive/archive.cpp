@@ -0,0 +1,573 @@
+#include "hikari/archive.h"
+
+#include <bit>
+#include <limits>
+#include <fmt/format.h>
+
+#include "archive_utils.h"
+
+namespace hkr::archive
+{
+    using namespace detail;
+
+    namespace
+    {
+        static_assert(sizeof(Header) == 16 + 8 * static_cast<std::size_t>(Table::count));
+        static_assert(sizeof(SectionRecord) == 40);
+        static_assert(sizeof(RepeatRecord) == 20);
+        static_assert(sizeof(MeasureRecord) == 16);
+        static_assert(sizeof(IndexRange) == 8);
+        static_assert(sizeof(ChordRecord) == 8);
+        static_assert(sizeof(ChordAttributesRecord) == 24);
+        static_assert(sizeof(NoteRecord) == 4);
+
+        constexpr char archive_magic[4]{'H', 'K', 'R', 'M'};
+
+        enum MeasureFlags : std::uint8_t
+        {
+            has_key = 1,
+            has_time = 2,
+            has_partial = 4
+        };
+
+        enum ChordFlags : std::uint8_t
+        {
+            is_sustained = 1
+        };
+
+        enum ChordAttributesFlags : std::uint8_t
+        {
+            has_tempo = 1
+        };
+
+        class Serializer
+        {
+        public:
+            std::vector<std::byte> serialize(const Music& music)
+            {
+                ensure_little_endian();
+                sections_.insert(sections_.end(), music.size(), SectionRecord{});
+                for (std::size_t i = 0; i < music.size(); i++)
+                    sections_[i] = write_section(music[i]);
+                return write_blob();
+            }
+
+        private:
+            std::vector<SectionRecord> sections_;
+            std::vector<IndexRange> staves_;
+            std::vector<MeasureRecord> measures_;
+            std::vector<IndexRange> beats_;
+            std::vector<IndexRange> voices_;
+            std::vector<ChordRecord> chords_;
+            std::vector<IndexRange> note_sets_;
+            std::vector<NoteRecord> notes_;
+            std::vector<RepeatRecord> repeats_;
+            std::vector<std::uint32_t> alternatives_;
+            std::vector<ChordAttributesRecord> chord_attributes_;
+
+            template <typename R, typename T, typename F>
+            static IndexRange write_children(std::vector<R>& table, const std::vector<T>& children, F&& write_child)
+            {
+                const auto first = table.size();
+                table.insert(table.end(), children.size(), R{});
+                for (std::size_t i = 0; i < children.size(); i++)
+                    table[first + i] = write_child(children[i]);
+                return {checked_cast<std::uint32_t>(first, "table size"),
+                    checked_cast<std::uint32_t>(children.size(), "table size")};
+            }
+
+            SectionRecord write_section(const Section& section)
+            {
+                return {
+                    .staves = write_children(staves_, section.staves, [this](const Staff& s) { return write_staff(s); }),
+                    .measures = write_children(measures_, section.measures, write_measure),
+                    .repeats = write_children(repeats_, section.repeats, //
+                        [this](const Repeat& r) { return write_repeat(r); }),
+                    .chord_attributes = write_children(
+                        chord_attributes_, section.chord_attributes, write_chord_attributes),
+                    .note_sets = write_chord_pool(section.chords) //
+                };
+            }
+
+            IndexRange write_chord_pool(const ChordPool& pool)
+            {
+                const auto first = note_sets_.size();
+                for (ChordId id = 0; id < pool.size(); id++)
+                {
+                    const auto notes = pool[id];
+                    const auto first_note = notes_.size();
+                    for (const Note note : notes)
+                        notes_.push_back(write_note(note));
+                    note_sets_.push_back({checked_cast<std::uint32_t>(first_note, "table size"),
+                        checked_cast<std::uint32_t>(notes.size(), "table size")});
+                }
+                return {checked_cast<std::uint32_t>(first, "table size"),
+                    checked_cast<std::uint32_t>(pool.size(), "table size")};
+            }
+
+            RepeatRecord write_repeat(const Repeat& repeat)
+            {
+                return {
+                    .begin_measure = checked_cast<std::uint32_t>(repeat.begin_measure, "measure index"),
+                    .end_measure = checked_cast<std::uint32_t>(repeat.end_measure, "measure index"),
+                    .times = checked_cast<std::uint32_t>(repeat.times, "repeat count"),
+                    .alternatives = write_children(alternatives_, repeat.alternative_ends,
+                        [](const std::size_t end) { return checked_cast<std::uint32_t>(end, "measure index"); }) //
+                };
+            }
+
+            static MeasureRecord write_measure(const Measure& measure)
+            {
+                MeasureRecord res{.start_beat = checked_cast<std::uint32_t>(measure.start_beat, "beat index")};
+                const auto& attrs = measure.attributes;
+                if (attrs.key)
+                {
+                    res.flags |= has_key;
+                    res.key = checked_cast<std::int8_t>(*attrs.key, "key signature");
+                }
+                const auto write_time = [](std::uint16_t (&dst)[2], const Time time)
+                {
+                    dst[0] = checked_cast<std::uint16_t>(time.numerator, "time signature numerator");
+                    dst[1] = checked_cast<std::uint16_t>(time.denominator, "time signature denominator");
+                };
+                if (attrs.time)
+                {
+                    res.flags |= has_time;
+                    write_time(res.time, *attrs.time);
+                }
+                if (attrs.partial)
+                {
+                    res.flags |= has_partial;
+                    write_time(res.partial, *attrs.partial);
+                }
+                return res;
+            }
+
+            IndexRange write_staff(const Staff& staff)
+            {
+                return write_children(beats_, staff, [this](const Beat& b) { return write_beat(b); });
+            }
+
+            IndexRange write_beat(const Beat& beat)
+            {
+                return write_children(voices_, beat, [this](const Voice& v) { return write_voice(v); });
+            }
+
+            IndexRange write_voice(const Voice& voice) { return write_children(chords_, voice, write_chord); }
+
+            static ChordRecord write_chord(const Chord& chord)
+            {
+                ChordRecord res{.notes = chord.notes, .flags = 0, .reserved = {}};
+                if (chord.sustained)
+                    res.flags |= is_sustained;
+                return res;
+            }
+
+            static ChordAttributesRecord write_chord_attributes(const ChordAttributes& attrs)
+            {
+                const auto& [beat, staff, voice, chord] = attrs.position;
+                ChordAttributesRecord res{
+                    .beat = checked_cast<std::uint32_t>(beat, "beat index"),
+                    .staff = checked_cast<std::uint32_t>(staff, "staff index"),
+                    .voice = checked_cast<std::uint32_t>(voice, "voice index"),
+                    .chord = checked_cast<std::uint32_t>(chord, "chord index") //
+                };
+                if (attrs.attributes.tempo)
+                {
+                    res.flags |= has_tempo;
+                    res.tempo = *attrs.attributes.tempo;
+                }
+                return res;
+            }
+
+            static NoteRecord write_note(const Note note)
+            {
+                return {
+                    .base = static_cast<std::uint8_t>(note.base),
+                    .accidental = checked_cast<std::int8_t>(note.accidental, "accidental"),
+                    .octave = checked_cast<std::int8_t>(note.octave, "octave") //
+                };
+            }
+
+            std::vector<std::byte> write_blob() const
+            {
+                Header header{.magic = {}, .version = format_version, .size = 0, .reserved = 0, .tables = {}};
+                std::memcpy(header.magic, archive_magic, sizeof(archive_magic));
+                std::size_t size = sizeof(Header);
+                const auto add_table = [&](const Table table, const auto& vec)
+                {
+                    header.tables[static_cast<std::size_t>(table)] = {
+                        .offset = checked_cast<std::uint32_t>(size, "archive size"),
+                        .count = checked_cast<std::uint32_t>(vec.size(), "table size") //
+                    };
+                    size += vec.size() * sizeof(vec[0]);
+                };
+                add_table(Table::sections, sections_);
+                add_table(Table::staves, staves_);
+                add_table(Table::measures, measures_);
+                add_table(Table::beats, beats_);
+                add_table(Table::voices, voices_);
+                add_table(Table::chords, chords_);
+                add_table(Table::note_sets, note_sets_);
+                add_table(Table::notes, notes_);
+                add_table(Table::repeats, repeats_);
+                add_table(Table::alternatives, alternatives_);
+                add_table(Table::chord_attributes, chord_attributes_);
+                header.size = checked_cast<std::uint32_t>(size, "archive size");
+
+                std::vector<std::byte> res(size);
+                std::byte* ptr = res.data();
+                const auto append = [&](const void* data, const std::size_t bytes)
+                {
+                    if (bytes == 0)
+                        return;
+                    std::memcpy(ptr, data, bytes);
+                    ptr += bytes;
+                };
+                const auto append_table = [&](const auto& vec) { append(vec.data(), vec.size() * sizeof(vec[0])); };
+                append(&header, sizeof(Header));
+                append_table(sections_);
+                append_table(staves_);
+                append_table(measures_);
+                append_table(beats_);
+                append_table(voices_);
+                append_table(chords_);
+                append_table(note_sets_);
+                append_table(notes_);
+                append_table(repeats_);
+                append_table(alternatives_);
+                append_table(chord_attributes_);
+                return res;
+            }
+        };
+    } // namespace
+
+    NoteView NoteView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        const auto rec = load_record<NoteRecord>(base, Table::notes, index);
+        return {{.base = static_cast<NoteBase>(rec.base), .octave = rec.octave, .accidental = rec.accidental}};
+    }
+
+    NoteSetView NoteSetView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        return NoteSetView(base, load_record<IndexRange>(base, Table::note_sets, index));
+    }
+
+    MeasureView MeasureView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        const auto rec = load_record<MeasureRecord>(base, Table::measures, index);
+        MeasureView res{{.start_beat = rec.start_beat, .attributes = {}}};
+        if (rec.flags & has_key)
+            res.attributes.key = rec.key;
+        if (rec.flags & has_time)
+            res.attributes.time = Time{rec.time[0], rec.time[1]};
+        if (rec.flags & has_partial)
+            res.attributes.partial = Time{rec.partial[0], rec.partial[1]};
+        return res;
+    }
+
+    ChordAttributesView ChordAttributesView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        const auto rec = load_record<ChordAttributesRecord>(base, Table::chord_attributes, index);
+        ChordAttributesView res{{
+            .position = {.beat = rec.beat, .staff = rec.staff, .voice = rec.voice, .chord = rec.chord},
+            .attributes = {} //
+        }};
+        if (rec.flags & has_tempo)
+            res.attributes.tempo = rec.tempo;
+        return res;
+    }
+
+    RepeatView RepeatView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        RepeatView res;
+        res.base_ = base;
+        res.record_ = load_record<RepeatRecord>(base, Table::repeats, index);
+        return res;
+    }
+
+    std::size_t RepeatView::alternative_end(const std::size_t index) const noexcept
+    {
+        return load_record<std::uint32_t>(base_, Table::alternatives, record_.alternatives.first + index);
+    }
+
+    Repeat RepeatView::to_repeat() const
+    {
+        Repeat res{.begin_measure = begin_measure(), .end_measure = end_measure(), .times = times()};
+        res.alternative_ends.reserve(alternative_count());
+        for (std::size_t i = 0; i < alternative_count(); i++)
+            res.alternative_ends.push_back(alternative_end(i));
+        return res;
+    }
+
+    ChordView ChordView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        ChordView res;
+        res.base_ = base;
+        res.record_ = load_record<ChordRecord>(base, Table::chords, index);
+        return res;
+    }
+
+    Chord ChordView::to_chord() const { return {.notes = notes(), .sustained = sustained()}; }
+
+    VoiceView VoiceView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        return VoiceView(base, load_record<IndexRange>(base, Table::voices, index));
+    }
+
+    Voice VoiceView::to_voice() const
+    {
+        Voice res;
+        res.reserve(size());
+        for (const auto chord : *this)
+            res.push_back(chord.to_chord());
+        return res;
+    }
+
+    BeatView BeatView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        return BeatView(base, load_record<IndexRange>(base, Table::beats, index));
+    }
+
+    Beat BeatView::to_beat() const
+    {
+        Beat res;
+        res.reserve(size());
+        for (const auto voice : *this)
+            res.push_back(voice.to_voice());
+        return res;
+    }
+
+    StaffView StaffView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        return StaffView(base, load_record<IndexRange>(base, Table::staves, index));
+    }
+
+    Staff StaffView::to_staff() const
+    {
+        Staff res;
+        res.reserve(size());
+        for (const auto beat : *this)
+            res.push_back(beat.to_beat());
+        return res;
+    }
+
+    SectionView SectionView::load(const std::byte* base, const std::size_t index) noexcept
+    {
+        SectionView res;
+        res.base_ = base;
+        res.record_ = load_record<SectionRecord>(base, Table::sections, index);
+        return res;
+    }
+
+    std::pair<std::size_t, std::size_t> SectionView::beat_index_range_of_measure(const std::size_t measure) const noexcept
+    {
+        const auto all = measures();
+        const std::size_t start = all[measure].start_beat;
+        if (all.size() != measure + 1)
+            return {start, all[measure + 1].start_beat};
+        // A section without staves has no beats
+        return {start, staves().empty() ? start : staves()[0].size()};
+    }
+
+    Section SectionView::to_section() const
+    {
+        Section res;
+        res.staves.reserve(staves().size());
+        for (const auto staff : staves())
+            res.staves.push_back(staff.to_staff());
+        const auto measure_views = measures();
+        res.measures.assign(measure_views.begin(), measure_views.end());
+        res.repeats.reserve(repeats().size());
+        for (const auto repeat : repeats())
+            res.repeats.push_back(repeat.to_repeat());
+        const auto attribute_views = chord_attributes();
+        res.chord_attributes.assign(attribute_views.begin(), attribute_views.end());
+        std::vector<Note> notes;
+        for (std::size_t i = 0; const auto note_set : chords())
+        {
+            notes.assign(note_set.begin(), note_set.end());
+            // The IDs of the chords stay valid only if the pool is rebuilt in the same order
+            if (res.chords.intern(notes) != i++)
+                throw ArchiveError("The chord pool of a section in the archive is malformed");
+        }
+        return res;
+    }
+
+    MusicView::MusicView(const std::span<const std::byte> bytes): bytes_(bytes)
+    {
+        ensure_little_endian();
+        if (bytes.size() < sizeof(Header))
+            throw ArchiveError("The archive is too small to contain a header");
+        const auto header = load<Header>(bytes.data());
+        if (std::memcmp(header.magic, archive_magic, sizeof(archive_magic)) != 0)
+            throw ArchiveError("The data is not a music archive");
+        if (header.version != format_version)
+            throw ArchiveError(fmt::format(
+                "Archive format version {} is not supported, expecting version {}", header.version, format_version));
+        if (header.size > bytes.size())
+            throw ArchiveError(fmt::format(
+                "The archive is truncated, expecting {} bytes but got {} bytes", header.size, bytes.size()));
+
+        static constexpr std::size_t record_sizes[]{
+            sizeof(SectionRecord), sizeof(IndexRange), sizeof(MeasureRecord), //
+            sizeof(IndexRange), sizeof(IndexRange), sizeof(ChordRecord), sizeof(IndexRange), sizeof(NoteRecord), //
+            sizeof(RepeatRecord), sizeof(std::uint32_t), sizeof(ChordAttributesRecord) //
+        };
+        for (std::size_t i = 0; i < std::size(record_sizes); i++)
+        {
+            const auto [offset, count] = header.tables[i];
+            if (offset < sizeof(Header) || offset > header.size ||
+                std::size_t{count} * record_sizes[i] > header.size - offset)
+                throw ArchiveError("A table in the archive lies out of the archive bounds");
+        }
+
+        bytes_ = bytes.first(header.size);
+        static_cast<ArchiveRange&>(*this) = ArchiveRange(bytes_.data(), {0, header.tables[0].count});
+    }
+
+    void MusicView::verify() const
+    {
+        const auto header = load<Header>(bytes_.data());
+        const auto check = [&](const IndexRange range, const Table table)
+        {
+            const std::uint64_t end = std::uint64_t{range.first} + range.count;
+            if (end > header.tables[static_cast<std::size_t>(table)].count)
+                throw ArchiveError("An index range in the archive is out of bounds");
+        };
+        // Same restrictions as the parser puts on time signatures
+        const auto is_valid_time = [](const Time time)
+        {
+            return time.numerator >= 1 && time.numerator <= 128 && time.denominator >= 1 && time.denominator <= 128 &&
+                std::has_single_bit(static_cast<unsigned>(time.denominator));
+        };
+
+        Time time; // The time signature carries over to the following sections
+        ChordPool pool;
+        std::vector<Note> notes;
+        for (const auto section : *this)
+        {
+            check(section.staves().index_range(), Table::staves);
+            check(section.measures().index_range(), Table::measures);
+            check(section.repeats().index_range(), Table::repeats);
+            check(section.chord_attributes().index_range(), Table::chord_attributes);
+            check(section.chords().index_range(), Table::note_sets);
+
+            // The chord pool starts with the rest, and every note set is stored once, as the serializer writes them
+            const auto note_sets = section.chords();
+            pool.clear();
+            for (std::size_t i = 0; const auto note_set : note_sets)
+            {
+                check(note_set.index_range(), Table::notes);
+                notes.assign(note_set.begin(), note_set.end());
+                if (pool.intern(notes) != i++)
+                    throw ArchiveError("The chord pool of a section in the archive is malformed");
+            }
+            if (note_sets.empty())
+                throw ArchiveError("The chord pool of a section in the archive is malformed");
+
+            // Every staff should have the same number of beats, and there are no empty beats or voices
+            const auto staves = section.staves();
+            const std::size_t n_beats = staves.empty() ? 0 : staves[0].size();
+            for (const auto staff : staves)
+            {
+                check(staff.index_range(), Table::beats);
+                if (staff.size() != n_beats)
+                    throw ArchiveError("The staves of a section in the archive have different numbers of beats");
+                for (const auto beat : staff)
+                {
+                    check(beat.index_range(), Table::voices);
+                    if (beat.empty())
+                        throw ArchiveError("A beat in the archive has no voices");
+                    for (const auto voice : beat)
+                    {
+                        check(voice.index_range(), Table::chords);
+                        if (voice.empty())
+                            throw ArchiveError("A voice in the archive has no chords");
+                        for (const auto chord : voice)
+                            if (chord.notes() >= note_sets.size())
+                                throw ArchiveError("A chord in the archive refers to an invalid note set");
+                    }
+                }
+            }
+
+            // Measures should cover all the beats in order, each of them being no longer than its time
+            const auto measures = section.measures();
+            if (measures.empty() != (n_beats == 0) || (!measures.empty() && measures[0].start_beat != 0))
+                throw ArchiveError("The measures of a section in the archive do not cover its beats");
+            for (std::size_t i = 0; i < measures.size(); i++)
+            {
+                const auto& attrs = measures[i].attributes;
+                if (attrs.key && (*attrs.key < -7 || *attrs.key > 7))
+                    throw ArchiveError("A measure in the archive has an invalid key signature");
+                if ((attrs.time && !is_valid_time(*attrs.time)) || (attrs.partial && !is_valid_time(*attrs.partial)))
+                    throw ArchiveError("A measure in the archive has an invalid time signature");
+                if (attrs.time)
+                    time = *attrs.time;
+                const Time partial = attrs.partial ? *attrs.partial : time;
+                const std::size_t start = measures[i].start_beat;
+                const std::size_t stop = i + 1 == measures.size() ? n_beats : measures[i + 1].start_beat;
+                if (stop <= start || stop - start > static_cast<std::size_t>(partial.numerator))
+                    throw ArchiveError("A measure in the archive has an invalid range of beats");
+            }
+
+            // Repeats should be sorted, non-overlapping and inside the section
+            std::size_t last_end = 0;
+            for (const auto repeat : section.repeats())
+            {
+                check(repeat.alternatives_index_range(), Table::alternatives);
+                std::size_t end = repeat.end_measure();
+                bool valid = repeat.begin_measure() >= last_end && repeat.begin_measure() < end &&
+                    repeat.times() >= std::max<int>(1, static_cast<int>(repeat.alternative_count()));
+                for (std::size_t i = 0; i < repeat.alternative_count(); i++)
+                {
+                    valid = valid && repeat.alternative_end(i) > end;
+                    end = repeat.alternative_end(i);
+                }
+                if (!valid || end > measures.size())
+                    throw ArchiveError("A repeat in the archive refers to invalid measures");
+                last_end = end;
+            }
+
+            // Chord attributes should be non-empty, sorted by their positions and refer to existing chords
+            std::optional<ChordPosition> last_position;
+            for (const auto& [position, attrs] : section.chord_attributes())
+            {
+                const auto& [beat, staff, voice, chord] = position;
+                const bool exists = staff < staves.size() && beat < n_beats && //
+                    voice < staves[staff][beat].size() && chord < staves[staff][beat][voice].size();
+                if (!exists || (last_position && position <= *last_position))
+                    throw ArchiveError("A chord attribute set in the archive refers to an invalid chord");
+                if (attrs.is_null() || !(*attrs.tempo >= 10 && *attrs.tempo <= 1000))
+                    throw ArchiveError("A chord attribute set in the archive has an invalid tempo");
+                last_position = position;
+            }
+        }
+
+        for (std::size_t i = 0; i < header.tables[static_cast<std::size_t>(Table::notes)].count; i++)
+        {
+            const auto rec = load_record<NoteRecord>(bytes_.data(), Table::notes, i);
+            if (rec.base >= 7 || rec.accidental < -2 || rec.accidental > 2)
+                throw ArchiveError("A note in the archive has an invalid name");
+            try
+            {
+                (void)NoteView::load(bytes_.data(), i).pitch_id();
+            }
+            catch (const std::out_of_range&)
+            {
+                throw ArchiveError("A note in the archive has a pitch out of the range 0 to 127");
+            }
+        }
+    }
+
+    Music MusicView::to_music() const
+    {
+        Music res;
+        res.reserve(size());
+        for (const auto section : *this)
+            res.push_back(section.to_section());
+        return res;
+    }
+
+    std::vector<std::byte> serialize(const Music& music) { return Serializer().serialize(music); }
+} // namespace hkr::archive
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <bit>
+#include <utility>
+#include <fmt/format.h>
+
+#include "hikari/archive.h"
+
+namespace hkr::archive
+{
+    // Archives are read in place, so the records must have the same byte order as the host
+    inline void ensure_little_endian()
+    {
+        if constexpr (std::endian::native != std::endian::little)
+            throw ArchiveError("Binary archives are only supported on little-endian platforms");
+    }
+
+    template <typename T>
+    T checked_cast(const auto value, const std::string_view what)
+    {
+        if (!std::in_range<T>(value))
+            throw ArchiveError(fmt::format("The {} ({}) cannot be represented in the archive format", what, value));
+        return static_cast<T>(value);
+    }
+} // namespace hkr::archive
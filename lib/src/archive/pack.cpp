@@ -0,0 +1,167 @@
+#include "hikari/archive.h"
+
+#include <algorithm>
+#include <tuple>
+#include <fmt/format.h>
+
+#include "archive_utils.h"
+#include "../hash.h"
+
+namespace hkr::archive
+{
+    namespace
+    {
+        constexpr char pack_magic[4]{'H', 'K', 'R', 'P'};
+
+        struct PackHeader
+        {
+            char magic[4]; // "HKRP"
+            std::uint32_t version;
+            std::uint64_t count;
+            std::uint64_t size; // Total size of the pack in bytes
+        };
+
+        // Index entries are sorted by (hash, name)
+        struct IndexEntry
+        {
+            std::uint64_t hash;
+            std::uint64_t name_offset;
+            std::uint64_t data_offset;
+            std::uint32_t name_size;
+            std::uint32_t data_size;
+        };
+
+        static_assert(sizeof(PackHeader) == 24);
+        static_assert(sizeof(IndexEntry) == 32);
+
+        constexpr std::size_t entry_alignment = 8;
+
+        std::size_t align_up(const std::size_t value) noexcept
+        {
+            return (value + entry_alignment - 1) / entry_alignment * entry_alignment;
+        }
+
+        IndexEntry load_entry(const std::span<const std::byte> bytes, const std::size_t index) noexcept
+        {
+            return detail::load<IndexEntry>(bytes.data() + sizeof(PackHeader) + index * sizeof(IndexEntry));
+        }
+
+        std::string_view entry_name(const std::span<const std::byte> bytes, const IndexEntry& entry) noexcept
+        {
+            return {reinterpret_cast<const char*>(bytes.data() + entry.name_offset), entry.name_size};
+        }
+    } // namespace
+
+    void PackBuilder::add(std::string name, const Music& music) { add_archive(std::move(name), serialize(music)); }
+
+    void PackBuilder::add_archive(std::string name, const std::span<const std::byte> archive)
+    {
+        const MusicView view(archive);
+        view.verify();
+        const auto hash = hash_bytes(name);
+        const auto iter = std::ranges::lower_bound(entries_, std::tie(hash, name), std::less{},
+            [](const Entry& entry) { return std::tie(entry.hash, entry.name); });
+        if (iter != entries_.end() && iter->hash == hash && iter->name == name)
+            throw ArchiveError(fmt::format("An entry named '{}' already exists in the pack", name));
+        const auto bytes = view.bytes();
+        entries_.insert(iter, {.hash = hash, .name = std::move(name), .data = {bytes.begin(), bytes.end()}});
+    }
+
+    std::vector<std::byte> PackBuilder::build() const
+    {
+        ensure_little_endian();
+
+        std::vector<IndexEntry> index(entries_.size());
+        std::size_t size = sizeof(PackHeader) + entries_.size() * sizeof(IndexEntry);
+        for (std::size_t i = 0; const auto& entry : entries_)
+        {
+            index[i].hash = entry.hash;
+            index[i].name_offset = size;
+            index[i].name_size = checked_cast<std::uint32_t>(entry.name.size(), "entry name length");
+            size = align_up(size + entry.name.size());
+            index[i].data_offset = size;
+            index[i].data_size = checked_cast<std::uint32_t>(entry.data.size(), "archive size");
+            size = align_up(size + entry.data.size());
+            i++;
+        }
+
+        std::vector<std::byte> res(size);
+        PackHeader header{.magic = {}, .version = format_version, .count = entries_.size(), .size = size};
+        std::memcpy(header.magic, pack_magic, sizeof(pack_magic));
+        std::memcpy(res.data(), &header, sizeof(PackHeader));
+        if (!index.empty())
+            std::memcpy(res.data() + sizeof(PackHeader), index.data(), index.size() * sizeof(IndexEntry));
+        for (std::size_t i = 0; const auto& entry : entries_)
+        {
+            std::memcpy(res.data() + index[i].name_offset, entry.name.data(), entry.name.size());
+            if (!entry.data.empty())
+                std::memcpy(res.data() + index[i].data_offset, entry.data.data(), entry.data.size());
+            i++;
+        }
+        return res;
+    }
+
+    PackView::PackView(const std::span<const std::byte> bytes)
+    {
+        ensure_little_endian();
+        if (bytes.size() < sizeof(PackHeader))
+            throw ArchiveError("The pack is too small to contain a header");
+        const auto header = detail::load<PackHeader>(bytes.data());
+        if (std::memcmp(header.magic, pack_magic, sizeof(pack_magic)) != 0)
+            throw ArchiveError("The data is not a music pack");
+        if (header.version != format_version)
+            throw ArchiveError(fmt::format(
+                "Pack format version {} is not supported, expecting version {}", header.version, format_version));
+        if (header.size > bytes.size())
+            throw ArchiveError(fmt::format(
+                "The pack is truncated, expecting {} bytes but got {} bytes", header.size, bytes.size()));
+        if (header.size < sizeof(PackHeader))
+            throw ArchiveError("The pack size is too small to contain its header");
+        if (header.count > (header.size - sizeof(PackHeader)) / sizeof(IndexEntry))
+            throw ArchiveError("The pack index lies out of the pack bounds");
+
+        bytes_ = bytes.first(static_cast<std::size_t>(header.size));
+        size_ = static_cast<std::size_t>(header.count);
+        for (std::size_t i = 0; i < size_; i++)
+        {
+            const auto entry = load_entry(bytes_, i);
+            if (entry.name_offset > header.size || entry.name_size > header.size - entry.name_offset ||
+                entry.data_offset > header.size || entry.data_size > header.size - entry.data_offset)
+                throw ArchiveError("An entry in the pack lies out of the pack bounds");
+        }
+    }
+
+    std::string_view PackView::name(const std::size_t index) const noexcept
+    {
+        return entry_name(bytes_, load_entry(bytes_, index));
+    }
+
+    MusicView PackView::operator[](const std::size_t index) const
+    {
+        const auto entry = load_entry(bytes_, index);
+        return MusicView(bytes_.subspan(static_cast<std::size_t>(entry.data_offset), entry.data_size));
+    }
+
+    std::optional<MusicView> PackView::find(const std::string_view name) const
+    {
+        const auto hash = hash_bytes(name);
+        std::size_t low = 0, high = size_;
+        while (low < high) // Find the first entry with a hash no less than the required one
+        {
+            const std::size_t mid = low + (high - low) / 2;
+            if (load_entry(bytes_, mid).hash < hash)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        for (; low < size_; low++)
+        {
+            const auto entry = load_entry(bytes_, low);
+            if (entry.hash != hash)
+                break;
+            if (entry_name(bytes_, entry) == name)
+                return (*this)[low];
+        }
+        return std::nullopt;
+    }
+} // namespace hkr::archive
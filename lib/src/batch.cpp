@@ -0,0 +1,136 @@
+#include "hikari/batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+
+#include "hikari/engine.h"
+#include "thread_pool.h"
+#include "tracing.h"
+
+namespace hkr
+{
+    namespace
+    {
+        // Stream buffer appending to a string, which keeps its capacity between the items
+        class StringAppendBuffer final : public std::streambuf
+        {
+        public:
+            explicit StringAppendBuffer(std::string& str) noexcept: str_(str) {}
+
+        protected:
+            std::streamsize xsputn(const char* str, const std::streamsize count) override
+            {
+                str_.append(str, static_cast<std::size_t>(count));
+                return count;
+            }
+
+            int_type overflow(const int_type ch) override
+            {
+                if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                    str_.push_back(traits_type::to_char_type(ch));
+                return ch;
+            }
+
+        private:
+            std::string& str_;
+        };
+
+        // Scratch memory and statistics of a worker thread
+        struct WorkerState
+        {
+            Engine engine;
+            std::string output;
+            Statistics parse_stats;
+            Statistics export_stats;
+        };
+
+        void convert_item(const BatchItem& item, BatchResult& result, WorkerState& state, const BatchOptions& options)
+        {
+            using Clock = std::chrono::steady_clock;
+            const auto begin = Clock::now();
+            try
+            {
+                ParseOptions parse_options = options.parse_options;
+                if (parse_options.statistics)
+                    parse_options.statistics = &state.parse_stats;
+                ExportOptions export_options = options.export_options;
+                if (export_options.statistics)
+                    export_options.statistics = &state.export_stats;
+
+                // Format into the scratch string first, so that nothing is written if the item fails
+                state.output.clear();
+                StringAppendBuffer buffer(state.output);
+                std::ostream stream(&buffer);
+                state.engine.convert_to_lilypond(stream, item.input, parse_options, export_options);
+                if (item.output)
+                    item.output->write(state.output.data(), static_cast<std::streamsize>(state.output.size()));
+            }
+            catch (const std::exception& exc)
+            {
+                result.error = std::current_exception();
+                result.message = exc.what();
+            }
+            catch (...)
+            {
+                result.error = std::current_exception();
+                result.message = "Unknown error";
+            }
+            result.nanoseconds = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+        }
+    } // namespace
+
+    std::vector<BatchResult> convert_batch(const std::span<const BatchItem> items, const BatchOptions& options)
+    {
+        std::vector<BatchResult> results(items.size());
+        if (items.empty())
+            return results;
+
+        const std::size_t hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        const std::size_t n_threads = std::min(options.n_threads == 0 ? hardware_threads : options.n_threads, //
+            items.size());
+        const std::size_t max_in_flight = options.max_in_flight == 0 ? 2 * n_threads : options.max_in_flight;
+        std::vector<WorkerState> workers(n_threads);
+
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::size_t in_flight = 0;
+            ThreadPool pool(n_threads); // Destroyed first, after finishing all the items
+            for (std::size_t i = 0; i < items.size(); i++)
+            {
+                {
+                    std::unique_lock lock(mutex);
+                    cv.wait(lock, [&] { return in_flight < max_in_flight; });
+                    in_flight++;
+                }
+                pool.submit(
+                    [&, i](const std::size_t worker)
+                    {
+                        {
+                            HIKARI_TRACE_ZONE("batch item", i);
+                            convert_item(items[i], results[i], workers[worker], options);
+                        }
+                        {
+                            const std::scoped_lock lock(mutex);
+                            in_flight--;
+                        }
+                        cv.notify_one();
+                    });
+            }
+        }
+
+        for (const auto& worker : workers)
+        {
+            if (Statistics* stats = options.parse_options.statistics)
+                *stats += worker.parse_stats;
+            if (Statistics* stats = options.export_options.statistics)
+                *stats += worker.export_stats;
+        }
+        return results;
+    }
+} // namespace hkr
@@ -0,0 +1,46 @@
+#include "budget.h"
+
+#include <fmt/format.h>
+
+namespace hkr
+{
+    namespace
+    {
+        std::string_view description(const Limit limit) noexcept
+        {
+            switch (limit)
+            {
+                case Limit::expanded_bytes: return "expanded text length";
+                case Limit::notes: return "number of notes";
+                case Limit::beats: return "number of beats";
+                case Limit::measures: return "number of measures";
+                case Limit::voices: return "number of voices";
+                case Limit::subdivision: return "number of chords in a beat";
+                case Limit::allocated_bytes: return "estimated memory usage in bytes";
+                default: return "resource usage";
+            }
+        }
+    } // namespace
+
+    ResourceBudget::ResourceBudget(const ParseOptions& options) noexcept:
+        limits_{options.max_expanded_bytes, options.max_notes, options.max_beats, options.max_measures,
+            options.max_voices, options.max_subdivision, options.max_allocated_bytes},
+        statistics_(options.statistics)
+    {
+    }
+
+    ResourceBudget::ResourceBudget(const ExportOptions& options) noexcept:
+        limits_{unlimited, options.max_notes, unlimited, options.max_measures, options.max_voices,
+            options.max_subdivision, options.max_allocated_bytes},
+        statistics_(options.statistics)
+    {
+    }
+
+    void ResourceBudget::fail(const Limit limit, const std::size_t value, const std::string_view where) const
+    {
+        const auto max = limits_[index(limit)];
+        throw LimitExceededError(limit, max,
+            fmt::format("The {} ({}) exceeds the limit of {}{}{}", description(limit), value, max,
+                where.empty() ? "" : ", ", where));
+    }
+} // namespace hkr
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+#include <utility>
+
+#include "hikari/options.h"
+#include "statistics.h"
+
+namespace hkr
+{
+    // Tracks the resources used by a single parse or export request against its limits.
+    // One budget is shared by all the stages of a request, so that the allocated bytes add up.
+    // It also carries the statistics object of the request, if the caller asked for one.
+    class ResourceBudget
+    {
+    public:
+        ResourceBudget() noexcept { limits_.fill(unlimited); }
+        explicit ResourceBudget(const ParseOptions& options) noexcept;
+        explicit ResourceBudget(const ExportOptions& options) noexcept;
+
+        std::size_t limit(const Limit limit) const noexcept { return limits_[index(limit)]; }
+        Statistics* statistics() const noexcept { return statistics_; }
+
+        // Check a quantity that is not accumulated, like the length of a macro
+        void check(const Limit limit, const std::size_t value) const
+        {
+            if (value > limits_[index(limit)]) [[unlikely]]
+                fail(limit, value, {});
+        }
+
+        // The description of where the limit is exceeded is only formatted on failure
+        template <typename F>
+        void check(const Limit limit, const std::size_t value, F&& where) const
+        {
+            if (value > limits_[index(limit)]) [[unlikely]]
+                fail(limit, value, where());
+        }
+
+        // Accumulate a quantity like the number of notes
+        void add(const Limit limit, const std::size_t amount = 1)
+        {
+            auto& used = used_[index(limit)];
+            used += amount;
+            check(limit, used);
+        }
+
+        template <typename F>
+        void add(const Limit limit, const std::size_t amount, F&& where)
+        {
+            auto& used = used_[index(limit)];
+            used += amount;
+            check(limit, used, std::forward<F>(where));
+        }
+
+        void allocate(const std::size_t bytes) { add(Limit::allocated_bytes, bytes); }
+
+        std::size_t used(const Limit limit) const noexcept { return used_[index(limit)]; }
+
+        [[noreturn]] void fail(Limit limit, std::size_t value, std::string_view where) const;
+
+    private:
+        static constexpr std::size_t n_limits = static_cast<std::size_t>(Limit::allocated_bytes) + 1;
+
+        std::array<std::size_t, n_limits> limits_{};
+        std::array<std::size_t, n_limits> used_{};
+        Statistics* statistics_ = nullptr;
+
+        static constexpr std::size_t index(const Limit limit) noexcept { return static_cast<std::size_t>(limit); }
+    };
+} // namespace hkr
@@ -0,0 +1,214 @@
+#include "hikari/cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "hikari/api.h"
+#include "hash.h"
+
+namespace hkr
+{
+    namespace
+    {
+        template <typename T>
+        std::size_t vector_bytes(const std::vector<T>& vec) noexcept
+        {
+            return vec.capacity() * sizeof(T);
+        }
+
+        std::size_t estimate_memory_usage(const Music& music) noexcept
+        {
+            std::size_t res = vector_bytes(music);
+            for (const auto& section : music)
+            {
+                res += vector_bytes(section.staves) + vector_bytes(section.measures) + vector_bytes(section.repeats) +
+                    vector_bytes(section.chord_attributes) + section.chords.memory_usage();
+                for (const auto& repeat : section.repeats)
+                    res += vector_bytes(repeat.alternative_ends);
+                for (const auto& staff : section.staves)
+                {
+                    res += vector_bytes(staff);
+                    for (const auto& beat : staff)
+                    {
+                        res += vector_bytes(beat);
+                        for (const auto& voice : beat)
+                            res += vector_bytes(voice);
+                    }
+                }
+            }
+            return res;
+        }
+
+        struct Entry
+        {
+            std::uint64_t hash = 0;
+            std::string text;
+            std::shared_ptr<const CachedResult> result;
+            std::size_t bytes = 0;
+        };
+
+        class Shard
+        {
+        public:
+            std::shared_ptr<const CachedResult> find(const std::uint64_t hash, const std::string_view text)
+            {
+                std::scoped_lock lock(mutex_);
+                const auto iter = index_.find(hash);
+                if (iter == index_.end() || iter->second->text != text)
+                    return nullptr;
+                lru_.splice(lru_.begin(), lru_, iter->second); // Mark as most recently used
+                return iter->second->result;
+            }
+
+            std::shared_ptr<const CachedResult> insert(Entry entry, const std::size_t budget, std::uint64_t& evictions)
+            {
+                std::scoped_lock lock(mutex_);
+                if (const auto iter = index_.find(entry.hash); iter != index_.end())
+                {
+                    // Another thread computed the same input concurrently, keep the existing result
+                    if (iter->second->text == entry.text)
+                        return iter->second->result;
+                    erase(iter->second); // Hash collision, the newer entry wins
+                }
+                if (entry.bytes > budget) // Too large to be cached at all
+                    return std::move(entry.result);
+                while (bytes_ + entry.bytes > budget)
+                {
+                    erase(std::prev(lru_.end()));
+                    evictions++;
+                }
+                bytes_ += entry.bytes;
+                lru_.push_front(std::move(entry));
+                index_[lru_.front().hash] = lru_.begin();
+                return lru_.front().result;
+            }
+
+            void clear()
+            {
+                std::scoped_lock lock(mutex_);
+                lru_.clear();
+                index_.clear();
+                bytes_ = 0;
+            }
+
+            void add_statistics(CacheStatistics& stats)
+            {
+                std::scoped_lock lock(mutex_);
+                stats.entries += lru_.size();
+                stats.bytes += bytes_;
+            }
+
+        private:
+            using EntryIter = std::list<Entry>::iterator;
+
+            std::mutex mutex_;
+            std::list<Entry> lru_; // Most recently used at the front
+            std::unordered_map<std::uint64_t, EntryIter> index_;
+            std::size_t bytes_ = 0;
+
+            void erase(const EntryIter iter)
+            {
+                bytes_ -= iter->bytes;
+                index_.erase(iter->hash);
+                lru_.erase(iter);
+            }
+        };
+    } // namespace
+
+    class ResultCache::Impl
+    {
+    public:
+        Impl(const std::size_t byte_budget, const std::size_t n_shards, const ParseOptions& parse_options,
+            const ExportOptions& export_options):
+            shards_(std::max(n_shards, std::size_t{1})), shard_budget_(byte_budget / shards_.size()),
+            parse_options_(parse_options), export_options_(export_options)
+        {
+            // Concurrent lookups would race on the statistics objects
+            parse_options_.statistics = nullptr;
+            export_options_.statistics = nullptr;
+        }
+
+        std::shared_ptr<const CachedResult> get(const std::string_view text)
+        {
+            const auto hash = hash_bytes(text);
+            Shard& shard = shard_of(hash);
+            if (auto res = shard.find(hash, text))
+            {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return res;
+            }
+            misses_.fetch_add(1, std::memory_order_relaxed);
+
+            // Compute without holding the lock, so that other inputs in this shard are not blocked
+            auto result = std::make_shared<CachedResult>();
+            result->music = parse_music(std::string(text), parse_options_);
+            std::ostringstream stream;
+            export_to_lilypond(stream, result->music, export_options_);
+            result->lilypond = std::move(stream).str();
+
+            const std::size_t bytes = sizeof(Entry) + sizeof(CachedResult) + text.size() +
+                estimate_memory_usage(result->music) + result->lilypond.capacity();
+            std::uint64_t evictions = 0;
+            auto res = shard.insert(
+                {.hash = hash, .text = std::string(text), .result = std::move(result), .bytes = bytes}, //
+                shard_budget_, evictions);
+            evictions_.fetch_add(evictions, std::memory_order_relaxed);
+            return res;
+        }
+
+        std::shared_ptr<const CachedResult> find(const std::string_view text)
+        {
+            const auto hash = hash_bytes(text);
+            auto res = shard_of(hash).find(hash, text);
+            (res ? hits_ : misses_).fetch_add(1, std::memory_order_relaxed);
+            return res;
+        }
+
+        void clear()
+        {
+            for (auto& shard : shards_)
+                shard.clear();
+        }
+
+        CacheStatistics statistics()
+        {
+            CacheStatistics res{
+                .hits = hits_.load(std::memory_order_relaxed),
+                .misses = misses_.load(std::memory_order_relaxed),
+                .evictions = evictions_.load(std::memory_order_relaxed) //
+            };
+            for (auto& shard : shards_)
+                shard.add_statistics(res);
+            return res;
+        }
+
+    private:
+        std::vector<Shard> shards_;
+        std::size_t shard_budget_;
+        ParseOptions parse_options_;
+        ExportOptions export_options_;
+        std::atomic<std::uint64_t> hits_{0};
+        std::atomic<std::uint64_t> misses_{0};
+        std::atomic<std::uint64_t> evictions_{0};
+
+        // The low bits of the hash are used by the hash maps in the shards, so use the high bits here
+        Shard& shard_of(const std::uint64_t hash) { return shards_[(hash >> 32) % shards_.size()]; }
+    };
+
+    ResultCache::ResultCache(const std::size_t byte_budget, const std::size_t n_shards,
+        const ParseOptions& parse_options, const ExportOptions& export_options):
+        impl_(std::make_unique<Impl>(byte_budget, n_shards, parse_options, export_options))
+    {
+    }
+
+    ResultCache::~ResultCache() noexcept = default;
+
+    std::shared_ptr<const CachedResult> ResultCache::get(const std::string_view text) { return impl_->get(text); }
+    std::shared_ptr<const CachedResult> ResultCache::find(const std::string_view text) { return impl_->find(text); }
+    void ResultCache::clear() { impl_->clear(); }
+    CacheStatistics ResultCache::statistics() const { return impl_->statistics(); }
+} // namespace hkr
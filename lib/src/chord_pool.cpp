@@ -0,0 +1,91 @@
+#include "hikari/types.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace hkr
+{
+    namespace
+    {
+        // Note has padding bytes, so we hash the fields instead of the object representation
+        std::uint64_t hash_notes(const std::span<const Note> notes) noexcept
+        {
+            Hasher hasher;
+            for (const Note note : notes)
+                hasher.update(static_cast<std::uint64_t>(note.base) |
+                    static_cast<std::uint64_t>(static_cast<std::uint32_t>(note.octave)) << 8 |
+                    static_cast<std::uint64_t>(static_cast<std::uint8_t>(note.accidental)) << 40);
+            return hasher.digest();
+        }
+
+        bool equal_notes(const std::span<const Note> lhs, const std::span<const Note> rhs) noexcept
+        {
+            return std::ranges::equal(lhs, rhs, [](const Note l, const Note r) noexcept
+                { return l.base == r.base && l.octave == r.octave && l.accidental == r.accidental; });
+        }
+    } // namespace
+
+    ChordId ChordPool::intern(const std::span<const Note> notes)
+    {
+        if (notes.empty())
+            return rest;
+        if (offsets_.empty())
+        {
+            offsets_.assign(2, 0);
+            hashes_.assign(1, 0);
+        }
+        if ((size() + 1) * 4 > slots_.size() * 3) // Keep the load factor under 3/4
+            grow();
+
+        const std::uint64_t hash = hash_notes(notes);
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const ChordId id = slots_[i];
+            if (id == rest)
+            {
+                if (notes_.size() + notes.size() > UINT32_MAX)
+                    throw std::length_error("Too many notes in the chord pool");
+                const auto new_id = static_cast<ChordId>(size());
+                notes_.insert(notes_.end(), notes.begin(), notes.end());
+                offsets_.push_back(static_cast<std::uint32_t>(notes_.size()));
+                hashes_.push_back(hash);
+                slots_[i] = new_id;
+                return new_id;
+            }
+            if (hashes_[id] == hash && equal_notes((*this)[id], notes))
+                return id;
+        }
+    }
+
+    std::size_t ChordPool::memory_usage() const noexcept
+    {
+        return notes_.capacity() * sizeof(Note) + offsets_.capacity() * sizeof(std::uint32_t) +
+            hashes_.capacity() * sizeof(std::uint64_t) + slots_.capacity() * sizeof(ChordId);
+    }
+
+    void ChordPool::clear() noexcept
+    {
+        notes_.clear();
+        if (!offsets_.empty())
+        {
+            offsets_.resize(2);
+            hashes_.resize(1);
+        }
+        std::ranges::fill(slots_, rest);
+    }
+
+    void ChordPool::grow()
+    {
+        slots_.assign(std::max<std::size_t>(slots_.size() * 2, 64), rest);
+        const std::size_t mask = slots_.size() - 1;
+        for (ChordId id = 1; id < size(); id++)
+        {
+            std::size_t i = hashes_[id] & mask;
+            while (slots_[i] != rest)
+                i = (i + 1) & mask;
+            slots_[i] = id;
+        }
+    }
+} // namespace hkr
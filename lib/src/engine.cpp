@@ -0,0 +1,74 @@
+#include "hikari/engine.h"
+
+#include "lilypond/music_converter.h"
+#include "lilypond/music_formatter.h"
+#include "parser/measurifier.h"
+#include "parser/music_recycler.h"
+#include "tracing.h"
+
+namespace hkr
+{
+    // The stages keep references to the budgets, which are reassigned for every request
+    class Engine::Impl
+    {
+    public:
+        const Music& parse(const std::string_view text, const ParseOptions& options)
+        {
+            HIKARI_TRACE_ZONE("Engine::parse");
+            parse_budget_ = ResourceBudget(options);
+            recycler_.recycle(unmeasured_); // Left behind if the last parse failed
+            recycler_.recycle(music_);
+            preprocessor_.process(text, preprocessed_);
+            parser_.parse(preprocessed_, unmeasured_);
+            measurifier_.process(unmeasured_, music_);
+            recycler_.recycle(unmeasured_);
+            return music_;
+        }
+
+        void export_to_lilypond(std::ostream& stream, const Music& music, const ExportOptions& options)
+        {
+            HIKARI_TRACE_ZONE("Engine::export_to_lilypond");
+            export_budget_ = ResourceBudget(options);
+            converter_.convert(music, ly_music_);
+            HIKARI_TRACE_ZONE("format");
+            StageScope scope(HIKARI_STATISTICS_OF(export_budget_), Stage::format);
+            [[maybe_unused]] const auto bytes = ly::write_to_stream(stream, ly_music_, measure_cache_);
+            HIKARI_WITH_STATISTICS(export_budget_, stats) stats->output_bytes += bytes;
+        }
+
+    private:
+        ResourceBudget parse_budget_;
+        ResourceBudget export_budget_;
+        MusicRecycler recycler_;
+        Preprocessor preprocessor_{parse_budget_};
+        Parser parser_{parse_budget_, &recycler_};
+        Measurifier measurifier_{parse_budget_, &recycler_};
+        ly::LyMusicConverter converter_{export_budget_};
+        PreprocessedText preprocessed_;
+        UnmeasuredMusic unmeasured_;
+        Music music_;
+        ly::LyMusic ly_music_;
+        ly::MeasureCache measure_cache_;
+    };
+
+    Engine::Engine(): impl_(std::make_unique<Impl>()) {}
+    Engine::Engine(Engine&&) noexcept = default;
+    Engine& Engine::operator=(Engine&&) noexcept = default;
+    Engine::~Engine() noexcept = default;
+
+    const Music& Engine::parse(const std::string_view text, const ParseOptions& options)
+    {
+        return impl_->parse(text, options);
+    }
+
+    void Engine::export_to_lilypond(std::ostream& stream, const Music& music, const ExportOptions& options)
+    {
+        impl_->export_to_lilypond(stream, music, options);
+    }
+
+    void Engine::convert_to_lilypond(std::ostream& stream, const std::string_view text,
+        const ParseOptions& parse_options, const ExportOptions& export_options)
+    {
+        impl_->export_to_lilypond(stream, impl_->parse(text, parse_options), export_options);
+    }
+} // namespace hkr
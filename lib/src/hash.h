@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace hkr
+{
+    // A fast non-cryptographic 64-bit hash, consuming the input 8 bytes at a time.
+    // The result only depends on the byte sequence (little-endian loads), so it is
+    // stable across platforms and safe to be stored on disk.
+    class Hasher
+    {
+    public:
+        explicit Hasher(const std::uint64_t seed = 0) noexcept: state_(seed ^ 0x9e3779b97f4a7c15ull) {}
+
+        Hasher& update(const std::string_view bytes) noexcept
+        {
+            const char* ptr = bytes.data();
+            std::size_t size = bytes.size();
+            length_ += size;
+            for (; size >= 8; ptr += 8, size -= 8)
+                mix(load_le(ptr, 8));
+            if (size > 0)
+                mix(load_le(ptr, size));
+            return *this;
+        }
+
+        Hasher& update(const std::uint64_t value) noexcept
+        {
+            mix(value);
+            length_ += 8;
+            return *this;
+        }
+
+        std::uint64_t digest() const noexcept { return finalize(state_ ^ length_); }
+
+    private:
+        std::uint64_t state_;
+        std::uint64_t length_ = 0;
+
+        static std::uint64_t load_le(const char* ptr, const std::size_t size) noexcept
+        {
+            unsigned char buffer[8]{};
+            std::memcpy(buffer, ptr, size);
+            std::uint64_t res = 0;
+            for (std::size_t i = 8; i-- > 0;)
+                res = (res << 8) | buffer[i];
+            return res;
+        }
+
+        static std::uint64_t finalize(std::uint64_t value) noexcept
+        {
+            value ^= value >> 33;
+            value *= 0xff51afd7ed558ccdull;
+            value ^= value >> 33;
+            value *= 0xc4ceb9fe1a85ec53ull;
+            value ^= value >> 33;
+            return value;
+        }
+
+        void mix(const std::uint64_t word) noexcept
+        {
+            state_ = (state_ ^ finalize(word)) * 0x100000001b3ull;
+            state_ = (state_ << 31) | (state_ >> 33);
+        }
+    };
+
+    inline std::uint64_t hash_bytes(const std::string_view bytes) noexcept { return Hasher().update(bytes).digest(); }
+} // namespace hkr
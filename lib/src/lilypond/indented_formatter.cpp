@@ -4,16 +4,11 @@
 
 namespace hkr::ly
 {
-    IndentedFormatter::IndentedScope::~IndentedScope() noexcept
-    {
-        parent_->current_ -= parent_->indent_;
-        parent_->println("}}");
-    }
+    IndentedFormatter::IndentedScope::~IndentedScope() noexcept { parent_->close_brace(); }
 
     IndentedFormatter::IndentedScope::IndentedScope(IndentedFormatter& parent): parent_(&parent)
     {
-        parent_->current_ += parent_->indent_;
-        parent_->println("{{");
+        parent_->open_brace();
     }
 
     IndentedFormatter::IndentedFormatter(std::ostream& stream, const std::size_t indent_size):
@@ -21,6 +16,27 @@ namespace hkr::ly
     {
     }
 
+    void IndentedFormatter::open_brace()
+    {
+        println("{{");
+        current_ += indent_;
+    }
+
+    void IndentedFormatter::close_brace()
+    {
+        current_ -= indent_;
+        println("}}");
+    }
+
+    void IndentedFormatter::replay(const std::string_view bytes, const bool ends_line)
+    {
+        os_->write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (capture_)
+            capture_->append(bytes);
+        written_ += bytes.size();
+        should_indent_ = ends_line;
+    }
+
     void IndentedFormatter::indent()
     {
         if (!should_indent_)
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <iterator>
 #include <ostream>
+#include <string>
+#include <string_view>
 #include <fmt/format.h>
 #include <clu/macros.h>
 
@@ -34,6 +37,9 @@ namespace hkr::ly
         void println()
         {
             *os_ << '\n';
+            if (capture_)
+                capture_->push_back('\n');
+            written_++;
             should_indent_ = true;
         }
 
@@ -52,13 +58,39 @@ namespace hkr::ly
             return IndentedScope(*this);
         }
 
+        // Braces that don't follow the scopes of the code, like the ones around repeated measures
+        void open_brace();
+        void close_brace();
+
+        // Copy everything printed into a buffer as well, until the capture is stopped
+        void start_capture(std::string& buffer) noexcept { capture_ = &buffer; }
+        void stop_capture() noexcept { capture_ = nullptr; }
+        // Write bytes captured before, which were printed starting with the same indentation
+        void replay(std::string_view bytes, bool ends_line);
+
+        std::size_t bytes_written() const noexcept { return written_; }
+        std::size_t indentation() const noexcept { return current_; }
+        bool at_line_start() const noexcept { return should_indent_; }
+
     private:
         std::ostream* os_ = nullptr;
         std::size_t indent_ = 0;
         std::size_t current_ = 0;
+        std::size_t written_ = 0;
         bool should_indent_ = false;
+        std::string* capture_ = nullptr;
+        fmt::memory_buffer buffer_; // Only allocates for the rare pieces longer than its inline storage
 
         void indent();
-        void vprint(const fmt::string_view format, const fmt::format_args args) const { *os_ << vformat(format, args); }
+        void vprint(const fmt::string_view format, const fmt::format_args args)
+        {
+            buffer_.clear();
+            fmt::vformat_to(std::back_inserter(buffer_), format, args);
+            const std::string_view str(buffer_.data(), buffer_.size());
+            os_->write(str.data(), static_cast<std::streamsize>(str.size()));
+            if (capture_)
+                capture_->append(str);
+            written_ += str.size();
+        }
     };
 }
@@ -1,4 +1,6 @@
 #include "music_converter.h"
+#include "../music_access.h"
+#include "../tracing.h"
 
 #include <algorithm>
 #include <functional>
@@ -28,71 +30,205 @@ namespace hkr::ly
             }
             vec.erase(++new_end, end);
         }
+
+        void mark_repeats(const std::span<LyMeasure> measures, const std::span<const Repeat> repeats)
+        {
+            for (const Repeat& repeat : repeats)
+            {
+                if (repeat.begin_measure >= repeat.end_measure || repeat.end_of_alternatives() > measures.size())
+                    throw std::out_of_range("A repeat refers to measures out of its section");
+                measures[repeat.begin_measure].repeat.volta_times = repeat.times;
+                measures[repeat.end_measure - 1].repeat.n_closing++;
+                if (repeat.alternative_ends.empty())
+                {
+                    measures[repeat.end_measure - 1].repeat.ends_pass = true;
+                    measures[repeat.end_measure - 1].repeat.pass_count = repeat.times;
+                    continue;
+                }
+                measures[repeat.end_measure].repeat.opens_alternatives = true;
+                // The extra early passes all take the first ending
+                const int n_alternatives = static_cast<int>(repeat.alternative_ends.size());
+                const int first_pass_of_others = repeat.times - n_alternatives + 1;
+                for (int i = 0; i < n_alternatives; i++)
+                {
+                    const auto begin = repeat.begin_of_alternative(static_cast<std::size_t>(i));
+                    const auto end = repeat.alternative_ends[static_cast<std::size_t>(i)];
+                    RepeatBraces& opening = measures[begin].repeat;
+                    opening.opens_alternative = true;
+                    opening.first_pass = i == 0 ? 1 : first_pass_of_others + i;
+                    opening.last_pass = i == 0 ? first_pass_of_others : first_pass_of_others + i;
+                    for (std::size_t j = begin; j < end; j++)
+                        measures[j].repeat.in_alternative = true;
+                    RepeatBraces& closing = measures[end - 1].repeat;
+                    closing.n_closing++;
+                    closing.ends_pass = closing.closes_alternative = i + 1 != n_alternatives;
+                }
+                measures[repeat.end_of_alternatives() - 1].repeat.n_closing++;
+            }
+        }
     } // namespace
 
-    LyMusic LyMusicConverter::convert()
+    LyMusic LyMusicConverter::convert(const Music& music)
     {
-        const auto n_staves = std::ranges::max(music_, std::less{}, //
-            [](const Section& sec) {
-                return sec.staves.size();
-            }).staves.size();
-        res_.reserve(n_staves);
-        for (std::size_t i = 0; i < n_staves; i++)
+        LyMusic res;
+        convert(music, res);
+        return res;
+    }
+
+    LyMusic LyMusicConverter::convert(const archive::MusicView& music)
+    {
+        LyMusic res;
+        convert(music, res);
+        return res;
+    }
+
+    void LyMusicConverter::convert(const Music& music, LyMusic& res)
+    {
+        unroll(music, res);
+        arrange(res);
+    }
+
+    void LyMusicConverter::convert(const archive::MusicView& music, LyMusic& res)
+    {
+        unroll(music, res);
+        arrange(res);
+    }
+
+    // Places the clef changes and partitions the durations of the unrolled staves
+    void LyMusicConverter::arrange(LyMusic& res)
+    {
+        Statistics* stats = HIKARI_STATISTICS_OF(budget_);
+        HIKARI_WITH_STATISTICS(budget_, st)
+            st->distinct_chords += res.chords.size() - 1; // Not counting the rest
+        for (LyStaff& staff : res.staves)
         {
-            LyStaff& staff = res_.emplace_back(unroll_staff(i));
-            ClefChangePlacer(staff).place();
+            HIKARI_TRACE_ZONE("convert staff", static_cast<std::size_t>(&staff - res.staves.data()));
+            {
+                StageScope scope(stats, Stage::place_clefs);
+                placer_.place(staff, res.chords);
+            }
+            HIKARI_WITH_STATISTICS(budget_, st)
+                for (const auto& measure : staff)
+                    for (const auto& voice : measure.voices)
+                        st->clef_changes += static_cast<std::uint64_t>(std::ranges::count_if(
+                            voice, [](const LyChord& chord) { return chord.clef_change != Clef::none; }));
+            StageScope scope(stats, Stage::partition_durations);
             for (auto& measure : staff)
-                DurationPartitioner(measure).partition();
+                DurationPartitioner(measure, budget_, partition_scratch_).partition();
         }
-        return std::move(res_);
     }
 
-    LyStaff LyMusicConverter::unroll_staff(const std::size_t idx)
+    LyMusic LyMusicConverter::unroll(const Music& music)
     {
-        LyStaff res;
+        LyMusic res;
+        unroll(music, res);
+        return res;
+    }
+
+    void LyMusicConverter::unroll(const Music& music, LyMusic& res) { unroll_music(music, res); }
+    void LyMusicConverter::unroll(const archive::MusicView& music, LyMusic& res) { unroll_music(music, res); }
+
+    template <typename M>
+    void LyMusicConverter::unroll_music(const M& music, LyMusic& res)
+    {
+        StageScope scope(HIKARI_STATISTICS_OF(budget_), Stage::unroll);
+        res_ = &res;
+        res.chords.clear();
+        res.chord_attributes.resize(1);
+        // The sections have their own chord pools, which are merged into the one of the result
+        chord_ids_.clear();
+        std::size_t n_staves = 0;
+        for (const auto& sec : music)
+        {
+            const auto& chords = chords_of(sec);
+            for (ChordId id = 0; id < chords.size(); id++)
+                chord_ids_.push_back(intern(chords[id]));
+            n_staves = std::max(n_staves, staves_of(sec).size());
+        }
+        res.staves.resize(n_staves);
+        for (std::size_t i = 0; i < n_staves; i++)
+        {
+            HIKARI_TRACE_ZONE("unroll staff", i);
+            unroll_staff(music, i, res.staves[i]);
+        }
+    }
+
+    template <typename M>
+    void LyMusicConverter::unroll_staff(const M& music, const std::size_t idx, LyStaff& res)
+    {
+        // The measures left from an earlier conversion are overwritten, keeping the capacity of their voices
+        std::size_t n_measures = 0;
+        std::size_t first_chord_id = 0;
         Time time;
-        for (auto& sec : music_)
-            for (std::size_t j = 0; j < sec.measures.size(); j++)
+        for (const auto& sec : music)
+        {
+            const auto& measures = measures_of(sec);
+            const auto& staves = staves_of(sec);
+            const auto& chord_attrs = chord_attributes_of(sec);
+            next_chord_attrs_ = 0;
+            const std::size_t n_chords = chords_of(sec).size();
+            section_chord_ids_ = std::span(chord_ids_).subspan(first_chord_id, n_chords);
+            first_chord_id += n_chords;
+            for (std::size_t j = 0; j < measures.size(); j++)
             {
-                const auto& attrs = sec.measures[j].attributes;
+                const auto& in_measure = measures[j];
+                const auto& attrs = in_measure.attributes;
                 if (attrs.time)
                     time = *attrs.time;
                 const Time partial = attrs.partial ? *attrs.partial : time;
 
-                auto& measure = res.emplace_back();
+                budget_.add(Limit::measures);
+                budget_.allocate(sizeof(LyMeasure));
+                auto& measure = n_measures < res.size() ? res[n_measures] : res.emplace_back();
+                n_measures++;
                 measure.attributes = attrs;
                 measure.current_time = time;
                 measure.current_partial = partial;
-                if (sec.staves.size() <= idx) // Empty section, so empty measure
+                measure.repeat = {};
+                if (staves.size() <= idx) // Empty section, so empty measure
+                {
+                    measure.voices.clear();
                     continue;
+                }
 
                 const auto [begin, end] = sec.beat_index_range_of_measure(j);
-                Staff& in_staff = sec.staves[idx];
-                const std::span in_beats{in_staff.data() + begin, end - begin};
-                LyMeasure* last_measure = res.size() == 1 ? nullptr : &measure - 1;
-                unroll_voices(measure, in_beats, last_measure);
+                const auto in_beats = slice(staves[idx], begin, end);
+                LyMeasure* last_measure = n_measures == 1 ? nullptr : &measure - 1;
+                unroll_voices(measure, in_beats, chord_attrs, {.beat = begin, .staff = idx}, last_measure);
             }
-        return res;
+            mark_repeats(std::span(res).first(n_measures).last(measures.size()), repeats_of(sec, repeats_));
+        }
+        res.resize(n_measures);
     }
 
-    void LyMusicConverter::unroll_voices(LyMeasure& measure, const std::span<Beat> in_beats, LyMeasure* last_measure)
+    template <typename B, typename A>
+    void LyMusicConverter::unroll_voices(LyMeasure& measure, const B& in_beats, const A& chord_attrs,
+        const ChordPosition first, LyMeasure* last_measure)
     {
-        const auto n_voices = std::ranges::max(in_beats, std::less{}, &Beat::size).size();
+        std::size_t n_voices = 0;
+        for (const auto& in_beat : in_beats)
+            n_voices = std::max(n_voices, in_beat.size());
+        budget_.check(Limit::voices, n_voices);
+        budget_.allocate(n_voices * sizeof(LyVoice));
+        for (LyVoice& voice : measure.voices)
+            voice.clear();
         measure.voices.resize(n_voices);
-        for (int i = 0; auto& in_beat : in_beats)
+        for (int i = 0; const auto& in_beat : in_beats)
         {
             for (std::size_t j = 0; j < in_beat.size(); j++)
             {
-                auto& in_voice = in_beat[j];
+                const auto& in_voice = in_beat[j];
                 auto& voice = measure.voices[j];
-                for (int k = 0; auto& in_chord : in_voice)
+                budget_.check(Limit::subdivision, in_voice.size());
+                for (int k = 0; const auto& in_chord : in_voice)
                 {
                     const auto start = i + clu::rational(k, static_cast<int>(in_voice.size()));
-                    if (in_chord.sustained)
+                    ChordId notes = section_chord_ids_[notes_of(in_chord)];
+                    if (is_sustained(in_chord))
                     {
                         if (!voice.empty())
                         {
-                            if (voice.back().chord) // Sustain the last chord
+                            if (!voice.back().spacer) // Sustain the last chord
                             {
                                 k++;
                                 continue;
@@ -105,27 +241,64 @@ namespace hkr::ly
                             {
                                 // Sustain the last chord in the previous measure,
                                 // if that chord is not a rest or a spacer
-                                if (auto& chord_prev = voices_prev[j].back().chord; //
-                                    chord_prev && !chord_prev->notes.empty())
+                                if (LyChord& chord_prev = voices_prev[j].back(); //
+                                    !chord_prev.is_rest_or_spacer())
                                 {
-                                    in_chord.notes = chord_prev->notes;
-                                    chord_prev->sustained = true;
+                                    notes = chord_prev.notes;
+                                    chord_prev.sustained = true;
                                 }
                             }
                         }
                         // else: insert as a rest
-                        in_chord.sustained = false;
                     }
-                    voice.push_back(LyChord{.start = start, .chord = std::move(in_chord)});
+                    budget_.add(Limit::notes, res_->chords[notes].size());
+                    budget_.allocate(sizeof(LyChord));
+                    const AttributesId attributes = add_attributes(chord_attrs, {
+                        .beat = first.beat + static_cast<std::size_t>(i),
+                        .staff = first.staff,
+                        .voice = j,
+                        .chord = static_cast<std::size_t>(k) //
+                    });
+                    voice.push_back(LyChord{.start = start, .notes = notes, .attributes = attributes});
                     k++;
                 }
             }
+            budget_.allocate((n_voices - in_beat.size()) * sizeof(LyChord));
             for (std::size_t j = in_beat.size(); j < n_voices; j++)
-                measure.voices[j].push_back(LyChord{.start = i});
+                measure.voices[j].push_back(LyChord{.start = i, .spacer = true});
             i++;
         }
     }
 
+    ChordId LyMusicConverter::intern(const std::span<const Note> notes)
+    {
+        const std::size_t n_chords = res_->chords.size();
+        const ChordId id = res_->chords.intern(notes);
+        if (res_->chords.size() != n_chords) // Only the first occurrence takes memory
+            budget_.allocate(notes.size() * sizeof(Note));
+        return id;
+    }
+
+    ChordId LyMusicConverter::intern(const archive::NoteSetView& notes)
+    {
+        notes_.assign(notes.begin(), notes.end());
+        return intern(notes_);
+    }
+
+    // The chords of a staff are visited in the order of their positions, so the attributes are found by
+    // walking through those of the section once, skipping the ones of the other staves
+    template <typename A>
+    AttributesId LyMusicConverter::add_attributes(const A& chord_attrs, const ChordPosition& position)
+    {
+        while (next_chord_attrs_ < chord_attrs.size() && chord_attrs[next_chord_attrs_].position < position)
+            next_chord_attrs_++;
+        if (next_chord_attrs_ == chord_attrs.size() || chord_attrs[next_chord_attrs_].position != position)
+            return 0;
+        budget_.allocate(sizeof(Chord::Attributes));
+        res_->chord_attributes.push_back(chord_attrs[next_chord_attrs_].attributes);
+        return static_cast<AttributesId>(res_->chord_attributes.size() - 1);
+    }
+
     // Clef change related utilities
     namespace
     {
@@ -244,8 +417,10 @@ namespace hkr::ly
         }
     } // namespace
 
-    void ClefChangePlacer::place()
+    void ClefChangePlacer::place(LyStaff& staff, const ChordPool& chords)
     {
+        staff_ = &staff;
+        chords_ = &chords;
         extract_and_sort_chords();
         merge_simultaneous_chords();
         find_clef_changes();
@@ -254,17 +429,20 @@ namespace hkr::ly
 
     void ClefChangePlacer::extract_and_sort_chords()
     {
-        for (auto& in_measure : staff_)
+        // The chord lists left from an earlier staff are reused
+        measures_.resize(staff_->size());
+        for (std::size_t i = 0; auto& in_measure : *staff_)
         {
-            auto& measure = measures_.emplace_back();
+            auto& measure = measures_[i++];
             measure.measure = &in_measure;
+            measure.chords.clear();
             for (auto& in_voice : in_measure.voices)
             {
                 for (auto& in_chord : in_voice)
                 {
-                    if (!in_chord.chord || in_chord.chord->notes.empty())
+                    if (in_chord.is_rest_or_spacer())
                         continue;
-                    const auto& notes = in_chord.chord->notes;
+                    const auto notes = (*chords_)[in_chord.notes];
                     const auto [min, max] = std::ranges::minmax(notes, cmp_note_staff_position);
                     measure.chords.push_back({&in_chord, {min, max}});
                 }
@@ -365,11 +543,7 @@ namespace hkr::ly
 
         bool both_rest_or_spacer(const LyChord& lhs, const LyChord& rhs) noexcept
         {
-            if (lhs.chord.has_value() != rhs.chord.has_value())
-                return false;
-            if (!lhs.chord && !rhs.chord)
-                return true;
-            return lhs.chord->notes.empty() && rhs.chord->notes.empty();
+            return lhs.spacer == rhs.spacer && lhs.is_rest_or_spacer() && rhs.is_rest_or_spacer();
         }
 
         int without_trailing_zero(const int value) noexcept
@@ -415,6 +589,7 @@ namespace hkr::ly
 
     void DurationPartitioner::partition() const
     {
+        HIKARI_TRACE_ZONE("partition measure");
         for (LyVoice& voice : measure_.voices)
         {
             merge_elements(voice, both_rest_or_spacer, [](const LyChord&, const LyChord&) noexcept {});
@@ -457,7 +632,7 @@ namespace hkr::ly
         if (voice.empty() || voice.size() == 1)
             return true; // Filler or one note
         if (std::ranges::all_of(
-                voice, [](const LyChord& chord) noexcept { return !chord.chord || chord.chord->notes.empty(); }))
+                voice, [](const LyChord& chord) noexcept { return chord.is_rest_or_spacer(); }))
             return true; // All rests
         if (to_rational(measure_.current_partial) != to_rational(measure_.current_time))
             return false;
@@ -576,15 +751,470 @@ namespace hkr::ly
         const auto prev = std::prev(iter);
         if (dont_break_tuplet && prev->tuplet.pos != TupletGroupPosition::none)
             return;
+        HIKARI_WITH_STATISTICS(budget_, stats) stats->break_at_calls++;
+        budget_.allocate(sizeof(LyChord));
         const auto inserted = voice.insert(iter, *prev);
         inserted->start = pos;
-        if (auto& chord = inserted->chord)
-            chord->attributes = {};
+        inserted->attributes = {};
         if (auto& prev_tuplet = std::prev(inserted)->tuplet; //
             prev_tuplet.pos == TupletGroupPosition::last)
             inserted->tuplet.pos = std::exchange(prev_tuplet.pos, TupletGroupPosition::head);
-        if (auto& chord = std::prev(inserted)->chord)
-            chord->sustained = true;
+        if (LyChord& chord = *std::prev(inserted); !chord.spacer)
+            chord.sustained = true;
+    }
+
+    namespace
+    {
+        std::size_t size_of(const int value) noexcept { return static_cast<std::size_t>(value); }
+
+        // Fenwick trees are stored with an unused first element, the i-th count at index i + 1
+        void fenwick_build(std::vector<int>& tree) noexcept
+        {
+            const int size = static_cast<int>(tree.size()) - 1;
+            for (int i = 1; i <= size; i++)
+                if (const int parent = i + (i & -i); parent <= size)
+                    tree[size_of(parent)] += tree[size_of(i)];
+        }
+
+        // Sum of the first n counts
+        int fenwick_prefix(const std::vector<int>& tree, const int n) noexcept
+        {
+            int res = 0;
+            for (int i = n; i > 0; i -= i & -i)
+                res += tree[size_of(i)];
+            return res;
+        }
+
+        // Index of the count that holds the n-th unit, i.e. the number of leading counts whose sum is at most n
+        int fenwick_find(const std::vector<int>& tree, int n) noexcept
+        {
+            const int size = static_cast<int>(tree.size()) - 1;
+            int idx = 0;
+            for (int bit = static_cast<int>(std::bit_floor(size_of(size))); bit > 0; bit >>= 1)
+            {
+                if (const int next = idx + bit; next <= size && tree[size_of(next)] <= n)
+                {
+                    idx = next;
+                    n -= tree[size_of(next)];
+                }
+            }
+            return idx;
+        }
+
+        void fenwick_decrement(std::vector<int>& tree, const int index) noexcept
+        {
+            const int size = static_cast<int>(tree.size()) - 1;
+            for (int i = index + 1; i <= size; i += i & -i)
+                tree[size_of(i)]--;
+        }
+
+        clu::rational<int> find_subrange_gcd(const std::span<const clu::rational<int>> subrange)
+        {
+            clu::rational res = 0;
+            for (std::size_t i = 1; i < subrange.size(); i++)
+            {
+                const auto diff = subrange[i] - subrange[i - 1];
+                res = res == 0 ? diff : gcd(diff, res);
+            }
+            return res;
+        }
+
+        // The break points of an irregular segment, which lie on a grid whose step is the regularized gcd of the
+        // chord positions. The offsets from the beginning of the segment are integers in units of the gcd, so
+        // the grid point k is at the offset k * step_. The break points in use are counted in a Fenwick tree.
+        //
+        // The removal gives the same break points as counting every range again after each removal, which is
+        // checked against the original rational implementation by hikari_bench --check-tuplets. With n grid
+        // points, its cost is bounded as follows:
+        // - Between two removals, a beginning is scanned at most once without removing anything, as its count
+        //   in the heap is up to date after that. So r removals take at most (r + 1) * n scans.
+        // - A scan goes through O(log(n * step_)) runs of ends, as the gcd of the chords at least halves from
+        //   one run to the next, and through the divisors of the largest kept step of each run below n.
+        // - Each divisor takes O(sqrt(n) log n). The break points are grouped by residue in a tree for the
+        //   steps up to sqrt(n) only, which takes O(n sqrt(n)) memory and O(sqrt(n) log n) time per removed
+        //   break point. Longer steps leave O(sqrt(n)) break points of a residue class in a range to walk.
+        class BreakPointGrid
+        {
+        public:
+            BreakPointGrid(DurationPartitioner::Scratch& scratch, const std::span<const clu::rational<int>> positions):
+                scratch_(scratch), begin_(positions.front())
+            {
+                const auto gcd = find_subrange_gcd(positions);
+                const auto den = static_cast<unsigned>(gcd.denominator());
+                step_ = static_cast<int>(den >> std::countr_zero(den));
+                period_ = gcd * step_;
+                // A segment may begin at an irregular position after the previous one has been broken, then the
+                // last grid point lies past the end of the segment
+                const auto length = (positions.back() - begin_) / period_;
+                n_points_ = (length.numerator() + length.denominator() - 1) / length.denominator() + 1;
+                while (max_tree_step_ * max_tree_step_ < n_points_)
+                    max_tree_step_++;
+
+                auto& offsets = scratch_.chord_offsets;
+                offsets.clear();
+                for (const auto pos : positions.subspan(1, positions.size() - 2))
+                    offsets.push_back(((pos - begin_) / gcd).numerator());
+                scratch_.grid_active.assign(size_of(n_points_), 1);
+                scratch_.grid_counts.assign(size_of(n_points_) + 1, 1);
+                scratch_.grid_counts[0] = 0;
+                fenwick_build(scratch_.grid_counts);
+                build_chord_gcds();
+            }
+
+            int size() const noexcept { return n_points_; }
+            bool is_active(const int point) const noexcept { return scratch_.grid_active[size_of(point)] != 0; }
+            clu::rational<int> position_of(const int point) const noexcept { return begin_ + period_ * point; }
+
+            // Repeatedly removes the break points counted by the range that counts the most of them, the first
+            // such range is taken on ties. Removing break points never increases the count of a range, so the
+            // best range of every beginning is kept in a heap, and only checked again when it gets to the top.
+            void remove_unnecessary_breaks(ResourceBudget& budget)
+            {
+                // Only the regular positions bound the ranges, none of the break points is regular otherwise
+                if (!has_single_bit(begin_.denominator()))
+                    return;
+                auto& heap = scratch_.best_ranges;
+                const auto lower = [](const RangeCount& lhs, const RangeCount& rhs) noexcept
+                { return lhs.count < rhs.count || (lhs.count == rhs.count && lhs.begin > rhs.begin); };
+                heap.clear();
+                for (int begin = 0; begin + 1 < n_points_; begin++)
+                    if (const Range range = best_range_from(begin); range.count > 0)
+                        heap.push_back({.count = range.count, .begin = begin});
+                std::ranges::make_heap(heap, lower);
+
+                [[maybe_unused]] std::uint64_t n_removals = 0;
+                while (!heap.empty())
+                {
+                    std::ranges::pop_heap(heap, lower);
+                    const auto [count, begin] = heap.back();
+                    heap.pop_back();
+                    Range range = best_range_from(begin);
+                    if (range.count == count) // Still the best one
+                    {
+                        remove_breaks(begin, range);
+                        n_removals++;
+                        range = best_range_from(begin);
+                    }
+                    if (range.count > 0)
+                    {
+                        heap.push_back({.count = range.count, .begin = begin});
+                        std::ranges::push_heap(heap, lower);
+                    }
+                }
+
+                HIKARI_WITH_STATISTICS(budget, stats)
+                {
+                    stats->tuplet_iterations += n_removals;
+                    stats->tuplet_ranges += n_ranges_;
+                }
+            }
+
+        private:
+            using RangeCount = DurationPartitioner::Scratch::RangeCount;
+            using ResidueCounts = DurationPartitioner::Scratch::ResidueCounts;
+
+            struct Range
+            {
+                std::size_t count = 0; // Break points inside the range that are not on a multiple of its gcd
+                int end = 0;
+                int kept_step = 0; // The break points at multiples of this many grid points are kept
+            };
+
+            DurationPartitioner::Scratch& scratch_;
+            clu::rational<int> begin_;
+            clu::rational<int> period_;
+            int step_ = 1;
+            int n_points_ = 0;
+            int max_tree_step_ = 1; // Ceiling of sqrt(n_points_), longer steps walk their residue classes
+            int n_chord_gcd_levels_ = 0;
+            int n_residue_counts_ = 0; // Those of scratch_.residue_counts in use for this grid
+            int divisors_of_ = 0; // The number whose divisors are in scratch_.divisors
+            std::uint64_t n_ranges_ = 0;
+
+            // Number of break points in use before a grid point
+            int count_before(const int point) const noexcept { return fenwick_prefix(scratch_.grid_counts, point); }
+
+            // The grid point with n break points in use before it
+            int nth_point(const int n) const noexcept { return fenwick_find(scratch_.grid_counts, n); }
+
+            void deactivate(const int point) noexcept
+            {
+                scratch_.grid_active[size_of(point)] = 0;
+                fenwick_decrement(scratch_.grid_counts, point);
+                for (int i = 0; i < n_residue_counts_; i++)
+                {
+                    auto& [step, counts] = scratch_.residue_counts[size_of(i)];
+                    fenwick_decrement(counts, residue_index(step, point));
+                }
+            }
+
+            // A sparse table of the gcds of the differences between adjacent chord offsets, the gcd of the
+            // differences from the i-th one on, 2^l of them, is at index l * (number of differences) + i
+            void build_chord_gcds()
+            {
+                const auto& offsets = scratch_.chord_offsets;
+                auto& gcds = scratch_.chord_gcds;
+                const int n_diffs = static_cast<int>(offsets.size()) - 1;
+                n_chord_gcd_levels_ = n_diffs > 0 ? static_cast<int>(std::bit_width(size_of(n_diffs))) : 0;
+                gcds.resize(size_of(n_chord_gcd_levels_ * std::max(n_diffs, 0)));
+                for (std::size_t i = 0; i < size_of(std::max(n_diffs, 0)); i++)
+                    gcds[i] = offsets[i + 1] - offsets[i];
+                for (int level = 1; level < n_chord_gcd_levels_; level++)
+                {
+                    const int half = 1 << (level - 1);
+                    const int* prev = gcds.data() + (level - 1) * n_diffs;
+                    int* current = gcds.data() + level * n_diffs;
+                    for (int i = 0; i + 2 * half <= n_diffs; i++)
+                        current[i] = std::gcd(prev[i], prev[i + half]);
+                }
+            }
+
+            // The last chord after the first one s.t. all the differences between adjacent chords in between
+            // are multiples of the divisor
+            int last_chord_on_multiples(const int first, const int divisor) const noexcept
+            {
+                const int n_diffs = static_cast<int>(scratch_.chord_offsets.size()) - 1;
+                int last = first;
+                for (int level = n_chord_gcd_levels_ - 1; level >= 0; level--)
+                    if (last + (1 << level) <= n_diffs &&
+                        scratch_.chord_gcds[size_of(level * n_diffs + last)] % divisor == 0)
+                        last += 1 << level;
+                return last;
+            }
+
+            // Divisors of the number that are at least 2 and smaller than the number of grid points, in
+            // ascending order. Only the numbers up to n_points_ * step_ are asked for, so that trial division
+            // takes O(sqrt(n_points_ * step_)), and the last number is cached as a run often keeps it.
+            std::span<const int> divisors(const int number)
+            {
+                auto& res = scratch_.divisors;
+                if (divisors_of_ == number)
+                    return res;
+                divisors_of_ = number;
+                res.clear();
+                std::size_t n_small = 0;
+                for (int divisor = 2; divisor <= number / divisor; divisor++)
+                {
+                    if (number % divisor != 0)
+                        continue;
+                    if (divisor < n_points_)
+                        res.insert(res.begin() + static_cast<std::ptrdiff_t>(n_small++), divisor);
+                    if (const int other = number / divisor; other != divisor && other < n_points_)
+                        res.insert(res.begin() + static_cast<std::ptrdiff_t>(n_small), other);
+                }
+                if (number < n_points_)
+                    res.push_back(number);
+                return res;
+            }
+
+            // Each residue class modulo the step occupies a contiguous part of the tree, in ascending order
+            int residue_index(const int step, const int point) const noexcept
+            {
+                const int class_size = (n_points_ + step - 1) / step;
+                return point % step * class_size + point / step;
+            }
+
+            // The tree of the break points in use grouped by their residues modulo the step, for the steps up to
+            // max_tree_step_
+            const std::vector<int>& residue_counts(const int step)
+            {
+                auto& all = scratch_.residue_counts;
+                for (int i = 0; i < n_residue_counts_; i++)
+                    if (all[size_of(i)].step == step)
+                        return all[size_of(i)].counts;
+                if (size_of(n_residue_counts_) == all.size())
+                    all.emplace_back();
+                auto& [tree_step, counts] = all[size_of(n_residue_counts_++)];
+                tree_step = step;
+                counts.assign(size_of((n_points_ + step - 1) / step * step) + 1, 0);
+                for (int point = 0; point < n_points_; point++)
+                    counts[size_of(residue_index(step, point) + 1)] = is_active(point);
+                fenwick_build(counts);
+                return counts;
+            }
+
+            // Number of break points in use at from + k * step, for k >= 0 and up to the last grid point
+            int count_in_class(const int step, const int from, const int last)
+            {
+                if (last < from)
+                    return 0;
+                const int to = last - (last - from) % step;
+                if (step <= max_tree_step_)
+                {
+                    const auto& counts = residue_counts(step);
+                    return fenwick_prefix(counts, residue_index(step, to) + 1) -
+                        fenwick_prefix(counts, residue_index(step, from));
+                }
+                int res = 0;
+                for (int point = from; point <= to; point += step)
+                    res += is_active(point);
+                return res;
+            }
+
+            // The last break point in use at begin + k * step between the given grid points, or -1 if none
+            int last_in_class(const int step, const int begin, const int first, const int last)
+            {
+                const int from = first + ((begin - first) % step + step) % step;
+                const int to = last - (last - begin) % step;
+                if (to < from)
+                    return -1;
+                if (step <= max_tree_step_)
+                {
+                    const auto& counts = residue_counts(step);
+                    const int n_before = fenwick_prefix(counts, residue_index(step, from));
+                    const int n_until = fenwick_prefix(counts, residue_index(step, to) + 1);
+                    if (n_until == n_before)
+                        return -1;
+                    const int index = fenwick_find(counts, n_until - 1);
+                    return from + (index - residue_index(step, from)) * step;
+                }
+                for (int point = to; point >= from; point -= step)
+                    if (is_active(point))
+                        return point;
+                return -1;
+            }
+
+            // The first break point in use at begin + k * step, from the first grid point given up to the last
+            // one (which is in use), s.t. the range from the beginning to it counts at least the given number of
+            // break points when those at multiples of the step are kept
+            int first_in_class_counting(const int step, const int begin, const int first, const int last,
+                const int min_count)
+            {
+                const int n_before = count_before(begin + 1);
+                const int from = first + ((begin - first) % step + step) % step;
+                if (step <= max_tree_step_)
+                {
+                    // Break points of the class in use, ranked from the first one in the tree
+                    const auto& counts = residue_counts(step);
+                    const int begin_rank = fenwick_prefix(counts, residue_index(step, begin));
+                    int low = fenwick_prefix(counts, residue_index(step, from));
+                    int high = fenwick_prefix(counts, residue_index(step, last));
+                    const auto point_of = [&](const int rank)
+                    { return begin + (fenwick_find(counts, rank) - residue_index(step, begin)) * step; };
+                    while (low < high)
+                    {
+                        const int mid = low + (high - low) / 2;
+                        if (count_before(point_of(mid)) - n_before - (mid - begin_rank - 1) >= min_count)
+                            high = mid;
+                        else
+                            low = mid + 1;
+                    }
+                    return point_of(low);
+                }
+                int n_kept = count_in_class(step, begin + step, from - step);
+                for (int point = from;; point += step)
+                {
+                    if (!is_active(point))
+                        continue;
+                    if (point == last || count_before(point) - n_before - n_kept >= min_count)
+                        return point;
+                    n_kept++;
+                }
+            }
+
+            // Finds the range starting from a break point in use that counts the most break points, with the
+            // gcd of the chords inside the range and its endpoints growing finer as the range extends
+            Range best_range_from(const int begin)
+            {
+                if (!is_active(begin))
+                    return {};
+                const auto& offsets = scratch_.chord_offsets;
+                const int n_chords = static_cast<int>(offsets.size());
+                const int origin = begin * step_;
+                int chord = static_cast<int>(std::ranges::upper_bound(offsets, origin) - offsets.begin());
+
+                // A range ending before the cell of the next chord contains no chords, so its gcd is its length,
+                // and all the break points inside are counted. The longest of such ranges counts the most.
+                Range best;
+                const int free_end = chord == n_chords ? n_points_ - 1 : offsets[size_of(chord)] / step_;
+                const int n_before = count_before(begin + 1);
+                if (const int n_inside = count_before(free_end + 1) - n_before; n_inside > 0)
+                {
+                    n_ranges_++;
+                    const int end = nth_point(n_before + n_inside - 1);
+                    best = {.count = size_of(n_inside - 1), .end = end, .kept_step = end - begin};
+                }
+
+                // The gcd of the chords inside a range only changes at the chords which are not on a multiple of
+                // it, so the ends are scanned in runs of the same gcd, each starting past the cell of a chord
+                int gcd = 0;
+                while (chord < n_chords)
+                {
+                    gcd = std::gcd(gcd, offsets[size_of(chord)] - origin);
+                    // Every break point lies on a multiple of the grid step, so once the gcd divides the step,
+                    // no longer range counts any break point
+                    const int max_kept_step = gcd / std::gcd(gcd, step_);
+                    if (max_kept_step == 1)
+                        break;
+                    const int last_chord = last_chord_on_multiples(chord, gcd);
+                    const int first = offsets[size_of(chord)] / step_ + 1;
+                    const int last =
+                        last_chord + 1 < n_chords ? offsets[size_of(last_chord + 1)] / step_ : n_points_ - 1;
+                    chord = last_chord + 1;
+                    if (first <= last)
+                        best = best_range_in_run(begin, first, last, max_kept_step, best);
+                }
+                return best;
+            }
+
+            // In a run of ends, a range keeps the break points at multiples of the gcd of its length and the
+            // largest kept step. For a fixed kept step, the count only grows with the end, and keeping the break
+            // points at multiples of a divisor of it counts fewer of them. So the best range ends at the last
+            // point on a multiple of some divisor of the largest kept step.
+            Range best_range_in_run(const int begin, const int first, const int last, const int max_kept_step,
+                Range best)
+            {
+                const int n_before = count_before(begin + 1);
+                const auto count_to = [&](const int end)
+                {
+                    n_ranges_++;
+                    const int kept_step = std::gcd(end - begin, max_kept_step);
+                    const int n_kept = count_in_class(kept_step, begin + kept_step, end - 1);
+                    return size_of(count_before(end) - n_before - n_kept);
+                };
+                std::size_t max_count = 0;
+                for (const int step : divisors(max_kept_step))
+                {
+                    if (step > last - begin)
+                        break;
+                    if (const int end = last_in_class(step, begin, first, last); end >= 0)
+                        max_count = std::max(max_count, count_to(end));
+                }
+                if (max_count <= best.count)
+                    return best;
+
+                // The first range reaching the count keeps the break points at multiples of one of the divisors
+                int best_end = last + 1;
+                for (const int step : divisors(max_kept_step))
+                {
+                    if (step > last - begin)
+                        break;
+                    if (const int end = last_in_class(step, begin, first, last); end >= 0 && count_to(end) == max_count)
+                        best_end = std::min(best_end,
+                            first_in_class_counting(step, begin, first, end, static_cast<int>(max_count)));
+                }
+                return {.count = max_count, .end = best_end, .kept_step = std::gcd(best_end - begin, max_kept_step)};
+            }
+
+            void remove_breaks(const int begin, const Range& range) noexcept
+            {
+                for (int point = nth_point(count_before(begin + 1)); point < range.end;
+                     point = nth_point(count_before(point + 1)))
+                    if ((point - begin) % range.kept_step != 0)
+                        deactivate(point);
+            }
+        };
+    } // namespace
+
+    void DurationPartitioner::find_tuplet_breaks(
+        const std::span<const clu::rational<int>> positions, ResourceBudget& budget, Scratch& scratch)
+    {
+        BreakPointGrid grid(scratch, positions);
+        grid.remove_unnecessary_breaks(budget);
+        scratch.breaks.clear();
+        for (int point = 1; point + 1 < grid.size(); point++)
+            if (grid.is_active(point))
+                scratch.breaks.push_back(grid.position_of(point));
     }
 
     class DurationPartitioner::TupletPartitioner
@@ -613,24 +1243,12 @@ namespace hkr::ly
             //       a) If such count is zero, goto 3.
             //       b) Otherwise, remove all the counted break points from the list, and goto 3).
             // 3. Break the voice with the final break point list.
+            // Steps 3) and 4) are done by BreakPointGrid on integer offsets, see find_tuplet_breaks.
             break_tuplets();
             set_tuplet_ratios();
         }
 
     private:
-        enum class Type
-        {
-            chord,
-            break_point,
-            placeholder
-        };
-
-        struct Position
-        {
-            clu::rational<int> start;
-            Type type;
-        };
-
         const DurationPartitioner& parent_;
         LyVoice& voice_;
 
@@ -645,11 +1263,10 @@ namespace hkr::ly
                 if (iter == voice_.end())
                     break;
                 const auto end = std::ranges::find_if(iter, voice_.end(), is_regular_chord);
-                auto pos = construct_positions(std::prev(iter), end);
-                fill_break_points(pos);
-                while (remove_unnecessary_breaks_once(pos)) {}
+                find_tuplet_breaks(construct_positions(std::prev(iter), end), parent_.budget_, parent_.scratch_);
                 const auto idx = std::distance(voice_.begin(), end); // end will be invalidated after the break
-                break_with_positions(pos);
+                for (const auto pos : parent_.scratch_.breaks)
+                    parent_.break_at(voice_, pos);
                 iter = voice_.begin() + idx;
             }
         }
@@ -670,108 +1287,19 @@ namespace hkr::ly
             }
         }
 
-        std::vector<Position> construct_positions(const ChordIter begin, const ChordIter end) const
+        // The positions live in the scratch buffer, which the next call overwrites
+        std::vector<clu::rational<int>>& construct_positions(const ChordIter begin, const ChordIter end) const
         {
             const std::span subrange(begin, end);
-            std::vector<Position> pos;
+            std::vector<clu::rational<int>>& pos = parent_.scratch_.positions;
+            pos.clear();
             pos.reserve(subrange.size() + 1);
             for (const auto& chord : subrange)
-                pos.push_back({.start = chord.start, .type = Type::chord});
-            pos.push_back({
-                .start = end == voice_.end() ? parent_.measure_.current_partial.numerator : end->start,
-                .type = Type::chord //
-            });
+                pos.push_back(chord.start);
+            pos.push_back(end == voice_.end() ? parent_.measure_.current_partial.numerator : end->start);
             return pos;
         }
 
-        void fill_break_points(std::vector<Position>& pos) const
-        {
-            auto period = find_subrange_gcd(pos);
-            const auto den = static_cast<unsigned>(period.denominator());
-            const auto multi = den >> std::countr_zero(den);
-            period *= static_cast<int>(multi);
-
-            const auto begin = pos.front().start, end = pos.back().start;
-            for (auto i = begin + period; i < end; i += period)
-                pos.push_back({.start = i, .type = Type::break_point});
-
-            std::ranges::sort(pos, std::less{}, &Position::start);
-        }
-
-        bool remove_unnecessary_breaks_once(std::vector<Position>& pos) const
-        {
-            const auto is_regular_non_placeholder = [](const Position& p) noexcept
-            { return p.type != Type::placeholder && has_single_bit(p.start.denominator()); };
-
-            std::span<Position> best_subrange;
-            std::size_t max_breaks_removed = 0;
-
-            auto begin = pos.begin();
-            while (true)
-            {
-                begin = std::ranges::find_if(begin, pos.end(), is_regular_non_placeholder);
-                if (begin == pos.end())
-                    break;
-                auto end = std::next(begin);
-                while (true)
-                {
-                    end = std::ranges::find_if(end, pos.end(), is_regular_non_placeholder);
-                    if (end == pos.end())
-                        break;
-                    ++end;
-                    const std::span subrange{begin, end};
-                    if (const std::size_t count = count_unnecessary_breaks_in_range(subrange);
-                        count > max_breaks_removed)
-                    {
-                        max_breaks_removed = count;
-                        best_subrange = subrange;
-                    }
-                }
-                ++begin;
-            }
-
-            if (max_breaks_removed == 0)
-                return false;
-            remove_unnecessary_breaks_in_range(best_subrange);
-            return true;
-        }
-
-        void foreach_unnecessary_breaks_in_range( //
-            const std::span<Position> subrange, clu::callable<Position&> auto&& func) const
-        {
-            if (subrange.size() <= 1)
-                return;
-            const auto period = find_subrange_gcd(subrange);
-            for (auto& pos : subrange.subspan(1, subrange.size() - 2))
-            {
-                if (pos.type != Type::break_point)
-                    continue;
-                if (((pos.start - subrange[0].start) / period).denominator() != 1)
-                    func(pos);
-                // pos.type = Type::placeholder;
-            }
-        }
-
-        void remove_unnecessary_breaks_in_range(const std::span<Position> subrange) const
-        {
-            foreach_unnecessary_breaks_in_range( //
-                subrange, [](Position& pos) { pos.type = Type::placeholder; });
-        }
-
-        std::size_t count_unnecessary_breaks_in_range(const std::span<Position> subrange) const
-        {
-            std::size_t result = 0;
-            foreach_unnecessary_breaks_in_range(subrange, [&](auto&) { result++; });
-            return result;
-        }
-
-        void break_with_positions(const std::vector<Position>& pos) const
-        {
-            for (const auto& p : pos)
-                if (p.type == Type::break_point)
-                    parent_.break_at(voice_, p.start);
-        }
-
         void set_tuplet_ratios_in_range(const ChordIter begin, const ChordIter end) const
         {
             const auto rational_bit_ceil = [](const clu::rational<int> value) noexcept
@@ -795,7 +1323,8 @@ namespace hkr::ly
 
         void break_compound_durations(const ChordIter begin, const ChordIter end) const
         {
-            std::vector<clu::rational<int>> breaks;
+            std::vector<clu::rational<int>>& breaks = parent_.scratch_.breaks;
+            breaks.clear();
             const Time partial = parent_.measure_.current_partial;
             const auto factor = partial.denominator / begin->tuplet.ratio;
             for (auto iter = begin; iter != end; ++iter)
@@ -821,30 +1350,13 @@ namespace hkr::ly
             for (const auto p : breaks)
                 parent_.break_at(voice_, p);
         }
-
-        clu::rational<int> find_subrange_gcd(const std::span<const Position> subrange) const
-        {
-            const auto endpoint_or_chord = [=](const Position& pos)
-            {
-                return pos.type == Type::chord || // chord
-                    &pos == subrange.data() || &pos == &(subrange.back()); // endpoint
-            };
-            auto starts = subrange | std::views::filter(endpoint_or_chord) | std::views::transform(&Position::start);
-            auto iter = starts.begin();
-            clu::rational res = 0;
-            auto prev = *iter++;
-            while (iter != starts.end())
-            {
-                const auto cur = *iter++;
-                const auto diff = cur - prev;
-                res = res == 0 ? diff : gcd(diff, res);
-                prev = cur;
-            }
-            return res;
-        }
     };
 
-    void DurationPartitioner::break_tuplets(LyVoice& voice) const { TupletPartitioner(*this, voice).partition(); }
+    void DurationPartitioner::break_tuplets(LyVoice& voice) const
+    {
+        StageScope scope(HIKARI_STATISTICS_OF(budget_), Stage::partition_tuplets);
+        TupletPartitioner(*this, voice).partition();
+    }
 
     // | 4/4: 8th 4th 4th 4th 8th |
     bool DurationPartitioner::is_syncopated_4beat(const std::span<const LyChord> span, const RationalRange& range) const
@@ -852,7 +1364,7 @@ namespace hkr::ly
         if (span.size() != 5)
             return false;
         const auto half_beat = (range.end - range.begin) / 8;
-        const auto not_rest = [](const LyChord& chord) noexcept { return chord.chord && !chord.chord->notes.empty(); };
+        const auto not_rest = [](const LyChord& chord) noexcept { return !chord.is_rest_or_spacer(); };
 
         if (span[0].start != range.begin)
             return false;
@@ -865,5 +1377,13 @@ namespace hkr::ly
         return span[4].start == range.begin + 7 * half_beat;
     }
 
-    LyMusic convert_to_ly(Music music) { return LyMusicConverter(std::move(music)).convert(); }
+    LyMusic convert_to_ly(const Music& music, ResourceBudget& budget)
+    {
+        return LyMusicConverter(budget).convert(music);
+    }
+
+    LyMusic convert_to_ly(const archive::MusicView& music, ResourceBudget& budget)
+    {
+        return LyMusicConverter(budget).convert(music);
+    }
 } // namespace hkr::ly
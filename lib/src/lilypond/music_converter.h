@@ -6,33 +6,17 @@
 
 namespace hkr::ly
 {
-    class LyMusicConverter
-    {
-    public:
-        explicit LyMusicConverter(Music music): music_(std::move(music)) {}
-
-        LyMusic convert();
-
-    private:
-        Music music_;
-        LyMusic res_;
-
-        LyStaff unroll_staff(std::size_t idx);
-        static void unroll_voices(LyMeasure& measure, std::span<Beat> in_beats, LyMeasure* last_measure);
-    };
-
     struct NoteRange
     {
         Note low;
         Note high;
     };
 
+    // Can be reused for many staves, the buffers keep their capacity
     class ClefChangePlacer
     {
     public:
-        explicit ClefChangePlacer(LyStaff& staff): staff_(staff) {}
-
-        void place();
+        void place(LyStaff& staff, const ChordPool& chords);
 
     private:
         struct ChordInfo
@@ -47,7 +31,8 @@ namespace hkr::ly
             std::vector<ChordInfo> chords;
         };
 
-        LyStaff& staff_;
+        LyStaff* staff_ = nullptr;
+        const ChordPool* chords_ = nullptr;
         std::vector<MeasureNotesInfo> measures_;
         Clef current_clef_ = Clef::none;
 
@@ -66,14 +51,48 @@ namespace hkr::ly
     class DurationPartitioner
     {
     public:
-        explicit DurationPartitioner(LyMeasure& measure): measure_(measure) {}
+        // Buffers of the tuplet partitioning, owned by the caller to keep their capacity between measures
+        struct Scratch
+        {
+            struct RangeCount
+            {
+                std::size_t count = 0; // Break points removed by the best range starting at a grid point
+                int begin = 0;
+            };
+
+            struct ResidueCounts
+            {
+                int step = 0;
+                std::vector<int> counts; // Fenwick tree of the break points in use, grouped by residue modulo step
+            };
+
+            std::vector<clu::rational<int>> positions;
+            std::vector<clu::rational<int>> breaks;
+            std::vector<int> chord_offsets; // In units of the gcd of the positions
+            std::vector<int> grid_counts; // Fenwick tree of the break points in use
+            std::vector<std::uint8_t> grid_active;
+            std::vector<int> chord_gcds; // Sparse table of the gcds of adjacent chord offset differences
+            std::vector<ResidueCounts> residue_counts;
+            std::vector<int> divisors;
+            std::vector<RangeCount> best_ranges; // Heap of the counts, which may be out of date
+        };
 
-        void partition()const;
+        DurationPartitioner(LyMeasure& measure, ResourceBudget& budget, Scratch& scratch):
+            measure_(measure), budget_(budget), scratch_(scratch) {}
+
+        void partition() const;
+
+        // Finds the break points left in an irregular segment, given the positions of its chords and of its end,
+        // and puts them into scratch.breaks. Public for the differential check in the benchmarks.
+        static void find_tuplet_breaks(
+            std::span<const clu::rational<int>> positions, ResourceBudget& budget, Scratch& scratch);
 
     private:
         class TupletPartitioner;
 
         LyMeasure& measure_;
+        ResourceBudget& budget_;
+        Scratch& scratch_;
 
         // 2^n * (1|3|7)/2^k, use a single note for the whole measure
         bool check_use_one_note(const LyVoice& voice) const;
@@ -88,4 +107,48 @@ namespace hkr::ly
         void break_tuplets(LyVoice& voice) const;
         bool is_syncopated_4beat(std::span<const LyChord> span, const RationalRange& range) const;
     };
+
+    class LyMusicConverter
+    {
+    public:
+        explicit LyMusicConverter(ResourceBudget& budget): budget_(budget) {}
+
+        // The music is either parsed or read in place from an archive
+        LyMusic convert(const Music& music);
+        LyMusic convert(const archive::MusicView& music);
+
+        // Converts into a result of an earlier call, the measures and voices keep their capacity
+        void convert(const Music& music, LyMusic& res);
+        void convert(const archive::MusicView& music, LyMusic& res);
+
+        // Only unroll the staves into measures and voices, without placing clef changes
+        // or partitioning the durations
+        LyMusic unroll(const Music& music);
+        void unroll(const Music& music, LyMusic& res);
+        void unroll(const archive::MusicView& music, LyMusic& res);
+
+    private:
+        ResourceBudget& budget_;
+        LyMusic* res_ = nullptr;
+        ClefChangePlacer placer_;
+        DurationPartitioner::Scratch partition_scratch_;
+        std::size_t next_chord_attrs_ = 0; // Index in those of the current section after the last chord
+        std::vector<ChordId> chord_ids_; // IDs in the result of the chord pools of all the sections, one after another
+        std::span<const ChordId> section_chord_ids_; // Those of the chord pool of the current section
+        std::vector<Note> notes_; // Notes of a chord read from an archive, to be interned
+        std::vector<Repeat> repeats_; // Those of the current section, if read from an archive
+
+        ChordId intern(std::span<const Note> notes);
+        ChordId intern(const archive::NoteSetView& notes);
+        void arrange(LyMusic& res);
+        template <typename M>
+        void unroll_music(const M& music, LyMusic& res);
+        template <typename M>
+        void unroll_staff(const M& music, std::size_t idx, LyStaff& res);
+        template <typename B, typename A>
+        void unroll_voices(LyMeasure& measure, const B& in_beats, const A& chord_attrs, ChordPosition first,
+            LyMeasure* last_measure);
+        template <typename A>
+        AttributesId add_attributes(const A& chord_attrs, const ChordPosition& position);
+    };
 }
@@ -1,16 +1,40 @@
-#include "types.h"
+#include "music_formatter.h"
 
 #include <bit>
 #include <algorithm>
+#include <span>
+#include <stdexcept>
 
 #include "hikari/api.h"
 #include "indented_formatter.h"
+#include "../hash.h"
+#include "../tracing.h"
 
 namespace hkr
 {
-    void export_to_lilypond(std::ostream& stream, Music music)
+    namespace
+    {
+        template <typename M>
+        void export_to_lilypond_impl(std::ostream& stream, const M& music, const ExportOptions& options)
+        {
+            HIKARI_TRACE_ZONE("export_to_lilypond");
+            ResourceBudget budget(options);
+            const auto ly_music = ly::convert_to_ly(music, budget);
+            HIKARI_TRACE_ZONE("format");
+            StageScope scope(HIKARI_STATISTICS_OF(budget), Stage::format);
+            [[maybe_unused]] const auto bytes = write_to_stream(stream, ly_music);
+            HIKARI_WITH_STATISTICS(budget, stats) stats->output_bytes += bytes;
+        }
+    } // namespace
+
+    void export_to_lilypond(std::ostream& stream, const Music& music, const ExportOptions& options)
+    {
+        export_to_lilypond_impl(stream, music, options);
+    }
+
+    void export_to_lilypond(std::ostream& stream, const archive::MusicView& music, const ExportOptions& options)
     {
-        write_to_stream(stream, ly::convert_to_ly(std::move(music)));
+        export_to_lilypond_impl(stream, music, options);
     }
 } // namespace hkr
 
@@ -41,15 +65,101 @@ namespace hkr::ly
                 default: return false;
             }
         }
+
+        std::uint64_t pack(const clu::rational<int> value) noexcept
+        {
+            return static_cast<std::uint32_t>(value.numerator()) |
+                static_cast<std::uint64_t>(static_cast<std::uint32_t>(value.denominator())) << 32;
+        }
+
+        // Hash of everything in a measure that affects the notes written by LyFormatter::write_measure,
+        // the attributes and the repeat braces are written separately
+        // The attributes are compared by value, as equal attributes of different chords have different IDs
+        void hash_measure_content(
+            Hasher& hasher, const LyMeasure& measure, const std::span<const Chord::Attributes> attributes) noexcept
+        {
+            hasher.update(pack({measure.current_partial.numerator, measure.current_partial.denominator}));
+            hasher.update(measure.voices.size());
+            for (const LyVoice& voice : measure.voices)
+            {
+                hasher.update(voice.size());
+                for (const LyChord& chord : voice)
+                {
+                    const auto tempo = attributes[chord.attributes].tempo;
+                    hasher.update(pack(chord.start));
+                    hasher.update(pack(chord.tuplet.ratio));
+                    hasher.update(chord.notes | static_cast<std::uint64_t>(chord.tuplet.pos) << 32 |
+                        static_cast<std::uint64_t>(chord.spacer) << 40 |
+                        static_cast<std::uint64_t>(chord.sustained) << 41 |
+                        static_cast<std::uint64_t>(tempo.has_value()) << 42 |
+                        static_cast<std::uint64_t>(chord.clef_change) << 48);
+                    if (tempo)
+                        hasher.update(std::bit_cast<std::uint32_t>(*tempo));
+                }
+            }
+        }
+
+        bool same_measure_content(
+            const LyMeasure& lhs, const LyMeasure& rhs, const std::span<const Chord::Attributes> attributes) noexcept
+        {
+            const auto same_chord = [=](const LyChord& l, const LyChord& r) noexcept
+            {
+                return l.start == r.start && l.tuplet.ratio == r.tuplet.ratio && l.tuplet.pos == r.tuplet.pos &&
+                    l.notes == r.notes && l.spacer == r.spacer && l.sustained == r.sustained &&
+                    l.clef_change == r.clef_change && attributes[l.attributes].tempo == attributes[r.attributes].tempo;
+            };
+            return lhs.current_partial.numerator == rhs.current_partial.numerator &&
+                lhs.current_partial.denominator == rhs.current_partial.denominator &&
+                std::ranges::equal(lhs.voices, rhs.voices,
+                    [&](const LyVoice& l, const LyVoice& r) noexcept { return std::ranges::equal(l, r, same_chord); });
+        }
     } // namespace
 
+    void MeasureCache::insert(const std::uint64_t hash, const Entry& entry)
+    {
+        if ((entries_.size() + 1) * 4 > slots_.size() * 3) // Keep the load factor under 3/4
+            grow();
+        if (entries_.size() >= UINT32_MAX)
+            throw std::length_error("Too many measures in the measure cache");
+        const std::size_t mask = slots_.size() - 1;
+        std::size_t i = hash & mask;
+        while (slots_[i] != 0)
+            i = (i + 1) & mask;
+        entries_.push_back(entry);
+        hashes_.push_back(hash);
+        slots_[i] = static_cast<std::uint32_t>(entries_.size());
+    }
+
+    void MeasureCache::clear() noexcept
+    {
+        entries_.clear();
+        hashes_.clear();
+        std::ranges::fill(slots_, 0);
+        bytes_.clear();
+    }
+
+    void MeasureCache::grow()
+    {
+        slots_.assign(std::max<std::size_t>(slots_.size() * 2, 64), 0);
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t index = 0; index < entries_.size(); index++)
+        {
+            std::size_t i = hashes_[index] & mask;
+            while (slots_[i] != 0)
+                i = (i + 1) & mask;
+            slots_[i] = static_cast<std::uint32_t>(index + 1);
+        }
+    }
+
     class LyFormatter
     {
     public:
-        explicit LyFormatter(std::ostream& stream): file_(stream) {}
+        LyFormatter(std::ostream& stream, MeasureCache& cache): file_(stream), cache_(cache) {}
 
         void write(const LyMusic& music)
         {
+            chords_ = &music.chords;
+            chord_attributes_ = music.chord_attributes;
             file_.println(R"(\version "2.22.1")");
             file_.println(R"(\language "english")");
             {
@@ -85,7 +195,7 @@ namespace hkr::ly
                     {
                         auto piano_staff = file_.new_scope("\\new PianoStaff");
                         file_.println("<<");
-                        for (const auto& staff : music)
+                        for (const auto& staff : music.staves)
                         {
                             auto new_staff = file_.new_scope("\\new Staff");
                             file_.println("\\numericTimeSignature");
@@ -97,22 +207,49 @@ namespace hkr::ly
             }
         }
 
+        std::size_t bytes_written() const noexcept { return file_.bytes_written(); }
+
     private:
+        // Stop adding new measures to the cache after this many bytes of output are kept
+        static constexpr std::size_t max_cached_bytes = 4 << 20;
+
         IndentedFormatter file_;
+        MeasureCache& cache_;
+        const ChordPool* chords_ = nullptr;
+        std::span<const Chord::Attributes> chord_attributes_;
         Clef current_clef_ = Clef::none;
 
         void write_staff(const LyStaff& staff)
         {
             current_clef_ = Clef::none;
-            const auto n_max_staves = std::ranges::max(staff, std::less{}, //
+            const auto n_max_staves = std::ranges::max_element(staff, std::less{}, //
                 [](const LyMeasure& measure) {
                     return measure.voices.size();
-                }).voices.size();
+                })->voices.size();
             for (const auto& measure : staff)
             {
+                write_repeat_openings(measure.repeat);
                 write_measure_attributes(measure.attributes);
-                write_measure(measure, n_max_staves);
+                write_measure_cached(measure, n_max_staves);
+                for (std::uint8_t i = 0; i < measure.repeat.n_closing; i++)
+                    file_.close_brace();
+            }
+        }
+
+        void write_repeat_openings(const RepeatBraces& repeat)
+        {
+            if (repeat.volta_times != 0)
+            {
+                file_.print("\\repeat volta {} ", repeat.volta_times);
+                file_.open_brace();
             }
+            if (repeat.opens_alternatives)
+            {
+                file_.print("\\alternative ");
+                file_.open_brace();
+            }
+            if (repeat.opens_alternative)
+                file_.open_brace();
         }
 
         void write_measure_attributes(const Measure::Attributes& attrs)
@@ -137,8 +274,7 @@ namespace hkr::ly
         static bool is_non_empty_voice(const LyVoice& voice)
         {
             return std::ranges::any_of(voice,
-                [](const LyChord& chord) noexcept //
-                { return chord.chord && !chord.chord->notes.empty(); });
+                [](const LyChord& chord) noexcept { return !chord.is_rest_or_spacer(); });
         }
 
         static std::size_t count_non_empty_voices(const LyMeasure& measure)
@@ -149,6 +285,50 @@ namespace hkr::ly
             return res;
         }
 
+        void write_measure_cached(const LyMeasure& measure, const std::size_t n_max_staves)
+        {
+            Hasher hasher;
+            hasher.update(n_max_staves).update(file_.indentation());
+            hasher.update(static_cast<std::uint64_t>(file_.at_line_start()) |
+                static_cast<std::uint64_t>(current_clef_) << 8);
+            hash_measure_content(hasher, measure, chord_attributes_);
+            const std::uint64_t hash = hasher.digest();
+
+            const auto* cached = cache_.find(hash,
+                [&](const MeasureCache::Entry& entry)
+                {
+                    return entry.n_max_staves == n_max_staves && entry.indentation == file_.indentation() &&
+                        entry.at_line_start == file_.at_line_start() && entry.clef_before == current_clef_ &&
+                        same_measure_content(*entry.measure, measure, chord_attributes_);
+                });
+            std::string& bytes = cache_.bytes();
+            if (cached)
+            {
+                file_.replay(std::string_view(bytes).substr(cached->offset, cached->size), cached->ends_line);
+                current_clef_ = cached->clef_after;
+                return;
+            }
+
+            if (bytes.size() >= max_cached_bytes)
+            {
+                write_measure(measure, n_max_staves);
+                return;
+            }
+            MeasureCache::Entry entry{.measure = &measure,
+                .n_max_staves = n_max_staves,
+                .indentation = file_.indentation(),
+                .at_line_start = file_.at_line_start(),
+                .clef_before = current_clef_,
+                .offset = bytes.size()};
+            file_.start_capture(bytes);
+            write_measure(measure, n_max_staves);
+            file_.stop_capture();
+            entry.clef_after = current_clef_;
+            entry.ends_line = file_.at_line_start();
+            entry.size = bytes.size() - entry.offset;
+            cache_.insert(hash, entry);
+        }
+
         void write_measure(const LyMeasure& measure, const std::size_t n_max_staves)
         {
             const std::size_t n_non_empty_voices = count_non_empty_voices(measure);
@@ -200,7 +380,7 @@ namespace hkr::ly
 
                 const auto duration =
                     (find_chord_end(chord) - chord.start) / measure_time.denominator * chord.tuplet.ratio;
-                write_chord_with_duration(chord.chord, duration);
+                write_chord_with_duration(chord, duration);
 
                 if (chord.tuplet.pos == TupletGroupPosition::last)
                 {
@@ -223,39 +403,40 @@ namespace hkr::ly
             current_clef_ = clef;
         }
 
-        void write_chord_with_duration(const std::optional<Chord>& chord_or_spacer, const clu::rational<int> duration)
+        void write_chord_with_duration(const LyChord& chord, const clu::rational<int> duration)
         {
-            write_chord_notes(chord_or_spacer);
+            write_chord_notes(chord);
             write_duration(duration);
-            if (!chord_or_spacer)
+            if (chord.spacer)
                 return;
-            if (chord_or_spacer->sustained)
+            if (chord.sustained)
                 file_.print("~ ");
         }
 
-        void write_chord_notes(const std::optional<Chord>& chord_or_spacer)
+        void write_chord_notes(const LyChord& chord)
         {
-            if (!chord_or_spacer) // spacer
+            if (chord.spacer)
             {
                 file_.print("s");
                 return;
             }
 
-            const Chord& chord = *chord_or_spacer;
-            if (chord.attributes.tempo) // TODO: any chance to support non-integer tempi?
-                file_.print("\\tempo 4={} ", static_cast<int>(*chord.attributes.tempo));
+            // TODO: any chance to support non-integer tempi?
+            if (const auto tempo = chord_attributes_[chord.attributes].tempo)
+                file_.print("\\tempo 4={} ", static_cast<int>(*tempo));
 
-            if (chord.notes.empty()) // rest
+            const auto notes = (*chords_)[chord.notes];
+            if (notes.empty()) // rest
             {
                 file_.print("r");
                 return;
             }
 
-            if (chord.notes.size() > 1)
+            if (notes.size() > 1)
                 file_.print("< ");
-            for (const auto note : chord.notes)
+            for (const auto note : notes)
                 write_note(note);
-            if (chord.notes.size() > 1)
+            if (notes.size() > 1)
                 file_.print("> ");
         }
 
@@ -331,5 +512,17 @@ namespace hkr::ly
         }
     };
 
-    void write_to_stream(std::ostream& stream, const LyMusic& music) { LyFormatter(stream).write(music); }
+    std::size_t write_to_stream(std::ostream& stream, const LyMusic& music)
+    {
+        MeasureCache cache;
+        return write_to_stream(stream, music, cache);
+    }
+
+    std::size_t write_to_stream(std::ostream& stream, const LyMusic& music, MeasureCache& cache)
+    {
+        cache.clear();
+        LyFormatter formatter(stream, cache);
+        formatter.write(music);
+        return formatter.bytes_written();
+    }
 }
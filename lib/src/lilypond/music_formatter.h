@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace hkr::ly
+{
+    // Formatted measures, so that the measures repeated with the same state coming into them
+    // are copied from the earlier output instead of being formatted again. A cache can be kept
+    // for formatting many pieces of music one after another, clearing it keeps its capacity.
+    class MeasureCache
+    {
+    public:
+        struct Entry
+        {
+            const LyMeasure* measure = nullptr; // The first measure formatted into these bytes
+            std::size_t n_max_staves = 0;
+            std::size_t indentation = 0;
+            bool at_line_start = false;
+            Clef clef_before{};
+            Clef clef_after{};
+            bool ends_line = false;
+            std::size_t offset = 0; // Position of the bytes in bytes()
+            std::size_t size = 0;
+        };
+
+        // Returns the first entry with the hash which the predicate accepts, or nullptr if there is none
+        template <typename Pred>
+        const Entry* find(const std::uint64_t hash, Pred&& pred) const
+        {
+            if (slots_.empty())
+                return nullptr;
+            const std::size_t mask = slots_.size() - 1;
+            for (std::size_t i = hash & mask; slots_[i] != 0; i = (i + 1) & mask)
+            {
+                const std::size_t index = slots_[i] - 1;
+                if (hashes_[index] == hash && pred(entries_[index]))
+                    return &entries_[index];
+            }
+            return nullptr;
+        }
+
+        void insert(std::uint64_t hash, const Entry& entry);
+        void clear() noexcept;
+
+        std::string& bytes() noexcept { return bytes_; }
+
+    private:
+        std::vector<Entry> entries_;
+        std::vector<std::uint64_t> hashes_;
+        std::vector<std::uint32_t> slots_; // Open addressing table of entry index + 1, 0 marks an empty slot
+        std::string bytes_;
+
+        void grow();
+    };
+
+    // Same as the overload without a cache, the cache is cleared before use
+    std::size_t write_to_stream(std::ostream& stream, const LyMusic& music, MeasureCache& cache);
+}
@@ -1,10 +1,11 @@
 #pragma once
 
 #include <ostream>
-#include <optional>
 #include <clu/rational.h>
 
+#include "hikari/archive.h"
 #include "hikari/types.h"
+#include "../budget.h"
 
 namespace hkr::ly
 {
@@ -31,29 +32,66 @@ namespace hkr::ly
         TupletGroupPosition pos = TupletGroupPosition::none;
     };
 
+    // Index into the chord attributes of the music, 0 for the chords without any attributes
+    using AttributesId = std::uint32_t;
+
     // In a `LyChord`, when a chord is sustained, it means that it extends to the next chord,
-    // contrary to in the original `Chord` where sustained means that it sustains the previous chord
+    // contrary to in the original `Chord` where sustained means that it sustains the previous chord.
+    // The notes and the attributes are stored in the music and only referred to by ID, so that a chord
+    // is a small trivially copyable record, and splitting it in the partitioning copies no notes.
     struct LyChord
     {
         clu::rational<int> start;
         TupletAttributes tuplet;
-        std::optional<Chord> chord; // nullopt for when the voice is skipped here (spacer)
+        ChordId notes = ChordPool::rest;
+        AttributesId attributes = 0; // Only the first fragment of a split chord keeps the attributes
+        bool spacer = false; // The voice is skipped here, the notes and the other flags are unused
+        bool sustained = false;
         Clef clef_change{};
+
+        bool is_rest_or_spacer() const noexcept { return notes == ChordPool::rest; }
     };
 
     using LyVoice = std::vector<LyChord>;
 
+    // Braces of the repeated passages around a measure
+    struct RepeatBraces
+    {
+        int volta_times = 0; // Opens "\repeat volta n" before the measure if not 0
+        bool opens_alternatives = false; // Opens "\alternative" before the measure
+        bool opens_alternative = false; // Opens an ending before the measure
+        std::uint8_t n_closing = 0; // Number of braces closed after the measure
+
+        // The same repeats for the engraver, which draws them as bar lines and volta brackets instead
+        bool ends_pass = false; // A ":|" bar line after the measure goes back to the start of the body
+        int pass_count = 0; // Times the body is played, on the last measure of a body without endings
+        int first_pass = 0; // The passes taking the ending that starts before the measure, 0 if none starts
+        int last_pass = 0;
+        bool in_alternative = false; // Under the volta bracket of an ending
+        bool closes_alternative = false; // The volta bracket is closed after the measure
+    };
+
     struct LyMeasure
     {
         Time current_time;
         Time current_partial;
         Measure::Attributes attributes;
+        RepeatBraces repeat;
         std::vector<LyVoice> voices;
     };
 
     using LyStaff = std::vector<LyMeasure>;
-    using LyMusic = std::vector<LyStaff>;
 
-    LyMusic convert_to_ly(Music music);
-    void write_to_stream(std::ostream& stream, const LyMusic& music);
+    struct LyMusic
+    {
+        std::vector<LyStaff> staves;
+        ChordPool chords; // Notes of all the chords in the staves
+        // Attributes of the few chords that have any, the first entry is the empty attributes
+        std::vector<Chord::Attributes> chord_attributes{Chord::Attributes{}};
+    };
+
+    LyMusic convert_to_ly(const Music& music, ResourceBudget& budget);
+    LyMusic convert_to_ly(const archive::MusicView& music, ResourceBudget& budget);
+    // Returns the number of bytes written
+    std::size_t write_to_stream(std::ostream& stream, const LyMusic& music);
 }
@@ -0,0 +1,140 @@
+#include "hikari/mapped_file.h"
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace hkr
+{
+#ifdef _WIN32
+    MappedFile::MappedFile(const std::filesystem::path& path)
+    {
+        // The error code is read before closing any handle, which may overwrite it
+        const auto throw_error = [](const DWORD error, const char* what)
+        { throw std::system_error(static_cast<int>(error), std::system_category(), what); };
+
+        const HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw_error(::GetLastError(), "Failed to open the file for mapping");
+        LARGE_INTEGER file_size;
+        if (!::GetFileSizeEx(file, &file_size))
+        {
+            const DWORD error = ::GetLastError();
+            ::CloseHandle(file);
+            throw_error(error, "Failed to get the size of the file");
+        }
+        size_ = static_cast<std::size_t>(file_size.QuadPart);
+        if (size_ == 0) // Empty files cannot be mapped
+        {
+            ::CloseHandle(file);
+            return;
+        }
+        mapping_ = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const DWORD mapping_error = ::GetLastError();
+        ::CloseHandle(file);
+        if (!mapping_)
+            throw_error(mapping_error, "Failed to create the file mapping");
+        data_ = static_cast<const std::byte*>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_)
+        {
+            const DWORD error = ::GetLastError();
+            ::CloseHandle(mapping_);
+            mapping_ = nullptr;
+            throw_error(error, "Failed to map the file into memory");
+        }
+    }
+
+    void MappedFile::unmap() noexcept
+    {
+        if (data_)
+            ::UnmapViewOfFile(data_);
+        if (mapping_)
+            ::CloseHandle(mapping_);
+        data_ = nullptr;
+        mapping_ = nullptr;
+        size_ = 0;
+    }
+#else
+    MappedFile::MappedFile(const std::filesystem::path& path)
+    {
+        // The error code is read before closing the file, which may overwrite errno
+        const auto throw_error = [](const int error, const char* what)
+        { throw std::system_error(error, std::generic_category(), what); };
+
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw_error(errno, "Failed to open the file for mapping");
+        struct stat st{};
+        if (::fstat(fd, &st) != 0)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw_error(error, "Failed to get the size of the file");
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ == 0) // Empty files cannot be mapped
+        {
+            ::close(fd);
+            return;
+        }
+        void* ptr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        const int mmap_error = errno;
+        ::close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            size_ = 0;
+            throw_error(mmap_error, "Failed to map the file into memory");
+        }
+        data_ = static_cast<const std::byte*>(ptr);
+    }
+
+    void MappedFile::unmap() noexcept
+    {
+        if (data_)
+            ::munmap(const_cast<std::byte*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+#endif
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept:
+        data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+#ifdef _WIN32
+        ,
+        mapping_(std::exchange(other.mapping_, nullptr))
+#endif
+    {
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+#ifdef _WIN32
+            mapping_ = std::exchange(other.mapping_, nullptr);
+#endif
+        }
+        return *this;
+    }
+
+    MappedFile::~MappedFile() noexcept { unmap(); }
+} // namespace hkr
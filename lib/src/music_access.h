@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <ranges>
+#include <span>
+#include <vector>
+
+#include "hikari/archive.h"
+
+namespace hkr
+{
+    // Uniform read access to parsed sections and to sections viewed in place in an archive, so that the exporters
+    // are written once for both. The archive views are returned by value, bind them to const references.
+
+    inline std::span<const Staff> staves_of(const Section& section) noexcept { return section.staves; }
+    inline auto staves_of(const archive::SectionView& section) noexcept { return section.staves(); }
+
+    inline std::span<const Measure> measures_of(const Section& section) noexcept { return section.measures; }
+    inline auto measures_of(const archive::SectionView& section) noexcept { return section.measures(); }
+
+    inline std::span<const ChordAttributes> chord_attributes_of(const Section& section) noexcept
+    {
+        return section.chord_attributes;
+    }
+    inline auto chord_attributes_of(const archive::SectionView& section) noexcept { return section.chord_attributes(); }
+
+    // Indexed by the IDs of the chords, an entry is a range of notes
+    inline const ChordPool& chords_of(const Section& section) noexcept { return section.chords; }
+    inline auto chords_of(const archive::SectionView& section) noexcept { return section.chords(); }
+
+    // The repeats of an archive are copied into the scratch buffer, there are only a few of them in a section
+    inline std::span<const Repeat> repeats_of(const Section& section, std::vector<Repeat>&) noexcept
+    {
+        return section.repeats;
+    }
+    inline std::span<const Repeat> repeats_of(const archive::SectionView& section, std::vector<Repeat>& scratch)
+    {
+        scratch.clear();
+        for (const auto repeat : section.repeats())
+            scratch.push_back(repeat.to_repeat());
+        return scratch;
+    }
+
+    inline ChordId notes_of(const Chord& chord) noexcept { return chord.notes; }
+    inline ChordId notes_of(const archive::ChordView& chord) noexcept { return chord.notes(); }
+    inline bool is_sustained(const Chord& chord) noexcept { return chord.sustained; }
+    inline bool is_sustained(const archive::ChordView& chord) noexcept { return chord.sustained(); }
+
+    // The elements [begin, end) of a vector or an archive range
+    template <typename R>
+    auto slice(const R& range, const std::size_t begin, const std::size_t end) noexcept
+    {
+        const auto first = std::ranges::begin(range);
+        return std::ranges::subrange(
+            first + static_cast<std::ptrdiff_t>(begin), first + static_cast<std::ptrdiff_t>(end));
+    }
+} // namespace hkr
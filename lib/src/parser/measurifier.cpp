@@ -4,87 +4,233 @@
 #include <fmt/format.h>
 
 #include "hikari/api.h"
+#include "music_recycler.h"
+#include "../tracing.h"
 
 namespace hkr
 {
-    Music parse_music(std::string text)
+    Music parse_music(std::string text, const ParseOptions& options)
     {
-        auto preproc = Preprocessor(std::move(text)).process();
-        auto unmeasured = Parser(std::move(preproc)).parse();
-        auto measured = Measurifier(std::move(unmeasured)).process();
+        HIKARI_TRACE_ZONE("parse_music");
+        ResourceBudget budget(options);
+        const auto preproc = Preprocessor(budget).process(text);
+        auto unmeasured = Parser(budget).parse(preproc);
+        auto measured = Measurifier(budget).process(unmeasured);
         return measured;
     }
 
-    Music Measurifier::process()
+    Music Measurifier::process(UnmeasuredMusic& input)
     {
-        for (auto& in_sec : input_)
-            res_.push_back(convert_section(in_sec));
-        return std::move(res_);
+        Music res;
+        process(input, res);
+        return res;
     }
 
-    Section Measurifier::convert_section(UnmeasuredSection& input)
+    void Measurifier::process(UnmeasuredMusic& input, Music& res)
     {
-        Section res;
-        Time partial;
-        std::size_t beat_of_measure = 0;
+        StageScope scope(HIKARI_STATISTICS_OF(budget_), Stage::measurify);
+        n_measures_ = 0;
+        repeat_state_ = RepeatState::none;
+        repeat_ = {};
+        time_ = {};
+        res.swap(input.music);
+        std::span<const BeatAttributes> attributes = input.attributes;
+        for (std::size_t i = 0; i < res.size(); i++)
+        {
+            HIKARI_TRACE_ZONE("measurify section", i);
+            const auto n_attributes = static_cast<std::size_t>(std::ranges::find_if(attributes,
+                [i](const BeatAttributes& attrs) { return attrs.section != i; }) - attributes.begin());
+            convert_section(res[i], attributes.first(n_attributes), input.end_marks[i], i + 1 == res.size());
+            attributes = attributes.subspan(n_attributes);
+        }
+    }
+
+    template <typename T>
+    void Measurifier::reserve(std::vector<T>& vec, const std::size_t capacity)
+    {
+        if (recycler_)
+            recycler_->reserve(vec, capacity);
+        else
+            vec.reserve(capacity);
+    }
+
+    template <typename T, typename U>
+    T& Measurifier::push_back(std::vector<T>& vec, U&& value)
+    {
+        return recycler_ ? recycler_->push_back(vec, std::forward<U>(value)) : vec.emplace_back(std::forward<U>(value));
+    }
 
-        res.staves.resize(input.size());
-        const std::size_t n_beats = std::ranges::max(input, std::less{}, &UnmeasuredStaff::size).size();
-        for (auto& staff : res.staves)
-            staff.resize(n_beats);
+    void Measurifier::convert_section(Section& section, const std::span<const BeatAttributes> attributes,
+        const RepeatMarks& end_marks, const bool is_last)
+    {
+        auto& staves = section.staves;
+        const std::size_t n_beats = std::ranges::max_element(staves, std::less{}, &Staff::size)->size();
+        // Staves that end early are padded with rests
+        for (const auto& staff : staves)
+        {
+            const auto padding = n_beats - staff.size();
+            budget_.add(Limit::beats, padding);
+            budget_.allocate(padding * (sizeof(Beat) + sizeof(Voice) + sizeof(Chord)));
+        }
+        for (auto& staff : staves)
+        {
+            reserve(staff, n_beats);
+            while (staff.size() < n_beats)
+                push_back(push_back(push_back(staff, Beat()), Voice()), Chord()); // Emplace a rest
+        }
 
-        // We need to loop inside-out, i.e. collect every beat synchronizedly from each of the staves
-        // This is because we need to collect attributes from the staves
-        for (std::size_t i = 0; i < n_beats; i++)
+        // Only the beats with attributes need to be looked at, the attributes of the beats at the
+        // beginning of a measure are collected from all the staves
+        Time partial;
+        std::size_t begin = 0; // First beat of the current measure
+        for (auto iter = attributes.begin(); begin < n_beats;)
         {
             Measure::Attributes attrs;
-            for (std::size_t j = 0; j < res.staves.size(); j++)
+            RepeatMarks repeat_marks;
+            for (; iter != attributes.end() && iter->beat == begin; ++iter)
             {
-                auto& in_staff = input[j];
-                if (i >= in_staff.size()) // This staff ends early
-                {
-                    res.staves[j][i].emplace_back().emplace_back(); // Emplace a rest
-                    continue;
-                }
-                auto& in_beat = in_staff[i];
-                if (beat_of_measure != 0 && !in_beat.attrs.is_null())
-                {
-                    const std::string pos = fmt::format("on beat {}, measure {} with {}/{} time", //
-                        beat_of_measure + 1, n_measures_, partial.numerator, partial.denominator);
-                    if (in_beat.attrs.time.has_value() || in_beat.attrs.partial.has_value())
-                        throw ParseError("Time signatures should only appear at the beginning of measures, "
-                                         "but got a time signature " +
-                            pos);
-                    else
-                        throw ParseError("Key signatures should only appear at the beginning of measures, "
-                                         "but got a key signature " +
-                            pos);
-                }
-                attrs.merge_with(in_beat.attrs);
-                res.staves[j][i] = std::move(in_beat.beat);
+                attrs.merge_with(iter->attrs);
+                repeat_marks.merge_with(iter->attrs.repeat);
             }
-            if (beat_of_measure == 0)
+            budget_.add(Limit::measures);
+            budget_.allocate(sizeof(Measure));
+            push_back(section.measures, Measure{.start_beat = begin, .attributes = attrs});
+            if (attrs.time)
+                time_ = *attrs.time;
+            if (attrs.partial) // Partial measures doesn't count toward the number
+                partial = *attrs.partial;
+            else
+            {
+                partial = time_;
+                n_measures_++;
+            }
+            if (!repeat_marks.is_null())
+                apply_repeat_marks(section, repeat_marks, section.measures.size() - 1);
+
+            const std::size_t end = begin + static_cast<std::size_t>(partial.numerator);
+            if (iter != attributes.end() && iter->beat < end)
             {
-                res.measures.push_back({.start_beat = i, .attributes = attrs});
-                if (attrs.time)
-                    time_ = *attrs.time;
-                if (attrs.partial) // Partial measures doesn't count toward the number
-                    partial = *attrs.partial;
+                const std::string pos = fmt::format("on beat {}, measure {} with {}/{} time", //
+                    iter->beat - begin + 1, n_measures_, partial.numerator, partial.denominator);
+                if (iter->attrs.time.has_value() || iter->attrs.partial.has_value())
+                    throw ParseError("Time signatures should only appear at the beginning of measures, "
+                                     "but got a time signature " +
+                        pos);
+                else if (!iter->attrs.repeat.is_null())
+                    throw ParseError("Repeat signs and endings should only appear at the beginning of measures, "
+                                     "but got one " +
+                        pos);
                 else
+                    throw ParseError("Key signatures should only appear at the beginning of measures, "
+                                     "but got a key signature " +
+                        pos);
+            }
+            if (end > n_beats && !is_last)
+                throw ParseError(fmt::format("The section ends on an incomplete measure, beat {} of measure {} "
+                                             "with {}/{} time",
+                    n_beats - begin, n_measures_, partial.numerator, partial.denominator));
+            begin = end;
+        }
+
+        // The repeat signs at the end of the section close the repeat there, e.g. a ':|' without a start sign
+        if (!end_marks.is_null())
+            apply_repeat_marks(section, end_marks, section.measures.size());
+        // A repeated body or an ending that is still open is closed at the end of the section
+        if (repeat_state_ == RepeatState::body)
+            repeat_.end_measure = section.measures.size();
+        else if (repeat_state_ == RepeatState::alternative)
+            repeat_.alternative_ends.push_back(section.measures.size());
+        if (repeat_state_ != RepeatState::none)
+            finish_repeat(section);
+    }
+
+    void Measurifier::apply_repeat_marks(Section& section, const RepeatMarks& marks, const std::size_t measure)
+    {
+        const auto fail = [&](const std::string_view message)
+        {
+            if (measure == section.measures.size())
+                throw ParseError(fmt::format("{}, at the end of the section after measure {}", message, n_measures_));
+            throw ParseError(fmt::format("{}, at the beginning of measure {}", message, n_measures_));
+        };
+        const auto close_body = [&]
+        {
+            if (measure == repeat_.begin_measure)
+                fail("The body of a repeat is empty");
+            repeat_.end_measure = measure;
+        };
+
+        if (marks.start != 0 && marks.ending != 0)
+            fail("A repeat and an ending cannot start at the same measure");
+        if (repeat_state_ == RepeatState::none && (marks.end || marks.ending != 0))
+        {
+            // Without a start repeat sign, the body starts after the last repeat or at the start of the section
+            repeat_state_ = RepeatState::body;
+            repeat_ = {.begin_measure = section.repeats.empty() ? 0 : section.repeats.back().end_of_alternatives()};
+        }
+
+        switch (repeat_state_)
+        {
+            case RepeatState::none:
+                if (marks.close)
+                    fail("Got a '||' sign closing the last ending, but no repeat with endings is open");
+                break;
+            case RepeatState::body:
+                if (marks.close)
+                    fail("Got a '||' sign closing the last ending, but the open repeat has no endings");
+                if (!marks.end && marks.ending == 0)
+                    fail("Repeats are not nestable, but got a start repeat sign in the body of another repeat");
+                if (marks.ending > 1)
+                    fail(fmt::format("The first ending of a repeat should be numbered 1, but got {}", marks.ending));
+                if (marks.end && marks.ending != 0)
+                    fail("The first ending should directly follow the body, without an end repeat sign");
+                close_body();
+                if (marks.ending != 0)
+                    repeat_state_ = RepeatState::alternative;
+                else
+                    finish_repeat(section);
+                break;
+            case RepeatState::alternative:
+            {
+                const auto current = static_cast<int>(repeat_.alternative_ends.size()) + 1;
+                const auto close_alternative = [&]
+                {
+                    if (measure == repeat_.begin_of_alternative(repeat_.alternative_ends.size()))
+                        fail(fmt::format("The ending {} of a repeat is empty", current));
+                    repeat_.alternative_ends.push_back(measure);
+                };
+                if (marks.end)
+                {
+                    close_alternative();
+                    if (marks.ending == 0)
+                        finish_repeat(section);
+                    else if (marks.ending != current + 1)
+                        fail(fmt::format("Expecting the ending {} after the ending {}, but got the ending {}", //
+                            current + 1, current, marks.ending));
+                }
+                else if (marks.ending != 0)
+                    fail(fmt::format("The ending {} should be closed with ':|' before the next one starts", current));
+                else if (marks.close || marks.start != 0) // The last ending
                 {
-                    partial = time_;
-                    n_measures_++;
+                    close_alternative();
+                    finish_repeat(section);
                 }
+                break;
             }
-            if (++beat_of_measure == static_cast<std::size_t>(partial.numerator)) // Last beat of current measure
-                beat_of_measure = 0;
         }
 
-        if (beat_of_measure != 0 && &input != &input_.back())
-            throw ParseError(fmt::format("The section ends on an incomplete measure, beat {} of measure {} "
-                                         "with {}/{} time",
-                beat_of_measure, n_measures_, partial.numerator, partial.denominator));
+        if (marks.start != 0)
+        {
+            repeat_state_ = RepeatState::body;
+            repeat_ = {.begin_measure = measure, .times = marks.start};
+        }
+    }
 
-        return res;
+    void Measurifier::finish_repeat(Section& section)
+    {
+        repeat_.times = std::max(repeat_.times, static_cast<int>(repeat_.alternative_ends.size()));
+        budget_.allocate(sizeof(Repeat) + repeat_.alternative_ends.size() * sizeof(std::size_t));
+        section.repeats.push_back(std::move(repeat_));
+        repeat_state_ = RepeatState::none;
+        repeat_ = {};
     }
 } // namespace hkr
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <span>
+
 #include "hikari/types.h"
 #include "parser.h"
 
@@ -8,16 +10,39 @@ namespace hkr
     class Measurifier final
     {
     public:
-        explicit Measurifier(UnmeasuredMusic input): input_(std::move(input)) {}
+        explicit Measurifier(ResourceBudget& budget, MusicRecycler* recycler = nullptr):
+            budget_(budget), recycler_(recycler) {}
+
+        // The music of the input is moved into the result, only the staves that end early are touched
+        Music process(UnmeasuredMusic& input);
 
-        Music process();
+        // Measurifies into a result of an earlier call, which is swapped with the music of the input.
+        // The vectors of the music are grown by the recycler if any.
+        void process(UnmeasuredMusic& input, Music& res);
 
     private:
-        Section convert_section(UnmeasuredSection& input);
+        enum class RepeatState : std::uint8_t
+        {
+            none,
+            body,
+            alternative
+        };
+
+        template <typename T>
+        void reserve(std::vector<T>& vec, std::size_t capacity);
+        template <typename T, typename U>
+        T& push_back(std::vector<T>& vec, U&& value);
+
+        void convert_section(Section& section, std::span<const BeatAttributes> attributes,
+            const RepeatMarks& end_marks, bool is_last);
+        void apply_repeat_marks(Section& section, const RepeatMarks& marks, std::size_t measure);
+        void finish_repeat(Section& section);
 
         std::size_t n_measures_ = 0;
-        UnmeasuredMusic input_;
+        RepeatState repeat_state_ = RepeatState::none;
+        Repeat repeat_;
+        ResourceBudget& budget_;
+        MusicRecycler* recycler_;
         Time time_;
-        Music res_;
     };
 }
@@ -0,0 +1,54 @@
+#include "music_recycler.h"
+
+namespace hkr
+{
+    void MusicRecycler::recycle(Music& music)
+    {
+        for (Section& section : music)
+            release(section);
+        music.clear();
+    }
+
+    void MusicRecycler::recycle(UnmeasuredMusic& music)
+    {
+        recycle(music.music);
+        music.attributes.clear();
+        music.end_marks.clear();
+    }
+
+    ChordPool MusicRecycler::take_chord_pool()
+    {
+        if (chord_pools_.empty())
+            return {};
+        ChordPool res = std::move(chord_pools_.back());
+        chord_pools_.pop_back();
+        return res;
+    }
+
+    void MusicRecycler::release(Voice& voice) { put(voice); }
+
+    void MusicRecycler::release(Beat& beat)
+    {
+        for (Voice& voice : beat)
+            release(voice);
+        put(beat);
+    }
+
+    void MusicRecycler::release(Staff& staff)
+    {
+        for (Beat& beat : staff)
+            release(beat);
+        put(staff);
+    }
+
+    void MusicRecycler::release(Section& section)
+    {
+        for (Staff& staff : section.staves)
+            release(staff);
+        put(section.staves);
+        put(section.measures);
+        put(section.chord_attributes);
+        section.chords.clear();
+        chord_pools_.push_back(std::move(section.chords));
+    }
+} // namespace hkr
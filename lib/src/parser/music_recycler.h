@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <iterator>
+#include <tuple>
+
+#include "hikari/types.h"
+#include "parser.h"
+
+namespace hkr
+{
+    // Free lists of the vectors of discarded music, sorted by their capacities. The parser and the
+    // measurifier grow their vectors through the recycler, which hands out a discarded vector that
+    // is large enough instead of allocating a new one. The vector that is outgrown goes back to the
+    // free lists, so parsing an input of a similar size to an earlier one does not allocate, no
+    // matter in which order the vectors are built.
+    class MusicRecycler final
+    {
+    public:
+        void recycle(Music& music);
+        void recycle(UnmeasuredMusic& music);
+
+        // Hands out a cleared chord pool of a discarded section, or a new one
+        ChordPool take_chord_pool();
+
+        template <typename T>
+        void reserve(std::vector<T>& vec, const std::size_t capacity)
+        {
+            if (capacity > vec.capacity())
+                grow(vec, capacity);
+        }
+
+        template <typename T, typename U>
+        T& push_back(std::vector<T>& vec, U&& value)
+        {
+            if (vec.size() == vec.capacity())
+                grow(vec, vec.size() + 1);
+            return vec.emplace_back(std::forward<U>(value));
+        }
+
+        template <typename T>
+        void pop_back(std::vector<T>& vec)
+        {
+            release(vec.back());
+            vec.pop_back();
+        }
+
+    private:
+        static constexpr std::size_t n_buckets = 32; // The vectors in bucket k have capacities in [2^k, 2^(k+1))
+
+        template <typename T>
+        using Buckets = std::array<std::vector<std::vector<T>>, n_buckets>;
+
+        std::tuple<Buckets<Chord>, Buckets<Voice>, Buckets<Beat>, Buckets<Staff>, Buckets<Measure>,
+            Buckets<ChordAttributes>>
+            buckets_;
+        std::vector<ChordPool> chord_pools_;
+
+        template <typename T>
+        void put(std::vector<T>& vec)
+        {
+            if (vec.capacity() == 0) // Moved from, nothing to keep
+                return;
+            vec.clear();
+            const auto bucket = std::min<std::size_t>(std::bit_width(vec.capacity()) - 1, n_buckets - 1);
+            std::get<Buckets<T>>(buckets_)[bucket].push_back(std::move(vec));
+        }
+
+        template <typename T>
+        void grow(std::vector<T>& vec, const std::size_t capacity)
+        {
+            // Grow geometrically like std::vector, rounding up to a power of 2 for the buckets
+            const std::size_t wanted = std::bit_ceil(std::max(capacity, vec.capacity() * 2));
+            const auto index = std::min<std::size_t>(std::bit_width(wanted) - 1, n_buckets - 1);
+            auto& bucket = std::get<Buckets<T>>(buckets_)[index];
+            std::vector<T> res;
+            if (!bucket.empty() && bucket.back().capacity() >= wanted)
+            {
+                res = std::move(bucket.back());
+                bucket.pop_back();
+            }
+            else
+                res.reserve(wanted);
+            res.insert(res.end(), std::make_move_iterator(vec.begin()), std::make_move_iterator(vec.end()));
+            put(vec);
+            vec = std::move(res);
+        }
+
+        static void release(Chord&) noexcept {} // The notes are in the chord pool of the section
+        void release(Voice& voice);
+        void release(Beat& beat);
+        void release(Staff& staff);
+        void release(Section& section);
+    };
+} // namespace hkr
@@ -2,12 +2,15 @@
 
 #include <ranges>
 #include <algorithm>
+#include <span>
 #include <utility>
 #include <fmt/format.h>
 #include <clu/parse.h>
 #include <clu/concepts.h>
 
 #include "parser.h"
+#include "music_recycler.h"
+#include "../tracing.h"
 
 namespace hkr
 {
@@ -39,36 +42,152 @@ namespace hkr
             }
             return false;
         }
+
+        // A beat that no voice has reached yet, only used to carry measure attributes
+        bool is_null_beat(const Beat& beat) noexcept { return std::ranges::all_of(beat, &Voice::empty); }
+
+        void replace_nulls_with_rests(Beat& beat)
+        {
+            for (Voice& voice : beat)
+            {
+                if (voice.empty())
+                    voice.emplace_back();
+            }
+        }
     } // namespace
 
-    bool BeatWithMeasureAttrs::is_null() const noexcept { return std::ranges::all_of(beat, &Voice::empty); }
+    void RepeatMarks::merge_with(const RepeatMarks& other) noexcept
+    {
+        if (other.start != 0)
+            start = other.start;
+        if (other.ending != 0)
+            ending = other.ending;
+        end = end || other.end;
+        close = close || other.close;
+    }
 
-    void BeatWithMeasureAttrs::replace_nulls_with_rests()
+    void BarAttributes::merge_with(const BarAttributes& other)
     {
-        for (Voice& voice : beat)
+        Measure::Attributes::merge_with(other);
+        repeat.merge_with(other.repeat);
+    }
+
+    UnmeasuredMusic Parser::parse(const PreprocessedText& text)
+    {
+        UnmeasuredMusic res;
+        parse(text, res);
+        return res;
+    }
+
+    void Parser::parse(const PreprocessedText& text, UnmeasuredMusic& res)
+    {
+        StageScope scope(HIKARI_STATISTICS_OF(budget_), Stage::parse);
+        text_ = &text;
+        music_ = &res;
+        music_->music.clear();
+        music_->attributes.clear();
+        music_->end_marks.clear();
+        measure_attrs_ = {};
+        measure_attrs_.time = Time{4, 4};
+        chord_attrs_ = {};
+        transposition_ = {};
+        octave_ = 4;
+        std::string_view view = text_->text.content;
+        while (!view.empty())
         {
-            if (voice.empty())
-                voice.emplace_back();
+            HIKARI_TRACE_ZONE("parse section", music_->music.size());
+            parse_section(isolate_current_section(view));
         }
     }
 
-    UnmeasuredMusic Parser::parse()
+    template <typename T, typename U>
+    T& Parser::push_back(std::vector<T>& vec, U&& value)
     {
-        measure_attrs_.time = Time{4, 4};
-        std::string_view text = text_.text.content;
-        while (!text.empty())
-            parse_section(isolate_current_section(text));
-        return std::move(music_);
+        return recycler_ ? recycler_->push_back(vec, std::forward<U>(value)) : vec.emplace_back(std::forward<U>(value));
+    }
+
+    template <typename T>
+    void Parser::pop_back(std::vector<T>& vec)
+    {
+        if (recycler_)
+            recycler_->pop_back(vec);
+        else
+            vec.pop_back();
+    }
+
+    // The attributes of the staff being parsed are at the end of the list
+    std::size_t Parser::first_attributes_of_staff() const noexcept
+    {
+        const auto& attributes = music_->attributes;
+        const std::size_t section = music_->music.size() - 1, staff = music_->music.back().staves.size() - 1;
+        std::size_t res = attributes.size();
+        while (res > 0 && attributes[res - 1].section == section && attributes[res - 1].staff == staff)
+            res--;
+        return res;
+    }
+
+    // Merges the pending measure attributes into those of a beat of the current staff
+    void Parser::merge_measure_attributes(const std::size_t beat)
+    {
+        if (measure_attrs_.is_null())
+            return;
+        auto& attributes = music_->attributes;
+        // Usually appended, but the later voices of a multi-voiced segment go back to earlier beats
+        std::size_t idx = attributes.size();
+        for (const std::size_t first = first_attributes_of_staff(); idx > first && attributes[idx - 1].beat >= beat;)
+            idx--;
+        if (idx == attributes.size() || attributes[idx].beat != beat)
+        {
+            budget_.allocate(sizeof(BeatAttributes));
+            attributes.insert(attributes.begin() + static_cast<std::ptrdiff_t>(idx),
+                BeatAttributes{
+                    .section = music_->music.size() - 1,
+                    .staff = music_->music.back().staves.size() - 1,
+                    .beat = beat //
+                });
+        }
+        attributes[idx].attrs.merge_with(measure_attrs_);
+        measure_attrs_ = {};
+    }
+
+    // Removes the measure attributes of a beat of the current staff
+    BarAttributes Parser::take_measure_attributes(const std::size_t beat)
+    {
+        auto& attributes = music_->attributes;
+        for (std::size_t i = attributes.size(), first = first_attributes_of_staff(); i > first; i--)
+        {
+            if (attributes[i - 1].beat == beat)
+            {
+                BarAttributes res = std::move(attributes[i - 1].attrs);
+                attributes.erase(attributes.begin() + static_cast<std::ptrdiff_t>(i - 1));
+                return res;
+            }
+        }
+        return {};
+    }
+
+    // Gives the pending chord attributes to a chord of the current staff
+    void Parser::attach_chord_attributes(const std::size_t beat, const std::size_t voice, const std::size_t chord)
+    {
+        if (chord_attrs_.is_null())
+            return;
+        Section& section = music_->music.back();
+        budget_.allocate(sizeof(ChordAttributes));
+        push_back(section.chord_attributes,
+            ChordAttributes{
+                .position = {.beat = beat, .staff = section.staves.size() - 1, .voice = voice, .chord = chord},
+                .attributes = std::exchange(chord_attrs_, {}) //
+            });
     }
 
     std::size_t Parser::offset_of(const std::string_view view) const noexcept
     {
-        return static_cast<std::size_t>(view.data() - text_.text.content.data());
+        return static_cast<std::size_t>(view.data() - text_->text.content.data());
     }
 
     TextPosition Parser::pos_of(const std::string_view view, const std::size_t offset) const noexcept
     {
-        return text_.text.positions[offset_of(view) + offset];
+        return text_->text.positions[offset_of(view) + offset];
     }
 
     bool Parser::parse_attributes(std::string_view& text)
@@ -90,7 +209,11 @@ namespace hkr
     {
         if (text.empty())
             throw ParseError("Empty attribute found " + pos_of(text).to_string());
-        if (text[0] == '+' || text[0] == '-')
+        if (text[0] == '|' || text[0] == ':')
+            parse_repeat_sign(text);
+        else if (text.size() == 2 && text[1] == '.' && text[0] >= '0' && text[0] <= '9')
+            parse_ending(text);
+        else if (text[0] == '+' || text[0] == '-')
             parse_transposition(text);
         else if (text.find('/') != npos)
             parse_time_signature(text);
@@ -100,6 +223,49 @@ namespace hkr
             parse_tempo(text);
     }
 
+    void Parser::parse_repeat_sign(std::string_view text)
+    {
+        const auto full = text;
+        RepeatMarks& marks = measure_attrs_.repeat;
+        if (text == "||")
+        {
+            marks.close = true;
+            return;
+        }
+        if (consume_if_starts_with(text, ":|"))
+        {
+            marks.end = true;
+            if (!consume_if_starts_with(text, ':')) // Not ":|:", no repeat starts here
+            {
+                if (!text.empty())
+                    throw ParseError(fmt::format("Unknown repeat sign '{}' {}", full, pos_of(full).to_string()));
+                return;
+            }
+        }
+        else if (!consume_if_starts_with(text, "|:"))
+            throw ParseError(fmt::format("Unknown repeat sign '{}', expecting '|:', ':|', ':|:' or '||' {}", //
+                full, pos_of(full).to_string()));
+
+        // A repeat starts here, optionally followed by the number of times it is played
+        marks.start = 2;
+        if (text.empty())
+            return;
+        if (const auto opt = clu::parse<int>(text); !opt || *opt < 2 || *opt > 16)
+            throw ParseError(fmt::format("The number of times a passage is played should be an integer "
+                                         "between 2 and 16, but got '{}' {}",
+                text, pos_of(text).to_string()));
+        else
+            marks.start = *opt;
+    }
+
+    void Parser::parse_ending(const std::string_view text)
+    {
+        if (text[0] == '0')
+            throw ParseError("The endings of a repeat are numbered from 1, but got an ending numbered 0 " +
+                pos_of(text).to_string());
+        measure_attrs_.repeat.ending = text[0] - '0';
+    }
+
     void Parser::parse_transposition(std::string_view text)
     {
         transposition_.up = text[0] == '+';
@@ -206,6 +372,10 @@ namespace hkr
             throw ParseError("Key signatures should only appear at the beginning of "
                              "bars, but got a key signature before a chord in the middle of a beat " +
                 pos.to_string());
+        if (!measure_attrs_.repeat.is_null())
+            throw ParseError("Repeat signs and endings should only appear at the beginning of "
+                             "bars, but got one before a chord in the middle of a beat " +
+                pos.to_string());
     }
 
     std::string_view Parser::isolate_current_section(std::string_view& text) const
@@ -233,12 +403,24 @@ namespace hkr
         if (const auto idx = text.find('{'); idx != npos)
             throw ParseError("Sections are not nestable, but found '{' in a section " + //
                 pos_of(text, idx).to_string());
-        const auto& section = music_.emplace_back(); // Add a section
+        auto& section = music_->music.emplace_back(); // Add a section
+        if (recycler_)
+            section.chords = recycler_->take_chord_pool();
+        music_->end_marks.emplace_back();
+        const std::size_t first_attributes = music_->attributes.size();
         while (!text.empty())
             parse_staff(isolate_current_staff(text));
         // Section with no staves (only attributes)
-        if (section.empty())
-            music_.pop_back();
+        if (section.staves.empty())
+        {
+            pop_back(music_->music);
+            music_->end_marks.pop_back();
+            return;
+        }
+        // The measurifier goes through the beats of all the staves at once
+        std::ranges::sort(std::span(music_->attributes).subspan(first_attributes), std::less{},
+            [](const BeatAttributes& attrs) { return std::pair(attrs.beat, attrs.staff); });
+        std::ranges::sort(section.chord_attributes, std::less{}, &ChordAttributes::position);
     }
 
     std::string_view Parser::isolate_current_staff(std::string_view& text) const
@@ -275,8 +457,9 @@ namespace hkr
 
     void Parser::parse_staff(std::string_view text)
     {
-        auto& section = music_.back();
-        const auto& staff = section.emplace_back();
+        const auto full = text;
+        auto& section = music_->music.back().staves;
+        const auto& staff = push_back(section, Staff());
         while (!text.empty())
             parse_voiced_segment(isolate_current_voiced_segment(text));
         // Remove the empty staff, when the staff only contains null beats of attributes.
@@ -285,8 +468,25 @@ namespace hkr
         // measure attributes. Null beats should not exist in the final data structure,
         // as they should be removed and gotten their attributes merged into the next beat
         // once we have parsed the next beat.
-        if (staff.empty() || staff[0].beat.empty())
-            section.pop_back();
+        if (staff.empty() || staff[0].empty())
+        {
+            music_->attributes.resize(first_attributes_of_staff());
+            std::erase_if(music_->music.back().chord_attributes,
+                [&](const ChordAttributes& attrs) { return attrs.position.staff == section.size() - 1; });
+            pop_back(section);
+            return;
+        }
+        // The repeat signs at the end of a staff end the section, they are resolved by the measurifier
+        // after the last measure, together with those of the other staves
+        if (RepeatMarks& marks = measure_attrs_.repeat; !marks.is_null())
+        {
+            if (marks.start != 0 || marks.ending != 0)
+                throw ParseError("A repeat or an ending cannot start at the end of a section, "
+                                 "but got one at the end of the staff starting " +
+                    pos_of(full).to_string());
+            music_->end_marks.back().merge_with(marks);
+            marks = {};
+        }
     }
 
     std::string_view Parser::isolate_current_voiced_segment(std::string_view& text) const
@@ -307,61 +507,69 @@ namespace hkr
 
     void Parser::parse_voiced_segment(std::string_view text)
     {
-        auto& staff = music_.back().back();
+        auto& staff = music_->music.back().staves.back();
         const auto starting_beat = staff.size();
         // Parse the respective voices
         for (std::size_t i = 0; const auto view : std::views::split(text, ';'))
         {
+            budget_.check(Limit::voices, i + 1, [&] { return pos_of(as_sv(view)).to_string(); });
             parse_voice(as_sv(view), starting_beat, i);
             i++;
         }
         // If the last beat is a null beat, move the measure attribute into the class field,
         // and then remove the null beat
-        if (BeatWithMeasureAttrs& last = staff.back(); last.is_null())
+        if (is_null_beat(staff.back()))
         {
-            measure_attrs_ = std::exchange(last.attrs, {});
-            staff.pop_back();
+            measure_attrs_ = take_measure_attributes(staff.size() - 1);
+            pop_back(staff);
         }
         // Fill remaining null beats with rests
         for (auto i = starting_beat; i < staff.size(); i++)
-            staff[i].replace_nulls_with_rests();
+            replace_nulls_with_rests(staff[i]);
     }
 
     void Parser::parse_voice(std::string_view text, const std::size_t starting_beat, const std::size_t voice_idx)
     {
-        auto& staff = music_.back().back(); // Get current staff
+        auto& staff = music_->music.back().staves.back(); // Get current staff
         std::size_t beat_idx = starting_beat;
         bool should_add_null_beat = false;
 
-        const auto get_beat = [&](const std::size_t idx) -> BeatWithMeasureAttrs&
+        const auto get_beat = [&](const std::size_t idx) -> Beat&
         {
-            BeatWithMeasureAttrs& beat = idx < staff.size() ? staff[idx] : staff.emplace_back();
+            if (idx >= staff.size())
+            {
+                budget_.add(Limit::beats);
+                budget_.allocate(sizeof(Beat));
+                push_back(staff, Beat());
+            }
+            Beat& beat = staff[idx];
             // Fill former voices with fewer beats with null beats to match this voice
-            for (std::size_t i = beat.beat.size(); i <= voice_idx; i++)
-                beat.beat.emplace_back();
+            if (beat.size() <= voice_idx)
+                budget_.allocate((voice_idx + 1 - beat.size()) * sizeof(Voice));
+            for (std::size_t i = beat.size(); i <= voice_idx; i++)
+                push_back(beat, Voice());
             return beat;
         };
 
         while (!text.empty())
         {
-            BeatWithMeasureAttrs& beat = get_beat(beat_idx);
-            parse_beat_in_voice(isolate_current_beat_in_voice(text), beat, voice_idx);
+            Beat& beat = get_beat(beat_idx);
+            parse_beat_in_voice(isolate_current_beat_in_voice(text), beat, beat_idx, voice_idx);
             // Only if we get a normal beat at the end, do we need to add another null beat
             // if we've got attributes to merge
-            should_add_null_beat = !beat.beat[voice_idx].empty();
+            should_add_null_beat = !beat[voice_idx].empty();
             beat_idx++;
         }
 
         if (should_add_null_beat && !measure_attrs_.is_null())
         {
-            BeatWithMeasureAttrs& beat = get_beat(beat_idx++);
-            beat.attrs.merge_with(measure_attrs_);
-            measure_attrs_ = {};
+            get_beat(beat_idx);
+            merge_measure_attributes(beat_idx++);
         }
 
         // Fill up the current voice with null beats
         for (; beat_idx < staff.size(); beat_idx++)
-            staff[beat_idx].beat.emplace_back();
+            push_back(staff[beat_idx], Voice());
     }
 
     std::string_view Parser::isolate_current_beat_in_voice(std::string_view& text) const
@@ -394,20 +602,22 @@ namespace hkr
         }
     }
 
-    void Parser::parse_beat_in_voice(std::string_view text, BeatWithMeasureAttrs& beat, const std::size_t voice_idx)
+    void Parser::parse_beat_in_voice(
+        std::string_view text, Beat& beat, const std::size_t beat_idx, const std::size_t voice_idx)
     {
-        Voice& voice = beat.beat[voice_idx];
+        Voice& voice = beat[voice_idx];
         while (!(text.empty() || text == ","))
         {
             if (parse_attributes(text)) // Accumulate attributes
                 continue;
-            voice.push_back(parse_chord(text));
+            push_back(voice, parse_chord(text));
+            attach_chord_attributes(beat_idx, voice_idx, voice.size() - 1);
+            budget_.check(Limit::subdivision, voice.size(), [&] { return pos_of(text).to_string(); });
+            budget_.allocate(sizeof(Chord));
+            HIKARI_WITH_STATISTICS(budget_, stats) stats->chords++;
             // We got a new chord, merge the measure attributes if needed
             if (voice.size() == 1) // Chord at the start of a beat
-            {
-                beat.attrs.merge_with(measure_attrs_);
-                measure_attrs_ = {};
-            }
+                merge_measure_attributes(beat_idx);
             else // Got a measure attribute applied to a chord in the middle of a beat
                 ensure_no_measure_attributes(pos_of(text));
         }
@@ -415,9 +625,9 @@ namespace hkr
         // Fill current beat with rest if there's a delimiter
         if (text == "," && voice.empty())
         {
-            voice.emplace_back().attributes = std::exchange(chord_attrs_, {});
-            beat.attrs.merge_with(measure_attrs_);
-            measure_attrs_ = {};
+            push_back(voice, Chord());
+            attach_chord_attributes(beat_idx, voice_idx, 0);
+            merge_measure_attributes(beat_idx);
         }
         else if (text.empty())
         {
@@ -425,16 +635,13 @@ namespace hkr
                 throw ParseError("A beat should end with a comma, but a beat ends unexpectedly without the comma " +
                     pos_of(text).to_string());
             else // Apply measure attributes to the null beat
-            {
-                beat.attrs.merge_with(measure_attrs_);
-                measure_attrs_ = {};
-            }
+                merge_measure_attributes(beat_idx);
         }
     }
 
     Chord Parser::parse_chord(std::string_view& text)
     {
-        Chord chord{.attributes = std::exchange(chord_attrs_, {})};
+        Chord chord;
         // Rest
         if (consume_if_starts_with(text, '.'))
             return chord;
@@ -445,14 +652,15 @@ namespace hkr
             return chord;
         }
         // Multi-note chord
+        chord_notes_.clear();
         if (consume_if_starts_with(text, '('))
         {
             while (!consume_if_starts_with(text, ')'))
-                chord.notes.push_back(parse_note(text));
-            return chord;
+                chord_notes_.push_back(parse_note(text));
         }
-        // Single note
-        chord.notes.push_back(parse_note(text));
+        else // Single note
+            chord_notes_.push_back(parse_note(text));
+        chord.notes = music_->music.back().chords.intern(chord_notes_);
         return chord;
     }
 
@@ -471,6 +679,9 @@ namespace hkr
                 text[0], pos_of(text).to_string()));
 
         const auto full = text;
+        budget_.add(Limit::notes, 1, [&] { return pos_of(full).to_string(); });
+        budget_.allocate(sizeof(Note));
+        HIKARI_WITH_STATISTICS(budget_, stats) stats->notes++;
         static constexpr NoteBase bases[]{
             NoteBase::a, NoteBase::b, NoteBase::c, NoteBase::d, NoteBase::e, NoteBase::f, NoteBase::g //
         };
@@ -4,18 +4,45 @@
 
 namespace hkr
 {
-    struct BeatWithMeasureAttrs
+    // Repeat signs on the bar line before a measure
+    struct RepeatMarks
     {
-        Beat beat;
-        Measure::Attributes attrs;
+        int start = 0; // Number of times the body is played if a repeat starts here ("|:"), 0 otherwise
+        int ending = 0; // Number of the ending starting here ("1."), 0 otherwise
+        bool end = false; // End of the body or of an ending that is not the last one (":|")
+        bool close = false; // End of the last ending ("||")
 
-        bool is_null() const noexcept;
-        void replace_nulls_with_rests();
+        bool is_null() const noexcept { return start == 0 && ending == 0 && !end && !close; }
+        void merge_with(const RepeatMarks& other) noexcept;
     };
 
-    using UnmeasuredStaff = std::vector<BeatWithMeasureAttrs>;
-    using UnmeasuredSection = std::vector<UnmeasuredStaff>;
-    using UnmeasuredMusic = std::vector<UnmeasuredSection>;
+    // Measure attributes, plus the repeat signs that are resolved into repeats on measurification
+    struct BarAttributes : Measure::Attributes
+    {
+        RepeatMarks repeat;
+
+        bool is_null() const noexcept { return Measure::Attributes::is_null() && repeat.is_null(); }
+        void merge_with(const BarAttributes& other);
+    };
+
+    // Measure attributes of a beat in a staff, only the few beats that have any are listed
+    struct BeatAttributes
+    {
+        std::size_t section = 0;
+        std::size_t staff = 0;
+        std::size_t beat = 0;
+        BarAttributes attrs;
+    };
+
+    // Parsed music whose beats are already in their final staves, but not grouped into measures yet.
+    // The measure attributes are kept aside, so that the measurifier only needs to walk through them
+    // instead of moving every beat into a new staff.
+    struct UnmeasuredMusic
+    {
+        Music music; // Only the staves of the sections are filled in
+        std::vector<BeatAttributes> attributes; // Sorted by section, then by beat, then by staff
+        std::vector<RepeatMarks> end_marks; // Repeat signs at the end of each section, merged over the staves
+    };
 
     struct Transposition
     {
@@ -23,26 +50,47 @@ namespace hkr
         bool up = true;
     };
 
+    class MusicRecycler;
+
     class Parser final
     {
     public:
-        explicit Parser(PreprocessedText text): text_(std::move(text)) {}
+        explicit Parser(ResourceBudget& budget, MusicRecycler* recycler = nullptr):
+            budget_(budget), recycler_(recycler) {}
 
-        UnmeasuredMusic parse();
+        UnmeasuredMusic parse(const PreprocessedText& text);
+
+        // Parses into a result of an earlier call, the vectors of the music are grown by the recycler if any
+        void parse(const PreprocessedText& text, UnmeasuredMusic& res);
 
     private:
-        PreprocessedText text_;
-        UnmeasuredMusic music_;
-        Measure::Attributes measure_attrs_;
+        const PreprocessedText* text_ = nullptr;
+        ResourceBudget& budget_;
+        MusicRecycler* recycler_;
+        UnmeasuredMusic* music_ = nullptr;
+        BarAttributes measure_attrs_;
         Chord::Attributes chord_attrs_;
         Transposition transposition_;
+        std::vector<Note> chord_notes_; // Notes of the chord being parsed, before they are interned
         int octave_ = 4;
 
+        template <typename T, typename U>
+        T& push_back(std::vector<T>& vec, U&& value);
+        template <typename T>
+        void pop_back(std::vector<T>& vec);
+
+        std::size_t first_attributes_of_staff() const noexcept;
+        void merge_measure_attributes(std::size_t beat);
+        BarAttributes take_measure_attributes(std::size_t beat);
+        void attach_chord_attributes(std::size_t beat, std::size_t voice, std::size_t chord);
+
         std::size_t offset_of(std::string_view view) const noexcept;
         TextPosition pos_of(std::string_view view, std::size_t offset = 0) const noexcept;
 
         bool parse_attributes(std::string_view& text);
         void parse_one_attribute(std::string_view text);
+        void parse_repeat_sign(std::string_view text);
+        void parse_ending(std::string_view text);
         void parse_transposition(std::string_view text);
         void parse_time_signature(std::string_view text);
         void parse_key_signature(std::string_view text);
@@ -60,7 +108,7 @@ namespace hkr
         void parse_voice(std::string_view text, std::size_t starting_beat, std::size_t voice_idx);
 
         std::string_view isolate_current_beat_in_voice(std::string_view& text) const;
-        void parse_beat_in_voice(std::string_view text, BeatWithMeasureAttrs& beat, std::size_t voice_idx);
+        void parse_beat_in_voice(std::string_view text, Beat& beat, std::size_t beat_idx, std::size_t voice_idx);
         Chord parse_chord(std::string_view& text);
         Note parse_note(std::string_view& text);
     };
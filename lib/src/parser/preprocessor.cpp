@@ -6,32 +6,50 @@
 
 namespace hkr
 {
-    Preprocessor::Preprocessor(std::string text, const std::size_t max_macro_length):
-        text_(std::move(text)), max_macro_length_(max_macro_length)
+    namespace
     {
+        // Names of the macros kept between the calls to reuse their nodes, a result
+        // that has seen more distinct names than this forgets them all
+        constexpr std::size_t max_kept_macro_names = 1024;
+    } // namespace
+
+    PreprocessedText Preprocessor::process(const std::string_view text)
+    {
+        PreprocessedText res;
+        process(text, res);
+        return res;
     }
 
-    PreprocessedText Preprocessor::process()
+    void Preprocessor::process(const std::string_view text, PreprocessedText& res)
     {
-        remove_whitespaces();
+        StageScope scope(HIKARI_STATISTICS_OF(budget_), Stage::preprocess);
+        res_ = &res;
+        res_->text.content.clear();
+        res_->text.positions.clear();
+        if (res_->macros.size() > max_kept_macro_names)
+            res_->macros.clear();
+        else
+            for (auto& [name, map] : res_->macros)
+                map = nullptr;
+        n_maps_ = 0;
+        remove_whitespaces(text);
         std::string_view view = text_;
         while (!view.empty())
         {
             const auto idx = view.find_first_of("!*");
             if (idx == npos)
             {
-                append_text_to_map(res_.text, view);
+                append_text_to_map(res_->text, view);
                 break;
             }
-            append_text_to_map(res_.text, view.substr(0, idx));
+            append_text_to_map(res_->text, view.substr(0, idx));
             view.remove_prefix(idx);
             if (view[0] == '!')
                 parse_consume_macro_def(view);
             else
-                append_macro_to_map(res_.text, parse_consume_macro_ref(view));
+                append_macro_to_map(res_->text, parse_consume_macro_ref(view));
         }
-        res_.text.positions.emplace_back(); // Add an EOF mark at the end
-        return std::move(res_);
+        res_->text.positions.emplace_back(); // Add an EOF mark at the end
     }
 
     std::size_t Preprocessor::offset_of(const std::string_view view) const noexcept
@@ -39,12 +57,15 @@ namespace hkr
         return static_cast<std::size_t>(view.data() - text_.data());
     }
 
-    void Preprocessor::remove_whitespaces()
+    void Preprocessor::remove_whitespaces(const std::string_view text)
     {
-        std::string res;
-        res.reserve(text_.size());
+        budget_.allocate(text.size() * (sizeof(char) + sizeof(TextPosition)));
+        text_.clear();
+        text_.reserve(text.size());
+        original_pos_.clear();
+        original_pos_.reserve(text.size());
         std::size_t line = 1, column = 1;
-        for (const char ch : text_)
+        for (const char ch : text)
         {
             switch (ch)
             {
@@ -56,40 +77,47 @@ namespace hkr
                 case ' ': column++; continue;
                 case '\t': column += 4; continue;
                 default:
-                    res.push_back(ch);
+                    text_.push_back(ch);
                     original_pos_.emplace_back(line, column);
                     column++;
                     continue;
             }
         }
-        text_ = std::move(res);
     }
 
-    void Preprocessor::append_text_to_map(TextPositionMap& map, const std::string_view view) const
+    void Preprocessor::account_expansion(
+        const TextPositionMap& map, const std::size_t appended, const std::string_view view)
+    {
+        budget_.check(Limit::expanded_bytes, map.content.size() + appended,
+            [&]
+            {
+                const auto pos = original_pos_[offset_of(view)].to_string();
+                return map.name.empty() ? pos : fmt::format("when expanding macro '{}' {}", map.name, pos);
+            });
+        budget_.allocate(appended * (sizeof(char) + sizeof(TextPosition)));
+        HIKARI_WITH_STATISTICS(budget_, stats) stats->expanded_bytes += appended;
+    }
+
+    void Preprocessor::append_text_to_map(TextPositionMap& map, const std::string_view view)
     {
-        if (map.content.size() + view.size() > max_macro_length_)
-            throw ParseError(fmt::format("{} expands exceeding the character limit of {}, {}", //
-                map.name.empty() ? "Preprocessed text" : fmt::format("Macro '{}'", map.name), max_macro_length_,
-                original_pos_[offset_of(view)].to_string()));
+        account_expansion(map, view.size(), view);
         map.content += view;
         const auto offset = offset_of(view);
         for (const auto [i] : clu::indices(view.size()))
             map.positions.push_back(original_pos_[offset + i]);
     }
 
-    void Preprocessor::append_macro_to_map(TextPositionMap& map, const std::string_view macro) const
+    void Preprocessor::append_macro_to_map(TextPositionMap& map, const std::string_view macro)
     {
-        if (const auto iter = res_.macros.find(std::string(macro)); iter == res_.macros.end())
+        if (const auto iter = res_->macros.find(macro); iter == res_->macros.end() || !iter->second)
             throw ParseError(fmt::format("Referenced macro '{}' is not yet defined, {}", //
                 macro, original_pos_[offset_of(macro)].to_string()));
         else
         {
             auto& macro_map = *iter->second;
             const std::string_view view = macro_map.content;
-            if (map.content.size() + view.size() > max_macro_length_)
-                throw ParseError(fmt::format("{} expands exceeding the character limit of {}, {}", //
-                    map.name.empty() ? "Preprocessed text" : fmt::format("Macro '{}'", map.name), max_macro_length_,
-                    original_pos_[offset_of(macro)].to_string()));
+            account_expansion(map, view.size(), macro);
+            HIKARI_WITH_STATISTICS(budget_, stats) stats->macro_expansions++;
 
             map.content += view;
             for (const auto [i] : clu::indices(view.size()))
@@ -116,8 +144,13 @@ namespace hkr
         validate_macro_name(macro_name);
         def_view.remove_prefix(idx + 1);
 
-        auto& map =
-            res_.maps.emplace_back(TextPositionMap{.name = std::string(macro_name), .definition_position = def_pos});
+        // Shadowed macros keep their maps, as the positions of earlier expansions point into them
+        auto& map = n_maps_ < res_->maps.size() ? res_->maps[n_maps_] : res_->maps.emplace_back();
+        n_maps_++;
+        map.name = macro_name;
+        map.content.clear();
+        map.definition_position = def_pos;
+        map.positions.clear();
         while (!def_view.empty())
         {
             idx = def_view.find('*');
@@ -131,7 +164,7 @@ namespace hkr
             append_macro_to_map(map, parse_consume_macro_ref(def_view));
         }
 
-        res_.macros[map.name] = &map;
+        res_->macros[map.name] = &map;
     }
 
     std::string_view Preprocessor::parse_consume_macro_ref(std::string_view& view) const
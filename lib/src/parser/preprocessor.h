@@ -2,15 +2,29 @@
 
 #include <unordered_map>
 #include <deque>
+#include <functional>
+#include <string_view>
 
 #include "parser_types.h"
+#include "../budget.h"
 
 namespace hkr
 {
     struct PreprocessedText
     {
+        // Looks up the macros by views of their names without copying them
+        struct NameHash
+        {
+            using is_transparent = void;
+            std::size_t operator()(const std::string_view name) const noexcept
+            {
+                return std::hash<std::string_view>{}(name);
+            }
+        };
+
         TextPositionMap text; // Main preprocessed text
-        std::unordered_map<std::string, TextPositionMap*> macros; // Active macros
+        // Active macros, the names left over from earlier calls map to null
+        std::unordered_map<std::string, TextPositionMap*, NameHash, std::equal_to<>> macros;
         std::deque<TextPositionMap> maps; // All macro information (including shadowed macros)
     };
 
@@ -20,21 +34,27 @@ namespace hkr
     class Preprocessor final
     {
     public:
-        explicit Preprocessor(std::string text, std::size_t max_macro_length = 65535);
+        explicit Preprocessor(ResourceBudget& budget): budget_(budget) {}
+
+        PreprocessedText process(std::string_view text);
 
-        PreprocessedText process();
+        // Processes the text into a result of an earlier call, the buffers of both the preprocessor
+        // and the result keep their capacity
+        void process(std::string_view text, PreprocessedText& res);
 
     private:
         std::string text_;
-        std::size_t max_macro_length_;
+        ResourceBudget& budget_;
         std::vector<TextPosition> original_pos_;
-        PreprocessedText res_;
+        PreprocessedText* res_ = nullptr;
+        std::size_t n_maps_ = 0; // Number of macro maps in use, the rest are left over from earlier calls
 
         std::size_t offset_of(std::string_view view) const noexcept;
 
-        void remove_whitespaces();
-        void append_text_to_map(TextPositionMap& map, std::string_view view) const;
-        void append_macro_to_map(TextPositionMap& map, std::string_view macro) const;
+        void remove_whitespaces(std::string_view text);
+        void account_expansion(const TextPositionMap& map, std::size_t appended, std::string_view view);
+        void append_text_to_map(TextPositionMap& map, std::string_view view);
+        void append_macro_to_map(TextPositionMap& map, std::string_view macro);
         void parse_consume_macro_def(std::string_view& view);
         std::string_view parse_consume_macro_ref(std::string_view& view) const;
         void validate_macro_name(std::string_view name) const;
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <fmt/format.h>
+
+#include "hikari/api.h"
+#include "hikari/unfold.h"
+#include "png_writer.h"
+#include "../budget.h"
+#include "../music_access.h"
+#include "../tracing.h"
+
+namespace hkr::roll
+{
+    namespace
+    {
+        // Lengths are in pixels
+        constexpr double whole_note_width = 64;
+        constexpr std::uint32_t row_height = 4; // Every pitch takes a row, the notes leave the last line blank
+        constexpr std::uint32_t note_height = 3;
+        constexpr int min_rows = 25;
+        constexpr int padding_rows = 2; // Above the highest note and below the lowest one
+
+        constexpr std::uint8_t background = 0;
+        constexpr std::uint8_t black_key_background = 1;
+        constexpr std::uint8_t bar_line = 2;
+        constexpr std::uint8_t first_voice_color = 3;
+        constexpr std::size_t max_voice_colors_per_staff = 4;
+        constexpr png::Color palette[]{
+            {255, 255, 255}, {238, 238, 242}, {170, 170, 170}, // Background, black key rows, bar lines
+            {31, 119, 180}, {44, 160, 44}, {148, 103, 189}, {23, 190, 207}, // Voices of the first staff
+            {255, 127, 14}, {214, 39, 40}, {140, 86, 75}, {227, 119, 194} // Voices of the second staff
+        };
+        constexpr std::size_t n_voice_colors = std::size(palette) - first_voice_color;
+
+        constexpr int values[]{0, 2, 4, 5, 7, 9, 11}; // C, D, E, F, G, A, B
+
+        // Unlike Note::pitch_id, the accidental is counted, and the pitch may be out of the MIDI range
+        int pitch_of(const Note note) noexcept
+        {
+            return values[static_cast<int>(note.base)] + (note.octave + 1) * 12 + note.accidental;
+        }
+
+        bool is_black_key(const int pitch) noexcept
+        {
+            constexpr bool black[]{false, true, false, true, false, false, true, false, true, false, true, false};
+            return black[(pitch % 12 + 12) % 12];
+        }
+
+        std::uint32_t to_pixels(const double x) noexcept { return static_cast<std::uint32_t>(std::lround(x)); }
+
+        struct RollNote
+        {
+            std::uint32_t begin = 0;
+            std::uint32_t end = 0;
+            int pitch = 0;
+            std::uint8_t color = 0;
+        };
+
+        struct PianoRoll
+        {
+            std::vector<RollNote> notes;
+            std::vector<std::uint32_t> bar_lines{0};
+            std::uint32_t width = 1;
+            int lowest = std::numeric_limits<int>::max();
+            int highest = std::numeric_limits<int>::min();
+        };
+
+        // Flattens the music into a list of notes in the order they are played, with the repeats unfolded.
+        // The horizontal positions follow the notated durations, tempo changes are not taken into account.
+        // The music is either parsed or read in place from an archive.
+        template <typename M>
+        class Flattener
+        {
+        public:
+            Flattener(const M& music, ResourceBudget& budget): music_(music), budget_(budget) {}
+
+            PianoRoll flatten()
+            {
+                StageScope scope(HIKARI_STATISTICS_OF(budget_), Stage::unroll);
+                Time time;
+                double x = 0;
+                for (std::size_t s = 0; s < music_.size(); s++)
+                {
+                    HIKARI_TRACE_ZONE("flatten section", s);
+                    const auto& section = music_[s];
+                    const auto& measures = measures_of(section);
+                    const auto& staves = staves_of(section);
+                    if (last_chords_.size() < staves.size())
+                        last_chords_.resize(staves.size());
+                    for (const std::size_t measure : UnfoldedMeasures(repeats_of(section, repeats_), measures.size()))
+                    {
+                        const auto& in_measure = measures[measure];
+                        const auto& attrs = in_measure.attributes;
+                        if (attrs.time)
+                            time = *attrs.time;
+                        const Time partial = attrs.partial ? *attrs.partial : time;
+                        const double beat_width = whole_note_width / partial.denominator;
+                        const auto [begin, end] = section.beat_index_range_of_measure(measure);
+                        for (std::size_t i = 0; i < staves.size(); i++)
+                        {
+                            budget_.add(Limit::measures);
+                            const auto& staff = staves[i];
+                            for (std::size_t j = begin; j < end; j++)
+                                add_beat(i, staff[j], chords_of(section), //
+                                    x + static_cast<double>(j - begin) * beat_width, beat_width);
+                        }
+                        x += partial.numerator * beat_width;
+                        // Checked as the measures are added, so that the pixel positions never overflow
+                        if (x >= png::max_size)
+                            throw std::length_error(
+                                fmt::format("The piano roll is wider than the PNG limit of {} pixels", png::max_size));
+                        res_.bar_lines.push_back(to_pixels(x));
+                    }
+                }
+                res_.width = to_pixels(x) + 1;
+                return std::move(res_);
+            }
+
+        private:
+            // Range of the notes of the last chord of a voice, which a sustained chord extends
+            struct LastChord
+            {
+                std::size_t begin = 0;
+                std::size_t end = 0;
+            };
+
+            const M& music_;
+            ResourceBudget& budget_;
+            PianoRoll res_;
+            std::vector<std::vector<LastChord>> last_chords_; // Indexed by staff and voice
+            std::vector<Repeat> repeats_; // Those of the current section, if read from an archive
+
+            template <typename B, typename P>
+            void add_beat(const std::size_t staff, const B& beat, const P& chords, const double x, const double width)
+            {
+                budget_.check(Limit::voices, beat.size());
+                auto& last_chords = last_chords_[staff];
+                if (last_chords.size() < beat.size())
+                    last_chords.resize(beat.size());
+                for (std::size_t i = beat.size(); i < last_chords.size(); i++) // Voices absent in this beat
+                    last_chords[i] = {};
+                for (std::size_t i = 0; i < beat.size(); i++)
+                {
+                    const auto& voice = beat[i];
+                    budget_.check(Limit::subdivision, voice.size());
+                    const double chord_width = width / static_cast<double>(voice.size());
+                    const auto color = static_cast<std::uint8_t>(first_voice_color +
+                        (staff * max_voice_colors_per_staff + std::min(i, max_voice_colors_per_staff - 1)) %
+                            n_voice_colors);
+                    LastChord& last = last_chords[i];
+                    for (std::size_t j = 0; j < voice.size(); j++)
+                    {
+                        const auto& chord = voice[j];
+                        const std::uint32_t begin = to_pixels(x + static_cast<double>(j) * chord_width);
+                        const std::uint32_t end = to_pixels(x + static_cast<double>(j + 1) * chord_width);
+                        if (is_sustained(chord))
+                        {
+                            for (std::size_t k = last.begin; k < last.end; k++)
+                                res_.notes[k].end = end;
+                            continue;
+                        }
+                        const auto notes = chords[notes_of(chord)];
+                        budget_.add(Limit::notes, notes.size());
+                        budget_.allocate(notes.size() * sizeof(RollNote));
+                        last.begin = res_.notes.size();
+                        for (const Note note : notes)
+                        {
+                            const int pitch = pitch_of(note);
+                            res_.lowest = std::min(res_.lowest, pitch);
+                            res_.highest = std::max(res_.highest, pitch);
+                            res_.notes.push_back({.begin = begin, .end = end, .pitch = pitch, .color = color});
+                        }
+                        last.end = res_.notes.size();
+                    }
+                }
+            }
+        };
+
+        std::size_t write_to_stream(std::ostream& stream, const PianoRoll& roll, ResourceBudget& budget)
+        {
+            int lowest = roll.lowest - padding_rows, highest = roll.highest + padding_rows;
+            if (roll.notes.empty())
+            {
+                lowest = 60 - min_rows / 2;
+                highest = lowest + min_rows - 1;
+            }
+            else if (const int missing = min_rows - (highest - lowest + 1); missing > 0)
+            {
+                lowest -= missing / 2;
+                highest += missing - missing / 2;
+            }
+
+            // Every row of pixels starts with the filter type byte, which is 0 for no filtering
+            const std::size_t stride = roll.width + 1;
+            const auto n_rows = static_cast<std::int64_t>(highest) - lowest + 1;
+            if (n_rows * row_height > png::max_size)
+                throw std::length_error(
+                    fmt::format("The piano roll is taller than the PNG limit of {} pixels", png::max_size));
+            const auto height = static_cast<std::uint32_t>(n_rows) * row_height;
+            budget.allocate(stride * (height + 2));
+            std::vector<std::uint8_t> templates(2 * stride);
+            for (std::size_t i = 0; i < 2; i++)
+            {
+                const auto row = std::span(templates).subspan(i * stride, stride);
+                std::ranges::fill(row.subspan(1), i == 0 ? background : black_key_background);
+                for (const std::uint32_t x : roll.bar_lines)
+                    row[x + 1] = bar_line;
+            }
+            std::vector<std::uint8_t> pixels(stride * height);
+            for (int pitch = highest; pitch >= lowest; pitch--)
+            {
+                const std::uint8_t* row = templates.data() + (is_black_key(pitch) ? stride : 0);
+                std::uint8_t* ptr = pixels.data() + static_cast<std::size_t>(highest - pitch) * row_height * stride;
+                for (std::uint32_t i = 0; i < row_height; i++, ptr += stride)
+                    std::copy_n(row, stride, ptr);
+            }
+
+            // The last column of every note is left blank to separate the repeated notes
+            for (const RollNote& note : roll.notes)
+            {
+                const std::size_t length = std::max(note.end - note.begin, 2u) - 1;
+                std::uint8_t* ptr =
+                    pixels.data() + static_cast<std::size_t>(highest - note.pitch) * row_height * stride + 1 + note.begin;
+                for (std::uint32_t i = 0; i < note_height; i++, ptr += stride)
+                    std::fill_n(ptr, length, note.color);
+            }
+
+            HIKARI_TRACE_ZONE("encode png");
+            return png::write_indexed(stream, roll.width, height, palette, pixels);
+        }
+    } // namespace
+} // namespace hkr::roll
+
+namespace hkr
+{
+    namespace
+    {
+        template <typename M>
+        void export_to_piano_roll_impl(std::ostream& stream, const M& music, const ExportOptions& options)
+        {
+            HIKARI_TRACE_ZONE("export_to_piano_roll");
+            ResourceBudget budget(options);
+            const auto roll = roll::Flattener(music, budget).flatten();
+            HIKARI_TRACE_ZONE("rasterize");
+            StageScope scope(HIKARI_STATISTICS_OF(budget), Stage::format);
+            [[maybe_unused]] const auto bytes = roll::write_to_stream(stream, roll, budget);
+            HIKARI_WITH_STATISTICS(budget, stats) stats->output_bytes += bytes;
+        }
+    } // namespace
+
+    void export_to_piano_roll(std::ostream& stream, const Music& music, const ExportOptions& options)
+    {
+        export_to_piano_roll_impl(stream, music, options);
+    }
+
+    void export_to_piano_roll(std::ostream& stream, const archive::MusicView& music, const ExportOptions& options)
+    {
+        export_to_piano_roll_impl(stream, music, options);
+    }
+} // namespace hkr
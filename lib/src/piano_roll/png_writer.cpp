@@ -0,0 +1,191 @@
+#include "png_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string_view>
+#include <fmt/format.h>
+
+namespace hkr::png
+{
+    namespace
+    {
+        // CRC-32 of the chunks, computed 4 bytes at a time with the slicing tables
+        constexpr auto crc_tables = []
+        {
+            std::array<std::array<std::uint32_t, 256>, 4> tables{};
+            for (std::uint32_t i = 0; i < 256; i++)
+            {
+                std::uint32_t value = i;
+                for (int j = 0; j < 8; j++)
+                    value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+                tables[0][i] = value;
+            }
+            for (std::size_t i = 0; i < 256; i++)
+                for (std::size_t j = 1; j < 4; j++)
+                    tables[j][i] = (tables[j - 1][i] >> 8) ^ tables[0][tables[j - 1][i] & 0xff];
+            return tables;
+        }();
+
+        std::uint32_t update_crc(std::uint32_t crc, const std::span<const std::uint8_t> bytes) noexcept
+        {
+            const std::uint8_t* ptr = bytes.data();
+            std::size_t size = bytes.size();
+            for (; size >= 4; ptr += 4, size -= 4)
+            {
+                crc ^= static_cast<std::uint32_t>(ptr[0]) | static_cast<std::uint32_t>(ptr[1]) << 8 |
+                    static_cast<std::uint32_t>(ptr[2]) << 16 | static_cast<std::uint32_t>(ptr[3]) << 24;
+                crc = crc_tables[3][crc & 0xff] ^ crc_tables[2][(crc >> 8) & 0xff] ^
+                    crc_tables[1][(crc >> 16) & 0xff] ^ crc_tables[0][crc >> 24];
+            }
+            for (; size > 0; ptr++, size--)
+                crc = crc_tables[0][(crc ^ *ptr) & 0xff] ^ (crc >> 8);
+            return crc;
+        }
+
+        // Adler-32 of the zlib stream, the sums are reduced once per 5552 bytes, the most that cannot overflow
+        class Adler32
+        {
+        public:
+            void update(std::span<const std::uint8_t> bytes) noexcept
+            {
+                constexpr std::uint32_t modulus = 65521;
+                while (!bytes.empty())
+                {
+                    const std::size_t size = std::min<std::size_t>(bytes.size(), 5552);
+                    for (const std::uint8_t byte : bytes.first(size))
+                    {
+                        a_ += byte;
+                        b_ += a_;
+                    }
+                    a_ %= modulus;
+                    b_ %= modulus;
+                    bytes = bytes.subspan(size);
+                }
+            }
+
+            std::uint32_t value() const noexcept { return b_ << 16 | a_; }
+
+        private:
+            std::uint32_t a_ = 1;
+            std::uint32_t b_ = 0;
+        };
+
+        void store_be(std::uint8_t* ptr, const std::uint32_t value) noexcept
+        {
+            ptr[0] = static_cast<std::uint8_t>(value >> 24);
+            ptr[1] = static_cast<std::uint8_t>(value >> 16);
+            ptr[2] = static_cast<std::uint8_t>(value >> 8);
+            ptr[3] = static_cast<std::uint8_t>(value);
+        }
+
+        // Writes a chunk whose data is given piece by piece, the length must be known beforehand
+        class ChunkWriter
+        {
+        public:
+            ChunkWriter(std::ostream& stream, const std::string_view type, const std::uint32_t length):
+                stream_(stream)
+            {
+                std::uint8_t header[8];
+                store_be(header, length);
+                std::ranges::copy(type, header + 4);
+                write_raw(header);
+                crc_ = update_crc(crc_, std::span(header).subspan(4));
+            }
+
+            void write(const std::span<const std::uint8_t> bytes)
+            {
+                write_raw(bytes);
+                crc_ = update_crc(crc_, bytes);
+            }
+
+            std::size_t finish()
+            {
+                std::uint8_t crc[4];
+                store_be(crc, ~crc_);
+                write_raw(crc);
+                return written_;
+            }
+
+        private:
+            std::ostream& stream_;
+            std::uint32_t crc_ = 0xffffffffu;
+            std::size_t written_ = 0;
+
+            void write_raw(const std::span<const std::uint8_t> bytes)
+            {
+                stream_.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+                written_ += bytes.size();
+            }
+        };
+    } // namespace
+
+    std::size_t write_indexed(std::ostream& stream, const std::uint32_t width, const std::uint32_t height,
+        const std::span<const Color> palette, const std::span<const std::uint8_t> rows)
+    {
+        if (width > max_size || height > max_size)
+            throw std::length_error(fmt::format(
+                "The image of {}x{} pixels exceeds the PNG limit of {} pixels per side", width, height, max_size));
+        constexpr std::uint8_t signature[]{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        stream.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+        std::size_t written = sizeof(signature);
+
+        {
+            std::uint8_t header[13]{};
+            store_be(header, width);
+            store_be(header + 4, height);
+            header[8] = 8; // Bit depth
+            header[9] = 3; // Indexed colors, the compression, filter and interlace methods are all 0
+            ChunkWriter chunk(stream, "IHDR", sizeof(header));
+            chunk.write(header);
+            written += chunk.finish();
+        }
+        {
+            ChunkWriter chunk(stream, "PLTE", static_cast<std::uint32_t>(palette.size() * 3));
+            for (const Color color : palette)
+                chunk.write(std::array{color.red, color.green, color.blue});
+            written += chunk.finish();
+        }
+        {
+            // A zlib stream of stored deflate blocks, each of which holds at most 65535 bytes. The stream is
+            // split into IDAT chunks of whole blocks, to keep every chunk within the length limit.
+            constexpr std::size_t max_block = 65535;
+            constexpr std::size_t max_blocks_per_chunk = 16384; // About 1 GiB
+            const std::size_t n_blocks = std::max<std::size_t>((rows.size() + max_block - 1) / max_block, 1);
+            Adler32 adler;
+            for (std::size_t first = 0; first < n_blocks; first += max_blocks_per_chunk)
+            {
+                const std::size_t last = std::min(first + max_blocks_per_chunk, n_blocks);
+                const std::size_t data_size = std::min(last * max_block, rows.size()) - first * max_block;
+                const std::size_t length = // The zlib header, the block headers and data, and the checksum
+                    (first == 0 ? 2 : 0) + (last - first) * 5 + data_size + (last == n_blocks ? 4 : 0);
+                ChunkWriter chunk(stream, "IDAT", static_cast<std::uint32_t>(length));
+                if (first == 0)
+                    chunk.write(std::array<std::uint8_t, 2>{0x78, 0x01});
+                for (std::size_t i = first; i < last; i++)
+                {
+                    const auto block = rows.subspan(i * max_block, std::min(max_block, rows.size() - i * max_block));
+                    const auto block_length = static_cast<std::uint16_t>(block.size());
+                    const auto complement = static_cast<std::uint16_t>(~block_length);
+                    chunk.write(std::array{static_cast<std::uint8_t>(i + 1 == n_blocks), //
+                        static_cast<std::uint8_t>(block_length), static_cast<std::uint8_t>(block_length >> 8),
+                        static_cast<std::uint8_t>(complement), static_cast<std::uint8_t>(complement >> 8)});
+                    chunk.write(block);
+                    adler.update(block);
+                }
+                if (last == n_blocks)
+                {
+                    std::uint8_t checksum[4];
+                    store_be(checksum, adler.value());
+                    chunk.write(checksum);
+                }
+                written += chunk.finish();
+            }
+        }
+        {
+            ChunkWriter chunk(stream, "IEND", 0);
+            written += chunk.finish();
+        }
+        return written;
+    }
+} // namespace hkr::png
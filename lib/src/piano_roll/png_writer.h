@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <span>
+
+namespace hkr::png
+{
+    struct Color
+    {
+        std::uint8_t red = 0;
+        std::uint8_t green = 0;
+        std::uint8_t blue = 0;
+    };
+
+    inline constexpr std::uint32_t max_size = 0x7fffffff; // Largest width, height or chunk length of a PNG file
+
+    // Write an image with 8-bit palette indices as a PNG file. The scanlines are stored without
+    // compression, so no deflate implementation is needed and encoding is just a copy with checksums.
+    // Every row in `rows` is a filter type byte (0 for none) followed by `width` palette indices.
+    // Returns the number of bytes written, throws std::length_error if the image is too large for a PNG file
+    std::size_t write_indexed(std::ostream& stream, std::uint32_t width, std::uint32_t height,
+        std::span<const Color> palette, std::span<const std::uint8_t> rows);
+}
@@ -0,0 +1,69 @@
+#include "statistics.h"
+
+#include <algorithm>
+
+namespace hkr
+{
+    std::string_view to_string(const Stage stage) noexcept
+    {
+        switch (stage)
+        {
+            case Stage::preprocess: return "preprocess";
+            case Stage::parse: return "parse";
+            case Stage::measurify: return "measurify";
+            case Stage::unroll: return "unroll";
+            case Stage::place_clefs: return "place_clefs";
+            case Stage::partition_durations: return "partition_durations";
+            case Stage::partition_tuplets: return "partition_tuplets";
+            case Stage::format: return "format";
+            default: return "unknown";
+        }
+    }
+
+    Statistics& Statistics::operator+=(const Statistics& other) noexcept
+    {
+        for (std::size_t i = 0; i < stage_count; i++)
+        {
+            stage_nanoseconds[i] += other.stage_nanoseconds[i];
+            auto& allocs = stage_allocations[i];
+            const auto& other_allocs = other.stage_allocations[i];
+            allocs.count += other_allocs.count;
+            allocs.bytes += other_allocs.bytes;
+            allocs.peak_bytes = std::max(allocs.peak_bytes, other_allocs.peak_bytes);
+        }
+        macro_expansions += other.macro_expansions;
+        expanded_bytes += other.expanded_bytes;
+        chords += other.chords;
+        notes += other.notes;
+        distinct_chords += other.distinct_chords;
+        break_at_calls += other.break_at_calls;
+        tuplet_iterations += other.tuplet_iterations;
+        tuplet_ranges += other.tuplet_ranges;
+        clef_changes += other.clef_changes;
+        output_bytes += other.output_bytes;
+        return *this;
+    }
+
+    AllocationCounter*& current_allocation_counter() noexcept
+    {
+        thread_local AllocationCounter* counter = nullptr;
+        return counter;
+    }
+
+    void record_allocation(const std::size_t bytes) noexcept
+    {
+        if (AllocationCounter* counter = current_allocation_counter())
+        {
+            counter->count++;
+            counter->bytes += bytes;
+            counter->live_bytes += static_cast<std::int64_t>(bytes);
+            counter->peak_bytes = std::max(counter->peak_bytes, counter->live_bytes);
+        }
+    }
+
+    void record_deallocation(const std::size_t bytes) noexcept
+    {
+        if (AllocationCounter* counter = current_allocation_counter())
+            counter->live_bytes -= static_cast<std::int64_t>(bytes);
+    }
+} // namespace hkr
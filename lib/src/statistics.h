@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "hikari/statistics.h"
+
+// Statistics are collected only when the caller asks for them. When the library is built without
+// HIKARI_ENABLE_STATISTICS, HIKARI_WITH_STATISTICS guards a discarded statement and
+// HIKARI_STATISTICS_OF is a null constant, so the statistics code compiles to nothing.
+#ifdef HIKARI_ENABLE_STATISTICS
+#   define HIKARI_STATISTICS_OF(budget) ((budget).statistics())
+#   define HIKARI_WITH_STATISTICS(budget, var) if (::hkr::Statistics* var = (budget).statistics())
+#else
+#   define HIKARI_STATISTICS_OF(budget) static_cast<::hkr::Statistics*>(nullptr)
+#   define HIKARI_WITH_STATISTICS(budget, var) if constexpr (::hkr::Statistics* var = nullptr; false)
+#endif
+
+namespace hkr
+{
+    // Allocations reported on the current thread since the innermost stage scope began
+    struct AllocationCounter
+    {
+        AllocationCounter* parent = nullptr;
+        std::uint64_t count = 0;
+        std::uint64_t bytes = 0;
+        std::int64_t live_bytes = 0;
+        std::int64_t peak_bytes = 0;
+    };
+
+    AllocationCounter*& current_allocation_counter() noexcept;
+
+    // Adds the wall time of its lifetime and the allocations made on this thread meanwhile
+    // to a stage, if statistics are requested
+    class StageScope
+    {
+    public:
+        StageScope(Statistics* stats, const Stage stage) noexcept: stats_(stats), stage_(stage)
+        {
+            if (!stats_)
+                return;
+            auto& current = current_allocation_counter();
+            counter_.parent = current;
+            current = &counter_;
+            begin_ = Clock::now();
+        }
+
+        StageScope(const StageScope&) = delete;
+        StageScope& operator=(const StageScope&) = delete;
+
+        ~StageScope() noexcept
+        {
+            if (!stats_)
+                return;
+            stats_->nanoseconds(stage_) += static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin_).count());
+            current_allocation_counter() = counter_.parent;
+            auto& allocs = stats_->allocations(stage_);
+            allocs.count += counter_.count;
+            allocs.bytes += counter_.bytes;
+            allocs.peak_bytes = std::max(allocs.peak_bytes, static_cast<std::uint64_t>(counter_.peak_bytes));
+            if (AllocationCounter* parent = counter_.parent)
+            {
+                parent->count += counter_.count;
+                parent->bytes += counter_.bytes;
+                parent->peak_bytes = std::max(parent->peak_bytes, parent->live_bytes + counter_.peak_bytes);
+                parent->live_bytes += counter_.live_bytes;
+            }
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Statistics* stats_;
+        Stage stage_;
+        Clock::time_point begin_{};
+        AllocationCounter counter_;
+    };
+} // namespace hkr
@@ -0,0 +1,1164 @@
+#include "engraver.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+#include <fmt/format.h>
+
+#include "hikari/api.h"
+#include "../tracing.h"
+
+namespace hkr
+{
+    namespace
+    {
+        template <typename M>
+        void export_to_svg_impl(std::ostream& stream, const M& music, const ExportOptions& options)
+        {
+            HIKARI_TRACE_ZONE("export_to_svg");
+            ResourceBudget budget(options);
+            const auto ly_music = ly::convert_to_ly(music, budget);
+            HIKARI_TRACE_ZONE("engrave");
+            StageScope scope(HIKARI_STATISTICS_OF(budget), Stage::format);
+            [[maybe_unused]] const auto bytes = svg::write_to_stream(stream, ly_music);
+            HIKARI_WITH_STATISTICS(budget, stats) stats->output_bytes += bytes;
+        }
+    } // namespace
+
+    void export_to_svg(std::ostream& stream, const Music& music, const ExportOptions& options)
+    {
+        export_to_svg_impl(stream, music, options);
+    }
+
+    void export_to_svg(std::ostream& stream, const archive::MusicView& music, const ExportOptions& options)
+    {
+        export_to_svg_impl(stream, music, options);
+    }
+} // namespace hkr
+
+namespace hkr::svg
+{
+    namespace
+    {
+        using ly::Clef;
+        using ly::LyChord;
+        using ly::LyMeasure;
+        using ly::LyMusic;
+        using ly::LyVoice;
+        using ly::RepeatBraces;
+        using ly::TupletGroupPosition;
+        using Rational = clu::rational<int>;
+
+        // Lengths are in pixels, mostly in multiples of the distance between two staff lines
+        constexpr double sp = 8;
+        constexpr double page_width = 1000;
+        constexpr double margin = 3 * sp;
+        constexpr double staff_distance = 12 * sp; // Between the middle lines of adjacent staves of a system
+        constexpr double system_distance = 16 * sp; // Between the last staff of a system and the first of the next
+        constexpr double head_rx = 0.62 * sp;
+        constexpr double head_ry = 0.42 * sp;
+        constexpr double stem_x = 0.56 * sp; // From the center of a notehead to its stem
+        constexpr double stem_length = 3.5 * sp;
+        constexpr double min_beamed_stem_length = 2.5 * sp;
+        constexpr double beam_thickness = 0.5 * sp;
+        constexpr double beam_distance = 0.75 * sp;
+        constexpr double accidental_width = 1.1 * sp;
+        constexpr double clef_width = 3.4 * sp;
+        constexpr double clef_change_width = 2.6 * sp;
+        constexpr double key_accidental_width = 1.0 * sp;
+        constexpr double time_width = 2.8 * sp;
+        constexpr double repeat_bar_width = 1.6 * sp; // Extra space for the dots and the thick line of a repeat sign
+        constexpr double volta_height = 1.8 * sp;
+        constexpr double volta_distance = 3 * sp; // From the top line of the first staff to a volta bracket
+
+        // SMuFL fonts are preferred, the glyphs are placed with their origins on the staff positions
+        constexpr std::string_view style = ".m{font-family:Bravura,'Noto Music','Segoe UI Symbol',Symbola,serif}"
+                                           ".t{font-family:serif;font-weight:bold}"
+                                           ".n{font-family:serif;font-style:italic}";
+        constexpr std::string_view treble_glyph = "&#x1D11E;";
+        constexpr std::string_view bass_glyph = "&#x1D122;";
+        constexpr std::string_view accidental_glyphs[]{"&#x1D12B;", "&#x266D;", "&#x266E;", "&#x266F;", "&#x1D12A;"};
+
+        // Staff positions of the accidentals in key signatures for the treble clef, in half spaces above
+        // the middle line, the bass clef ones are a line lower
+        constexpr int sharp_positions[]{4, 1, 5, 2, -1, 3, 0};
+        constexpr int flat_positions[]{0, 3, -1, 2, -2, 1, -3};
+        constexpr NoteBase sharp_order[]{NoteBase::f, NoteBase::c, NoteBase::g, NoteBase::d, NoteBase::a,
+            NoteBase::e, NoteBase::b};
+
+        double to_double(const Rational value) noexcept
+        {
+            return static_cast<double>(value.numerator()) / static_cast<double>(value.denominator());
+        }
+
+        bool is_treble(const Clef clef) noexcept { return clef != Clef::bass && clef != Clef::bass_8va_bassa; }
+
+        int step_of(const Note note) noexcept { return note.octave * 7 + static_cast<int>(note.base); }
+
+        int middle_step(const Clef clef) noexcept
+        {
+            switch (clef)
+            {
+                case Clef::bass_8va_bassa: return 15; // D2
+                case Clef::bass: return 22; // D3
+                case Clef::treble_8va: return 41; // B5
+                default: return 34; // B4
+            }
+        }
+
+        int key_accidental(const int key, const NoteBase base) noexcept
+        {
+            for (int i = 0; i < std::min(key, 7); i++)
+                if (sharp_order[i] == base)
+                    return 1;
+            for (int i = 0; i < std::min(-key, 7); i++)
+                if (sharp_order[6 - i] == base)
+                    return -1;
+            return 0;
+        }
+
+        struct Duration
+        {
+            int log = 2; // 0 for whole notes, 1 for half notes, 2 for quarter notes, ...
+            int dots = 0;
+        };
+
+        // The durations written by the Lilypond writer, the others are drawn as quarter notes.
+        // Notes longer than a whole note are drawn as whole notes.
+        Duration to_duration(const Rational value) noexcept
+        {
+            const auto exponent = [](const int v) { return std::countr_zero(static_cast<unsigned>(v)); };
+            if (value <= 0 || !std::has_single_bit(static_cast<unsigned>(value.denominator())))
+                return {};
+            if (value.denominator() == 1)
+            {
+                const int n = value.numerator();
+                return {0, n == 3 || n == 6 ? 1 : n == 7 ? 2 : 0};
+            }
+            if (value.numerator() == 1)
+                return {exponent(value.denominator()), 0};
+            const auto rounded = (value + Rational(1, value.denominator())) / 2;
+            const auto multiple = rounded * value.denominator();
+            if (multiple.denominator() != 1 || !std::has_single_bit(static_cast<unsigned>(multiple.numerator())))
+                return {};
+            const int dots = static_cast<int>(std::bit_width(static_cast<unsigned>(multiple.numerator()))) - 1;
+            return {rounded.denominator() == 1 ? 0 : exponent(rounded.denominator()), dots};
+        }
+
+        struct Head
+        {
+            int pos = 0; // Half spaces above the middle line
+            int accidental = 0;
+            bool shows_accidental = false;
+            bool displaced = false; // On the other side of the stem, for seconds in a chord
+            int accidental_column = 0; // Accidentals of close notes are moved to the left
+        };
+
+        // A chord or a rest as it is drawn
+        struct Glyph
+        {
+            const LyChord* chord = nullptr;
+            std::size_t column = 0;
+            Duration duration;
+            std::size_t heads_begin = 0;
+            std::size_t heads_end = 0;
+            Clef clef_change = Clef::none; // A clef change in the middle of the measure drawn before this
+            bool stem_down = false;
+            bool beamed = false;
+            double stem_end = 0; // Only set for beamed chords before they are drawn
+
+            bool is_rest() const noexcept { return heads_begin == heads_end; }
+        };
+
+        struct BeamGroup
+        {
+            std::size_t voice = 0;
+            std::size_t begin = 0;
+            std::size_t end = 0;
+            double x = 0; // Start of the beam at the first stem
+            double y = 0;
+            double slope = 0;
+        };
+
+        struct StaffMeasure
+        {
+            Clef clef = Clef::treble; // The clef in effect at the start of the measure
+            bool clef_changed = false; // Whether the clef changes at the start of the measure
+            std::size_t n_non_empty_voices = 0;
+            std::vector<std::vector<Glyph>> voices; // Empty for the voices without any notes
+            std::vector<BeamGroup> beams;
+        };
+
+        struct MeasureLayout
+        {
+            std::vector<Rational> positions; // Distinct starts of the chords in whole notes
+            std::vector<double> pads; // Space needed before every column, for accidentals or clef changes
+            std::vector<double> offsets; // Positions of the columns from the start of the body
+            Rational length;
+            double body_width = 0;
+            double attributes_x = 0; // Start of the changed attributes in the middle of a system
+            double x = 0; // Start of the body
+            double scale = 1;
+            int key = 0;
+            int previous_key = 0;
+            bool key_changed = false;
+            std::optional<Time> time_change;
+        };
+
+        struct System
+        {
+            std::size_t begin = 0;
+            std::size_t end = 0;
+            double top = 0; // Middle line of the first staff
+            double right = 0;
+        };
+
+        struct PendingTie
+        {
+            std::vector<int> positions;
+            double x = 0;
+            std::size_t system = 0;
+            bool below = false;
+        };
+
+        class Engraver
+        {
+        public:
+            explicit Engraver(const LyMusic& music): music_(music) {}
+
+            std::size_t write(std::ostream& stream)
+            {
+                n_staves_ = music_.staves.size();
+                n_measures_ = n_staves_ == 0 ? 0 : music_.staves[0].size();
+                prepare_measures();
+                staff_measures_.resize(n_staves_ * n_measures_);
+                for (std::size_t i = 0; i < n_staves_; i++)
+                    prepare_staff(i);
+                layout_columns();
+                break_systems();
+                ties_.resize(n_staves_);
+                for (std::size_t i = 0; i < systems_.size(); i++)
+                    draw_system(i);
+                emit("</g></svg>");
+
+                double width = page_width, height = 2 * margin;
+                for (const auto& system : systems_)
+                    width = std::max(width, system.right + margin);
+                if (!systems_.empty())
+                    height = staff_middle(systems_.back(), n_staves_ - 1) + 6 * sp + margin;
+                fmt::memory_buffer header;
+                fmt::format_to(std::back_inserter(header),
+                    R"(<svg xmlns="http://www.w3.org/2000/svg" width="{0:.0f}" height="{1:.0f}" )"
+                    R"(viewBox="0 0 {0:.0f} {1:.0f}">)"
+                    "\n<style>{2}</style>\n"
+                    R"(<rect width="100%" height="100%" fill="#fff"/>)"
+                    "\n"
+                    R"(<g fill="#000" stroke="#000" stroke-width="0">)"
+                    "\n",
+                    std::ceil(width), std::ceil(height), style);
+                stream.write(header.data(), static_cast<std::streamsize>(header.size()));
+                stream.write(out_.data(), static_cast<std::streamsize>(out_.size()));
+                return header.size() + out_.size();
+            }
+
+        private:
+            const LyMusic& music_;
+            std::size_t n_staves_ = 0;
+            std::size_t n_measures_ = 0;
+            std::vector<MeasureLayout> measures_;
+            std::vector<StaffMeasure> staff_measures_; // Indexed by staff * n_measures_ + measure
+            std::vector<Head> heads_;
+            std::vector<System> systems_;
+            std::vector<std::vector<PendingTie>> ties_; // Indexed by staff and voice
+            fmt::memory_buffer out_;
+
+            template <typename... Ts>
+            void emit(fmt::format_string<Ts...> format, Ts&&... args)
+            {
+                fmt::format_to(std::back_inserter(out_), format, static_cast<Ts&&>(args)...);
+                out_.push_back('\n');
+            }
+
+            StaffMeasure& staff_measure(const std::size_t staff, const std::size_t measure) noexcept
+            {
+                return staff_measures_[staff * n_measures_ + measure];
+            }
+
+            // The repeats are the same in every staff
+            const RepeatBraces& repeat_of(const std::size_t measure) const noexcept
+            {
+                return music_.staves[0][measure].repeat;
+            }
+
+            std::span<Head> heads_of(const Glyph& glyph) noexcept
+            {
+                return std::span(heads_).subspan(glyph.heads_begin, glyph.heads_end - glyph.heads_begin);
+            }
+
+            // Preparation
+
+            void prepare_measures()
+            {
+                measures_.resize(n_measures_);
+                int key = 0;
+                for (std::size_t i = 0; i < n_measures_; i++)
+                {
+                    const LyMeasure& first = music_.staves[0][i];
+                    MeasureLayout& layout = measures_[i];
+                    const Time partial = first.current_partial;
+                    layout.length = Rational(partial.numerator, partial.denominator);
+                    for (const auto& staff : music_.staves)
+                        for (const LyVoice& voice : staff[i].voices)
+                            for (const LyChord& chord : voice)
+                                layout.positions.push_back(chord.start / partial.denominator);
+                    std::ranges::sort(layout.positions);
+                    const auto [end, _] = std::ranges::unique(layout.positions);
+                    layout.positions.erase(end, layout.positions.end());
+                    layout.pads.assign(layout.positions.size(), 0);
+
+                    layout.previous_key = key;
+                    if (first.attributes.key)
+                    {
+                        key = *first.attributes.key;
+                        layout.key_changed = true;
+                    }
+                    layout.key = key;
+                    if (first.attributes.time || i == 0)
+                        layout.time_change = first.current_time;
+                }
+            }
+
+            void prepare_staff(const std::size_t staff_index)
+            {
+                const auto& staff = music_.staves[staff_index];
+                Clef clef = Clef::treble;
+                std::vector<std::pair<std::size_t, std::size_t>> order; // Voice and chord indices
+                std::vector<std::pair<int, int>> accidentals; // Steps and the accidentals in effect
+                for (std::size_t i = 0; i < n_measures_; i++)
+                {
+                    const LyMeasure& measure = staff[i];
+                    StaffMeasure& sm = staff_measure(staff_index, i);
+                    MeasureLayout& layout = measures_[i];
+                    const int den = measure.current_partial.denominator;
+
+                    sm.voices.resize(measure.voices.size());
+                    order.clear();
+                    for (std::size_t j = 0; j < measure.voices.size(); j++)
+                    {
+                        const LyVoice& voice = measure.voices[j];
+                        if (std::ranges::any_of(voice, [](const LyChord& chord) { return !chord.is_rest_or_spacer(); }))
+                        {
+                            sm.n_non_empty_voices++;
+                            sm.voices[j].resize(voice.size());
+                        }
+                        for (std::size_t k = 0; k < voice.size(); k++)
+                            order.emplace_back(j, k);
+                    }
+                    // Clef changes apply to the simultaneous chords in the other voices as well
+                    std::ranges::stable_sort(order,
+                        [&](const auto& lhs, const auto& rhs)
+                        {
+                            const LyChord& l = measure.voices[lhs.first][lhs.second];
+                            const LyChord& r = measure.voices[rhs.first][rhs.second];
+                            if (l.start != r.start)
+                                return l.start < r.start;
+                            return l.clef_change != Clef::none && r.clef_change == Clef::none;
+                        });
+
+                    sm.clef = clef;
+                    accidentals.clear();
+                    for (const auto& [j, k] : order)
+                    {
+                        const LyVoice& voice = measure.voices[j];
+                        const LyChord& chord = voice[k];
+                        const bool changes_clef = chord.clef_change != Clef::none && chord.clef_change != clef;
+                        if (changes_clef)
+                        {
+                            clef = chord.clef_change;
+                            if (chord.start == 0)
+                            {
+                                sm.clef = clef;
+                                sm.clef_changed = true;
+                            }
+                        }
+                        if (sm.voices[j].empty())
+                            continue;
+
+                        Glyph& glyph = sm.voices[j][k];
+                        glyph.chord = &chord;
+                        glyph.column = static_cast<std::size_t>(
+                            std::ranges::lower_bound(layout.positions, chord.start / den) - layout.positions.begin());
+                        const Rational end =
+                            k + 1 < voice.size() ? voice[k + 1].start : Rational(measure.current_partial.numerator);
+                        glyph.duration = to_duration((end - chord.start) / den * chord.tuplet.ratio);
+                        if (changes_clef && chord.start != 0)
+                        {
+                            glyph.clef_change = clef;
+                            layout.pads[glyph.column] = std::max(layout.pads[glyph.column], clef_change_width);
+                        }
+                        if (chord.spacer)
+                            continue;
+
+                        const bool tied = k > 0 ? voice[k - 1].sustained : is_tied_from_last_measure(staff, i, j);
+                        glyph.heads_begin = heads_.size();
+                        for (const Note note : music_.chords[chord.notes])
+                        {
+                            const int step = step_of(note);
+                            const auto iter = std::ranges::find(accidentals, step, &std::pair<int, int>::first);
+                            const int current =
+                                iter != accidentals.end() ? iter->second : key_accidental(layout.key, note.base);
+                            heads_.push_back({.pos = step - middle_step(clef),
+                                .accidental = note.accidental,
+                                .shows_accidental = !tied && note.accidental != current});
+                            if (iter != accidentals.end())
+                                iter->second = note.accidental;
+                            else
+                                accidentals.emplace_back(step, note.accidental);
+                        }
+                        glyph.heads_end = heads_.size();
+                        std::ranges::sort(heads_of(glyph), {}, &Head::pos);
+                    }
+
+                    for (std::size_t j = 0; j < sm.voices.size(); j++)
+                        if (!sm.voices[j].empty())
+                            prepare_stems(sm, j, measure);
+                    for (auto& voice : sm.voices)
+                        for (const Glyph& glyph : voice)
+                            if (glyph.chord && !glyph.chord->spacer && !glyph.is_rest())
+                                place_heads(glyph, layout);
+                }
+            }
+
+            bool is_tied_from_last_measure(const ly::LyStaff& staff, const std::size_t measure, const std::size_t voice)
+            {
+                if (measure == 0)
+                    return false;
+                const auto& voices = staff[measure - 1].voices;
+                return voices.size() > voice && !voices[voice].empty() && voices[voice].back().sustained;
+            }
+
+            int stem_direction_weight(const Glyph& glyph) noexcept
+            {
+                const auto heads = heads_of(glyph);
+                return heads.front().pos + heads.back().pos;
+            }
+
+            void prepare_stems(StaffMeasure& sm, const std::size_t voice_index, const LyMeasure& measure)
+            {
+                auto& glyphs = sm.voices[voice_index];
+                const bool forced = sm.n_non_empty_voices > 1;
+                const bool forced_down = voice_index % 2 == 1;
+
+                // Beams are broken at every beat, or at every dotted beat in compound times, and
+                // the chords in a tuplet are beamed together
+                const Time time = measure.current_time;
+                const bool compound = time.denominator >= 8 && time.numerator % 3 == 0;
+                const Rational unit = compound ? Rational(3, time.denominator) : Rational(1, 4);
+                const auto beat_of = [&](const LyChord& chord)
+                {
+                    const auto beats = chord.start / measure.current_partial.denominator / unit;
+                    return beats.numerator() / beats.denominator();
+                };
+                const auto beamable = [](const Glyph& glyph)
+                { return glyph.chord && !glyph.chord->spacer && !glyph.is_rest() && glyph.duration.log >= 3; };
+
+                std::size_t begin = 0;
+                int group_beat = 0;
+                bool in_tuplet = false;
+                const auto close_group = [&](const std::size_t end)
+                {
+                    if (end - begin >= 2)
+                        sm.beams.push_back({.voice = voice_index, .begin = begin, .end = end});
+                };
+                for (std::size_t i = 0; i < glyphs.size(); i++)
+                {
+                    const LyChord& chord = *glyphs[i].chord;
+                    const bool starts_tuplet = chord.tuplet.pos == TupletGroupPosition::head && !in_tuplet;
+                    if (starts_tuplet)
+                        in_tuplet = true;
+                    const int beat = in_tuplet && !starts_tuplet ? group_beat : beat_of(chord);
+                    const bool continues = i > 0 && beamable(glyphs[i - 1]) && beamable(glyphs[i]) &&
+                        beat == group_beat && !starts_tuplet;
+                    if (!continues)
+                    {
+                        close_group(i);
+                        begin = i;
+                        group_beat = beat;
+                    }
+                    if (chord.tuplet.pos == TupletGroupPosition::last)
+                    {
+                        in_tuplet = false;
+                        close_group(i + 1);
+                        begin = i + 1;
+                        group_beat = -1;
+                    }
+                }
+                close_group(glyphs.size());
+
+                for (Glyph& glyph : glyphs)
+                    if (glyph.chord && !glyph.is_rest())
+                        glyph.stem_down = forced ? forced_down : stem_direction_weight(glyph) >= 0;
+                for (const BeamGroup& beam : sm.beams)
+                {
+                    if (beam.voice != voice_index)
+                        continue;
+                    int weight = 0;
+                    for (std::size_t i = beam.begin; i < beam.end; i++)
+                        weight += stem_direction_weight(glyphs[i]);
+                    for (std::size_t i = beam.begin; i < beam.end; i++)
+                    {
+                        glyphs[i].beamed = true;
+                        if (!forced)
+                            glyphs[i].stem_down = weight >= 0;
+                    }
+                }
+            }
+
+            void place_heads(const Glyph& glyph, MeasureLayout& layout)
+            {
+                const auto heads = heads_of(glyph);
+                // Seconds are put on both sides of the stem
+                if (glyph.stem_down)
+                {
+                    for (std::size_t i = heads.size() - 1; i-- > 0;)
+                        heads[i].displaced = heads[i + 1].pos - heads[i].pos <= 1 && !heads[i + 1].displaced;
+                }
+                else
+                {
+                    for (std::size_t i = 1; i < heads.size(); i++)
+                        heads[i].displaced = heads[i].pos - heads[i - 1].pos <= 1 && !heads[i - 1].displaced;
+                }
+
+                // Accidentals from top to bottom, moved further left when they are too close
+                int n_columns = 0;
+                for (std::size_t i = heads.size(); i-- > 0;)
+                {
+                    if (!heads[i].shows_accidental)
+                        continue;
+                    int column = 0;
+                    for (std::size_t j = i + 1; j < heads.size(); j++)
+                        if (heads[j].shows_accidental && heads[j].accidental_column == column &&
+                            heads[j].pos - heads[i].pos < 6)
+                            column++;
+                    heads[i].accidental_column = column;
+                    n_columns = std::max(n_columns, column + 1);
+                }
+                const bool displaced_left =
+                    glyph.stem_down && std::ranges::any_of(heads, [](const Head& head) { return head.displaced; });
+                const double pad = n_columns * accidental_width + (displaced_left ? 2 * stem_x : 0);
+                double& column_pad = layout.pads[glyph.column];
+                column_pad = std::max(column_pad, pad + (glyph.clef_change != Clef::none ? clef_change_width : 0));
+            }
+
+            // Layout
+
+            static double spacing(const Rational duration) noexcept
+            {
+                return sp * (1.6 + 3.2 * std::sqrt(std::max(to_double(duration), 0.0) * 4));
+            }
+
+            void layout_columns()
+            {
+                for (std::size_t j = 0; j < n_measures_; j++)
+                {
+                    MeasureLayout& layout = measures_[j];
+                    const RepeatBraces& repeat = repeat_of(j);
+                    double x = 1.2 * sp + (repeat.volta_times != 0 ? repeat_bar_width : 0);
+                    layout.offsets.resize(layout.positions.size());
+                    for (std::size_t i = 0; i < layout.positions.size(); i++)
+                    {
+                        x += layout.pads[i];
+                        layout.offsets[i] = x;
+                        const Rational next = i + 1 < layout.positions.size() ? layout.positions[i + 1] : layout.length;
+                        x += spacing(next - layout.positions[i]);
+                    }
+                    if (layout.positions.empty())
+                        x += spacing(layout.length);
+                    layout.body_width = x + (repeat.ends_pass ? repeat_bar_width : 0);
+                }
+            }
+
+            static double key_width(const int n_accidentals) noexcept
+            {
+                return n_accidentals == 0 ? 0 : n_accidentals * key_accidental_width + 0.6 * sp;
+            }
+
+            double header_width(const std::size_t measure) const noexcept
+            {
+                const MeasureLayout& layout = measures_[measure];
+                return 0.8 * sp + clef_width + key_width(std::abs(layout.key)) + (layout.time_change ? time_width : 0);
+            }
+
+            double attributes_width(const std::size_t measure) const noexcept
+            {
+                const MeasureLayout& layout = measures_[measure];
+                double width = 0;
+                for (std::size_t i = 0; i < n_staves_; i++)
+                    if (staff_measures_[i * n_measures_ + measure].clef_changed)
+                    {
+                        width += clef_change_width;
+                        break;
+                    }
+                if (layout.key_changed)
+                    width += key_width(std::abs(layout.key == 0 ? layout.previous_key : layout.key));
+                if (layout.time_change)
+                    width += time_width;
+                return width == 0 ? 0 : width + 0.6 * sp;
+            }
+
+            void break_systems()
+            {
+                constexpr double right = page_width - margin;
+                double x = 0;
+                for (std::size_t i = 0; i < n_measures_; i++)
+                {
+                    const bool fits = !systems_.empty() && systems_.back().begin != i &&
+                        x + attributes_width(i) + measures_[i].body_width <= right;
+                    if (fits)
+                    {
+                        x += attributes_width(i) + measures_[i].body_width;
+                        systems_.back().end = i + 1;
+                        continue;
+                    }
+                    if (!systems_.empty() && systems_.back().begin == i) // The first measure of the score
+                    {
+                        x += measures_[i].body_width;
+                        systems_.back().end = i + 1;
+                        continue;
+                    }
+                    systems_.push_back({.begin = i, .end = i});
+                    x = margin + header_width(i);
+                    i--; // Add the measure into the new system
+                }
+
+                for (std::size_t i = 0; i < systems_.size(); i++)
+                {
+                    System& system = systems_[i];
+                    const double height = static_cast<double>(n_staves_ - 1) * staff_distance + system_distance;
+                    system.top = margin + 4 * sp + static_cast<double>(i) * height;
+                    double fixed = margin + header_width(system.begin), bodies = 0;
+                    for (std::size_t j = system.begin; j < system.end; j++)
+                    {
+                        fixed += j == system.begin ? 0 : attributes_width(j);
+                        bodies += measures_[j].body_width;
+                    }
+                    // Justify every line except the last one
+                    const double scale =
+                        i + 1 == systems_.size() || fixed + bodies >= right ? 1 : (right - fixed) / bodies;
+                    x = margin + header_width(system.begin);
+                    for (std::size_t j = system.begin; j < system.end; j++)
+                    {
+                        MeasureLayout& layout = measures_[j];
+                        layout.attributes_x = x;
+                        x += j == system.begin ? 0 : attributes_width(j);
+                        layout.x = x;
+                        layout.scale = scale;
+                        x += layout.body_width * scale;
+                    }
+                    system.right = x;
+                }
+            }
+
+            // Drawing
+
+            static double y_of(const double middle, const int pos) noexcept { return middle - pos * sp / 2; }
+
+            double staff_middle(const System& system, const std::size_t staff) const noexcept
+            {
+                return system.top + static_cast<double>(staff) * staff_distance;
+            }
+
+            void draw_system(const std::size_t index)
+            {
+                const System& system = systems_[index];
+                const double top = system.top - 2 * sp;
+                const double bottom = staff_middle(system, n_staves_ - 1) + 2 * sp;
+                for (std::size_t i = 0; i < n_staves_; i++)
+                {
+                    const double middle = staff_middle(system, i);
+                    fmt::format_to(std::back_inserter(out_), R"(<path stroke-width="1" d=")");
+                    for (int line = -2; line <= 2; line++)
+                        fmt::format_to(std::back_inserter(out_), "M{:.1f} {:.1f}H{:.1f}", //
+                            margin, middle + line * sp, system.right);
+                    emit(R"("/>)");
+                }
+                emit(R"(<path stroke-width="1.5" d="M{:.1f} {:.1f}V{:.1f}"/>)", margin, top, bottom);
+                if (n_staves_ > 1) // Bracket of the piano staff
+                    emit(R"(<path d="M{0:.1f} {1:.1f}h-3v{2:.1f}h3z"/>)", margin - 2, top, bottom - top);
+
+                // Header
+                const MeasureLayout& first = measures_[system.begin];
+                for (std::size_t i = 0; i < n_staves_; i++)
+                {
+                    const double middle = staff_middle(system, i);
+                    const Clef clef = staff_measure(i, system.begin).clef;
+                    double x = margin + 0.8 * sp;
+                    draw_clef(x, middle, clef, 1);
+                    x += clef_width;
+                    draw_key(x, middle, clef, first.key, first.key);
+                    x += key_width(std::abs(first.key));
+                    if (first.time_change)
+                        draw_time(x, middle, *first.time_change);
+                }
+
+                for (std::size_t i = system.begin; i < system.end; i++)
+                {
+                    const MeasureLayout& layout = measures_[i];
+                    if (i != system.begin)
+                        draw_measure_attributes(system, i);
+                    for (std::size_t j = 0; j < n_staves_; j++)
+                        draw_staff_measure(index, j, i);
+                    const double bar = layout.x + layout.body_width * layout.scale;
+                    const RepeatBraces& repeat = repeat_of(i);
+                    if (repeat.volta_times != 0)
+                    {
+                        emit(R"(<rect x="{:.1f}" y="{:.1f}" width="3" height="{:.1f}"/>)", layout.x, top, bottom - top);
+                        emit(R"(<path stroke-width="1" d="M{:.1f} {:.1f}V{:.1f}"/>)", layout.x + 5, top, bottom);
+                        draw_repeat_dots(system, layout.x + 8.5);
+                    }
+                    if (i + 1 == n_measures_ || repeat.ends_pass)
+                    {
+                        emit(R"(<path stroke-width="1" d="M{:.1f} {:.1f}V{:.1f}"/>)", bar - 5, top, bottom);
+                        emit(R"(<rect x="{:.1f}" y="{:.1f}" width="3" height="{:.1f}"/>)", bar - 3, top, bottom - top);
+                    }
+                    else
+                        emit(R"(<path stroke-width="1" d="M{:.1f} {:.1f}V{:.1f}"/>)", bar, top, bottom);
+                    if (repeat.ends_pass)
+                        draw_repeat_dots(system, bar - 8.5);
+                    if (repeat.pass_count > 2) // Played more than twice without endings
+                        draw_text("n", bar - 2 * sp, top - 1.2 * sp, 1.6 * sp, //
+                            fmt::format("{}&#xD7;", repeat.pass_count));
+                    if (repeat.in_alternative)
+                        draw_volta(system, i, bar);
+                }
+            }
+
+            void draw_repeat_dots(const System& system, const double x)
+            {
+                for (std::size_t i = 0; i < n_staves_; i++)
+                {
+                    const double middle = staff_middle(system, i);
+                    emit(R"(<circle cx="{0:.1f}" cy="{1:.1f}" r="{3:.1f}"/>)"
+                         R"(<circle cx="{0:.1f}" cy="{2:.1f}" r="{3:.1f}"/>)",
+                        x, middle - sp / 2, middle + sp / 2, 0.22 * sp);
+                }
+            }
+
+            // The part of the bracket of an ending over a measure, which continues from the previous bar line
+            void draw_volta(const System& system, const std::size_t measure, const double right)
+            {
+                const MeasureLayout& layout = measures_[measure];
+                const RepeatBraces& repeat = repeat_of(measure);
+                const double y = system.top - 2 * sp - volta_distance;
+                // From the previous bar line
+                const double left = layout.attributes_x + (repeat.first_pass != 0 ? 1 : 0);
+                const double end = right - (repeat.closes_alternative ? 2 : 0);
+                fmt::format_to(std::back_inserter(out_), R"(<path stroke-width="1" fill="none" d="M{:.1f} {:.1f})",
+                    left, repeat.first_pass != 0 ? y + volta_height : y);
+                if (repeat.first_pass != 0)
+                    fmt::format_to(std::back_inserter(out_), "V{:.1f}", y);
+                fmt::format_to(std::back_inserter(out_), "H{:.1f}", end);
+                if (repeat.closes_alternative)
+                    fmt::format_to(std::back_inserter(out_), "V{:.1f}", y + volta_height);
+                emit(R"("/>)");
+                if (repeat.first_pass == 0)
+                    return;
+                const std::string label = repeat.first_pass == repeat.last_pass
+                    ? fmt::format("{}.", repeat.first_pass)
+                    : fmt::format("{}.&#x2013;{}.", repeat.first_pass, repeat.last_pass);
+                draw_text("t", left + 0.5 * sp, y + 1.5 * sp, 1.6 * sp, label);
+            }
+
+            void draw_measure_attributes(const System& system, const std::size_t measure)
+            {
+                const MeasureLayout& layout = measures_[measure];
+                bool any_clef_change = false;
+                for (std::size_t i = 0; i < n_staves_; i++)
+                    any_clef_change |= staff_measure(i, measure).clef_changed;
+                for (std::size_t i = 0; i < n_staves_; i++)
+                {
+                    const StaffMeasure& sm = staff_measure(i, measure);
+                    const double middle = staff_middle(system, i);
+                    double x = layout.attributes_x + 0.3 * sp;
+                    if (sm.clef_changed)
+                        draw_clef(x, middle, sm.clef, 0.75);
+                    x += any_clef_change ? clef_change_width : 0;
+                    if (layout.key_changed)
+                    {
+                        draw_key(x, middle, sm.clef, layout.key, layout.previous_key);
+                        x += key_width(std::abs(layout.key == 0 ? layout.previous_key : layout.key));
+                    }
+                    if (layout.time_change)
+                        draw_time(x, middle, *layout.time_change);
+                }
+            }
+
+            void draw_clef(const double x, const double middle, const Clef clef, const double size)
+            {
+                if (is_treble(clef))
+                {
+                    draw_text("m", x, middle + sp, 4 * sp * size, treble_glyph);
+                    if (clef == Clef::treble_8va)
+                        draw_text("n", x + 1.1 * sp * size, middle - 3.6 * sp * size, 1.4 * sp * size, "8");
+                }
+                else
+                {
+                    draw_text("m", x, middle - sp, 4 * sp * size, bass_glyph);
+                    if (clef == Clef::bass_8va_bassa)
+                        draw_text("n", x + 1.1 * sp * size, middle + 3.4 * sp * size, 1.4 * sp * size, "8");
+                }
+            }
+
+            // Draw a key signature, or the naturals cancelling the previous one when the key changes to C
+            void draw_key(const double x, const double middle, const Clef clef, const int key, const int previous)
+            {
+                const int shown = key == 0 ? previous : key;
+                const int n = std::min(std::abs(shown), 7);
+                const std::string_view glyph =
+                    key == 0 ? accidental_glyphs[2] : key > 0 ? accidental_glyphs[3] : accidental_glyphs[1];
+                const int offset = is_treble(clef) ? 0 : -2;
+                for (int i = 0; i < n; i++)
+                {
+                    const int pos = (shown > 0 ? sharp_positions[i] : flat_positions[i]) + offset;
+                    draw_text("m", x + i * key_accidental_width, y_of(middle, pos) + 0.35 * sp, 3 * sp, glyph);
+                }
+            }
+
+            void draw_time(const double x, const double middle, const Time time)
+            {
+                const double center = x + time_width / 2 - 0.3 * sp;
+                emit(R"(<text class="t" text-anchor="middle" x="{0:.1f}" font-size="{1:.1f}">)"
+                     R"(<tspan x="{0:.1f}" y="{2:.1f}">{3}</tspan><tspan x="{0:.1f}" y="{4:.1f}">{5}</tspan></text>)",
+                    center, 2.8 * sp, middle - 0.1 * sp, time.numerator, middle + 1.9 * sp, time.denominator);
+            }
+
+            void draw_staff_measure(const std::size_t system_index, const std::size_t staff, const std::size_t measure)
+            {
+                const System& system = systems_[system_index];
+                const MeasureLayout& layout = measures_[measure];
+                StaffMeasure& sm = staff_measure(staff, measure);
+                const double middle = staff_middle(system, staff);
+                auto& ties = ties_[staff];
+                ties.resize(std::max(ties.size(), sm.voices.size()));
+
+                if (sm.n_non_empty_voices == 0) // A whole measure rest
+                {
+                    for (auto& tie : ties)
+                        tie.positions.clear();
+                    draw_rest(layout.x + layout.body_width * layout.scale / 2, middle, {0, 0});
+                    return;
+                }
+                for (std::size_t i = 0; i < sm.voices.size(); i++)
+                {
+                    auto& glyphs = sm.voices[i];
+                    if (glyphs.empty())
+                    {
+                        if (i < ties.size())
+                            ties[i].positions.clear();
+                        continue;
+                    }
+                    const auto x_of = [&](const Glyph& glyph)
+                    { return layout.x + layout.offsets[glyph.column] * layout.scale; };
+                    for (BeamGroup& beam : sm.beams)
+                        if (beam.voice == i)
+                            place_beam(beam, glyphs, middle, x_of);
+                    // Rests of the upper and lower voices are moved out of the way of each other
+                    const double rest_offset = sm.n_non_empty_voices == 1 ? 0 : i % 2 == 0 ? -2 * sp : 2 * sp;
+                    for (const Glyph& glyph : glyphs)
+                        draw_glyph(glyph, x_of(glyph), middle, layout, rest_offset, ties[i], system_index);
+                    for (const BeamGroup& beam : sm.beams)
+                        if (beam.voice == i)
+                            draw_beam(beam, glyphs, x_of);
+                    draw_tuplet_brackets(glyphs, middle, x_of);
+                }
+            }
+
+            double stem_x_of(const Glyph& glyph, const double x) const noexcept
+            {
+                return glyph.stem_down ? x - stem_x : x + stem_x;
+            }
+
+            void place_beam(BeamGroup& beam, std::vector<Glyph>& glyphs, const double middle, const auto& x_of)
+            {
+                const bool down = glyphs[beam.begin].stem_down;
+                const double direction = down ? 1 : -1;
+                const auto reference = [&](const Glyph& glyph)
+                {
+                    const auto heads = heads_of(glyph);
+                    return y_of(middle, down ? heads.front().pos : heads.back().pos);
+                };
+                const Glyph& first = glyphs[beam.begin];
+                const Glyph& last = glyphs[beam.end - 1];
+                const double x0 = stem_x_of(first, x_of(first)), x1 = stem_x_of(last, x_of(last));
+                const double y0 = reference(first) + direction * stem_length;
+                const double y1 = reference(last) + direction * stem_length;
+                beam.x = x0;
+                beam.slope = x1 > x0 ? std::clamp(y1 - y0, -sp, sp) / (x1 - x0) : 0;
+                beam.y = y0;
+                // Move the beam away from the heads until every stem is long enough
+                double shift = 0;
+                for (std::size_t i = beam.begin; i < beam.end; i++)
+                {
+                    const Glyph& glyph = glyphs[i];
+                    const double min_length = min_beamed_stem_length + (glyph.duration.log - 3) * beam_distance;
+                    const double y = beam.y + beam.slope * (stem_x_of(glyph, x_of(glyph)) - x0);
+                    shift = std::max(shift, direction * (reference(glyph) + direction * min_length - y));
+                }
+                beam.y += direction * shift;
+                for (std::size_t i = beam.begin; i < beam.end; i++)
+                    glyphs[i].stem_end = beam.y + beam.slope * (stem_x_of(glyphs[i], x_of(glyphs[i])) - x0);
+            }
+
+            void draw_beam(const BeamGroup& beam, const std::vector<Glyph>& glyphs, const auto& x_of)
+            {
+                const bool down = glyphs[beam.begin].stem_down;
+                const auto segment = [&](const double from, const double to, const int level)
+                {
+                    const double offset = (down ? -1 : 1) * level * beam_distance;
+                    const double y0 = beam.y + beam.slope * (from - beam.x) + offset;
+                    const double y1 = beam.y + beam.slope * (to - beam.x) + offset;
+                    const double thickness = down ? -beam_thickness : beam_thickness;
+                    emit(R"(<path d="M{:.1f} {:.1f}L{:.1f} {:.1f}V{:.1f}L{:.1f} {:.1f}z"/>)", from, y0, to, y1,
+                        y1 + thickness, from, y0 + thickness);
+                };
+                const auto stem_of = [&](const std::size_t i) { return stem_x_of(glyphs[i], x_of(glyphs[i])); };
+                segment(stem_of(beam.begin), stem_of(beam.end - 1), 0);
+                for (int level = 1;; level++)
+                {
+                    bool any = false;
+                    for (std::size_t i = beam.begin; i < beam.end; i++)
+                    {
+                        if (glyphs[i].duration.log - 3 < level)
+                            continue;
+                        any = true;
+                        const bool next = i + 1 < beam.end && glyphs[i + 1].duration.log - 3 >= level;
+                        const bool prev = i > beam.begin && glyphs[i - 1].duration.log - 3 >= level;
+                        if (next)
+                            segment(stem_of(i), stem_of(i + 1), level);
+                        else if (!prev) // A partial beam
+                        {
+                            if (i + 1 < beam.end)
+                                segment(stem_of(i), stem_of(i) + sp, level);
+                            else
+                                segment(stem_of(i) - sp, stem_of(i), level);
+                        }
+                    }
+                    if (!any)
+                        break;
+                }
+            }
+
+            void draw_glyph(const Glyph& glyph, const double x, const double middle, const MeasureLayout& layout,
+                const double rest_offset, PendingTie& tie, const std::size_t system)
+            {
+                if (glyph.clef_change != Clef::none)
+                    draw_clef(x - layout.pads[glyph.column] * layout.scale, middle, glyph.clef_change, 0.75);
+                if (glyph.chord->spacer)
+                {
+                    tie.positions.clear();
+                    return;
+                }
+                if (glyph.is_rest())
+                {
+                    tie.positions.clear();
+                    draw_rest(x, middle + rest_offset, glyph.duration);
+                    return;
+                }
+
+                const auto heads = heads_of(glyph);
+                if (!tie.positions.empty())
+                    draw_ties(tie, x, middle, system, heads);
+                if (glyph.chord->sustained)
+                {
+                    tie.positions.clear();
+                    for (const Head& head : heads)
+                        tie.positions.push_back(head.pos);
+                    tie.x = x;
+                    tie.system = system;
+                    tie.below = !glyph.stem_down;
+                }
+
+                // Ledger lines
+                const bool displaced = std::ranges::any_of(heads, &Head::displaced);
+                const double ledger_left = x - 1.1 * sp - (glyph.stem_down && displaced ? 2 * stem_x : 0);
+                const double ledger_right = x + 1.1 * sp + (!glyph.stem_down && displaced ? 2 * stem_x : 0);
+                for (int pos = 6; pos <= heads.back().pos; pos += 2)
+                    draw_ledger_line(ledger_left, ledger_right, y_of(middle, pos));
+                for (int pos = -6; pos >= heads.front().pos; pos -= 2)
+                    draw_ledger_line(ledger_left, ledger_right, y_of(middle, pos));
+
+                const bool hollow = glyph.duration.log <= 1;
+                double dots_x = x + head_rx + 0.6 * sp;
+                for (const Head& head : heads)
+                {
+                    const double head_x = head.displaced ? (glyph.stem_down ? x - 2 * stem_x : x + 2 * stem_x) : x;
+                    const double y = y_of(middle, head.pos);
+                    if (hollow)
+                        emit(R"(<ellipse cx="{0:.1f}" cy="{1:.1f}" rx="{2:.1f}" ry="{3:.1f}" fill="none" )"
+                             R"~(stroke-width="1.3" transform="rotate(-20 {0:.1f} {1:.1f})"/>)~",
+                            head_x, y, head_rx - 0.6, head_ry - 0.6);
+                    else
+                        emit(R"(<ellipse cx="{0:.1f}" cy="{1:.1f}" rx="{2:.1f}" ry="{3:.1f}" )"
+                             R"~(transform="rotate(-20 {0:.1f} {1:.1f})"/>)~",
+                            head_x, y, head_rx, head_ry);
+                    if (head.shows_accidental)
+                    {
+                        const double left = std::min(head_x, x) - head_rx - 0.2 * sp -
+                            (head.accidental_column + 1) * accidental_width;
+                        draw_text("m", left + 0.2 * sp, y + 0.35 * sp, 3 * sp,
+                            accidental_glyphs[std::clamp(head.accidental, -2, 2) + 2]);
+                    }
+                    dots_x = std::max(dots_x, head_x + head_rx + 0.6 * sp);
+                }
+                for (const Head& head : heads)
+                    draw_dots(dots_x, y_of(middle, head.pos) - (head.pos % 2 == 0 ? sp / 2 : 0), glyph.duration.dots);
+
+                if (glyph.duration.log == 0)
+                    return;
+                const double sx = stem_x_of(glyph, x);
+                const double direction = glyph.stem_down ? 1 : -1;
+                const double far = y_of(middle, glyph.stem_down ? heads.back().pos : heads.front().pos);
+                const double near = y_of(middle, glyph.stem_down ? heads.front().pos : heads.back().pos);
+                const int n_flags = std::max(glyph.duration.log - 2, 0);
+                const double end = glyph.beamed
+                    ? glyph.stem_end
+                    : near + direction * (stem_length + std::max(n_flags - 1, 0) * beam_distance);
+                emit(R"(<path stroke-width="1.1" d="M{:.1f} {:.1f}V{:.1f}"/>)", sx, far, end);
+                if (glyph.beamed)
+                    return;
+                for (int i = 0; i < n_flags; i++)
+                {
+                    const double y = end - direction * i * beam_distance;
+                    emit(R"(<path fill="none" stroke-width="1.4" )"
+                         R"(d="M{:.1f} {:.1f}c0 {:.1f} {:.1f} {:.1f} {:.1f} {:.1f}"/>)",
+                        sx, y, -direction * 0.9 * sp, sp, -direction * 1.1 * sp, 0.9 * sp, -direction * 2.4 * sp);
+                }
+            }
+
+            void draw_text(const std::string_view cls, const double x, const double y, const double size,
+                const std::string_view text)
+            {
+                emit(R"(<text class="{}" x="{:.1f}" y="{:.1f}" font-size="{:.1f}">{}</text>)", cls, x, y, size, text);
+            }
+
+            void draw_ledger_line(const double left, const double right, const double y)
+            {
+                emit(R"(<path stroke-width="1" d="M{:.1f} {:.1f}H{:.1f}"/>)", left, y, right);
+            }
+
+            void draw_dots(const double x, const double y, const int n)
+            {
+                for (int i = 0; i < n; i++)
+                    emit(R"(<circle cx="{:.1f}" cy="{:.1f}" r="{:.1f}"/>)", x + i * 0.5 * sp, y, 0.2 * sp);
+            }
+
+            void draw_ties(const PendingTie& tie, const double x, const double middle, const std::size_t system,
+                const std::span<const Head> heads)
+            {
+                const double from = tie.x + head_rx + 1;
+                const double to = tie.system == system ? x - head_rx - 1 : systems_[tie.system].right - 2;
+                const double direction = tie.below ? 1 : -1;
+                for (const int pos : tie.positions)
+                {
+                    if (tie.system == system && std::ranges::find(heads, pos, &Head::pos) == heads.end())
+                        continue;
+                    // The tie may start on the same staff of an earlier system
+                    const double middle_of_tie = middle - systems_[system].top + systems_[tie.system].top;
+                    const double y = y_of(middle_of_tie, pos) + direction * 0.5 * sp;
+                    const double bulge = direction * std::min(0.8 * sp, 0.15 * (to - from));
+                    emit(R"(<path d="M{0:.1f} {1:.1f}Q{2:.1f} {3:.1f} {4:.1f} {1:.1f})"
+                         R"(Q{2:.1f} {5:.1f} {0:.1f} {1:.1f}z"/>)",
+                        from, y, (from + to) / 2, y + bulge * 1.3, to, y + bulge);
+                }
+            }
+
+            void draw_rest(const double x, const double middle, const Duration duration)
+            {
+                const double dots_y = middle - sp / 2;
+                switch (duration.log)
+                {
+                    case 0: // Hanging from the second line from the top
+                        emit(R"(<rect x="{:.1f}" y="{:.1f}" width="{:.1f}" height="{:.1f}"/>)", x - 0.6 * sp,
+                            middle - sp, 1.2 * sp, 0.5 * sp);
+                        break;
+                    case 1: // Sitting on the middle line
+                        emit(R"(<rect x="{:.1f}" y="{:.1f}" width="{:.1f}" height="{:.1f}"/>)", x - 0.6 * sp,
+                            middle - 0.5 * sp, 1.2 * sp, 0.5 * sp);
+                        break;
+                    case 2:
+                        emit(R"(<path fill="none" stroke-width="2" d="M{:.1f} {:.1f}l{:.1f} {:.1f}l{:.1f} {:.1f})"
+                             R"(l{:.1f} {:.1f}q{:.1f} {:.1f} {:.1f} {:.1f}"/>)",
+                            x - 0.3 * sp, middle - 1.5 * sp, 0.65 * sp, 0.9 * sp, -0.6 * sp, 0.7 * sp, 0.6 * sp,
+                            0.7 * sp, -0.9 * sp, -0.2 * sp, -0.3 * sp, 0.7 * sp);
+                        break;
+                    default:
+                    {
+                        const int n_flags = duration.log - 2;
+                        const double top = middle - 0.5 * sp - (n_flags / 2) * sp;
+                        emit(R"(<path stroke-width="1.2" d="M{:.1f} {:.1f}L{:.1f} {:.1f}"/>)", x + 0.5 * sp, top,
+                            x - 0.2 * sp - n_flags * 0.2 * sp, top + (n_flags + 1) * sp);
+                        for (int i = 0; i < n_flags; i++)
+                            emit(R"(<circle cx="{:.1f}" cy="{:.1f}" r="{:.1f}"/>)", x - 0.3 * sp - i * 0.2 * sp,
+                                top + 0.3 * sp + i * sp, 0.3 * sp);
+                    }
+                }
+                draw_dots(x + sp, dots_y, duration.dots);
+            }
+
+            void draw_tuplet_brackets(const std::vector<Glyph>& glyphs, const double middle, const auto& x_of)
+            {
+                bool in_tuplet = false;
+                std::size_t begin = 0;
+                for (std::size_t i = 0; i < glyphs.size(); i++)
+                {
+                    const auto tuplet = glyphs[i].chord->tuplet;
+                    if (tuplet.pos == TupletGroupPosition::head && !in_tuplet)
+                    {
+                        in_tuplet = true;
+                        begin = i;
+                    }
+                    if (tuplet.pos != TupletGroupPosition::last)
+                        continue;
+                    in_tuplet = false;
+
+                    bool below = true;
+                    for (std::size_t j = begin; j <= i; j++)
+                        if (!glyphs[j].is_rest() && !glyphs[j].stem_down)
+                            below = false;
+                    const double direction = below ? 1 : -1;
+                    double extreme = middle + direction * 2.5 * sp;
+                    for (std::size_t j = begin; j <= i; j++)
+                    {
+                        const Glyph& glyph = glyphs[j];
+                        if (glyph.is_rest())
+                            continue;
+                        const auto heads = heads_of(glyph);
+                        const double head_y = y_of(middle, below ? heads.front().pos : heads.back().pos);
+                        const double stem_y = glyph.beamed
+                            ? glyph.stem_end
+                            : head_y + (glyph.stem_down == below ? direction * stem_length : 0);
+                        extreme = below ? std::max({extreme, head_y, stem_y}) : std::min({extreme, head_y, stem_y});
+                    }
+                    const double y = extreme + direction * 1.2 * sp;
+                    const double x0 = x_of(glyphs[begin]) - head_rx, x1 = x_of(glyphs[i]) + head_rx;
+                    const double center = (x0 + x1) / 2, hook = -direction * 0.5 * sp;
+                    emit(R"(<path fill="none" stroke-width="1" d="M{:.1f} {:.1f}V{:.1f}H{:.1f})"
+                         R"(M{:.1f} {:.1f}H{:.1f}V{:.1f}"/>)",
+                        x0, y + hook, y, center - 0.8 * sp, center + 0.8 * sp, y, x1, y + hook);
+                    emit(R"(<text class="n" text-anchor="middle" x="{:.1f}" y="{:.1f}" font-size="{:.1f}">{}</text>)",
+                        center, y + 0.5 * sp, 1.6 * sp, tuplet.ratio.numerator());
+                }
+            }
+        };
+    } // namespace
+
+    std::size_t write_to_stream(std::ostream& stream, const ly::LyMusic& music)
+    {
+        return Engraver(music).write(stream);
+    }
+} // namespace hkr::svg
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <ostream>
+
+#include "../lilypond/types.h"
+
+namespace hkr::svg
+{
+    // Engrave the converted music into a single SVG image, for quick previews without Lilypond.
+    // Every line holds a system of all the staves, the lines are justified to a fixed width.
+    // Returns the number of bytes written
+    std::size_t write_to_stream(std::ostream& stream, const ly::LyMusic& music);
+}
@@ -0,0 +1,82 @@
+#include "thread_pool.h"
+
+namespace hkr
+{
+    ThreadPool::ThreadPool(const std::size_t n_threads)
+    {
+        const std::size_t n = n_threads == 0 ? 1 : n_threads;
+        queues_.reserve(n);
+        for (std::size_t i = 0; i < n; i++)
+            queues_.push_back(std::make_unique<Queue>());
+        threads_.reserve(n);
+        for (std::size_t i = 0; i < n; i++)
+            threads_.emplace_back([this, i] { work(i); });
+    }
+
+    ThreadPool::~ThreadPool() noexcept
+    {
+        {
+            const std::scoped_lock lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    void ThreadPool::submit(Task task)
+    {
+        // Only the submitting thread touches next_queue_
+        Queue& queue = *queues_[next_queue_++ % queues_.size()];
+        {
+            const std::scoped_lock lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            const std::scoped_lock lock(mutex_);
+            pending_++;
+        }
+        cv_.notify_one();
+    }
+
+    void ThreadPool::work(const std::size_t worker)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [this] { return pending_ > 0 || stopping_; });
+                if (pending_ == 0) // Stopping and nothing left to do
+                    return;
+                pending_--; // Claim a task, which is already in one of the queues
+            }
+            take(worker)(worker);
+        }
+    }
+
+    ThreadPool::Task ThreadPool::take(const std::size_t worker)
+    {
+        // Take the newest task from our own queue, or steal the oldest one from the others
+        const std::size_t n = queues_.size();
+        while (true)
+            for (std::size_t i = 0; i < n; i++)
+            {
+                Queue& queue = *queues_[(worker + i) % n];
+                const std::scoped_lock lock(queue.mutex);
+                if (queue.tasks.empty())
+                    continue;
+                Task task;
+                if (i == 0)
+                {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                return task;
+            }
+    }
+} // namespace hkr
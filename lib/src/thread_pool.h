@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hkr
+{
+    // A fixed-size pool of worker threads. Every worker has its own task queue, tasks are
+    // distributed over the queues round-robin, and an idle worker steals from the other
+    // queues, so that a few expensive tasks do not leave the other workers waiting.
+    class ThreadPool
+    {
+    public:
+        // The argument of a task is the index of the worker running it
+        using Task = std::function<void(std::size_t)>; // Must not throw
+
+        explicit ThreadPool(std::size_t n_threads);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool() noexcept; // Finishes the queued tasks before joining the workers
+
+        std::size_t size() const noexcept { return queues_.size(); }
+        void submit(Task task);
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> queues_;
+        std::vector<std::thread> threads_;
+        std::size_t next_queue_ = 0;
+
+        // Number of submitted tasks not yet claimed by a worker
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::size_t pending_ = 0;
+        bool stopping_ = false;
+
+        void work(std::size_t worker);
+        Task take(std::size_t worker);
+    };
+} // namespace hkr
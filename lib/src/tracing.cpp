@@ -0,0 +1,131 @@
+#include "tracing.h"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <fmt/format.h>
+
+namespace hkr::trace
+{
+    namespace
+    {
+        struct Sink
+        {
+            std::mutex mutex;
+            std::ofstream file;
+            Callback callback;
+            bool first_event = true;
+            Clock::time_point epoch;
+        };
+
+        std::atomic<bool> active{false};
+
+        Sink& sink()
+        {
+            static Sink instance;
+            return instance;
+        }
+
+        std::uint32_t thread_id() noexcept
+        {
+            // Small sequential IDs are easier to read in the trace viewers than the native ones
+            static std::atomic<std::uint32_t> next_id{1};
+            thread_local const std::uint32_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+            return id;
+        }
+
+        double microseconds(const Clock::duration duration) noexcept
+        {
+            return std::chrono::duration<double, std::micro>(duration).count();
+        }
+
+        void stop_locked(Sink& s)
+        {
+            active.store(false, std::memory_order_relaxed);
+            if (s.file.is_open())
+            {
+                s.file << "\n]\n";
+                s.file.close();
+            }
+            s.callback = nullptr;
+        }
+
+        void start_locked(Sink& s)
+        {
+            s.first_event = true;
+            s.epoch = Clock::now();
+            active.store(true, std::memory_order_relaxed);
+        }
+    } // namespace
+
+    bool is_supported() noexcept
+    {
+#ifdef HIKARI_ENABLE_TRACING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void start(const std::filesystem::path& path)
+    {
+        if (!is_supported())
+            return;
+        auto& s = sink();
+        const std::scoped_lock lock(s.mutex);
+        stop_locked(s);
+        s.file.open(path, std::ios::out | std::ios::trunc);
+        if (!s.file)
+            throw std::runtime_error("Failed to open the trace file " + path.string());
+        s.file << '[';
+        start_locked(s);
+    }
+
+    void start(Callback callback)
+    {
+        if (!is_supported())
+            return;
+        auto& s = sink();
+        const std::scoped_lock lock(s.mutex);
+        stop_locked(s);
+        s.callback = std::move(callback);
+        start_locked(s);
+    }
+
+    void stop()
+    {
+        auto& s = sink();
+        const std::scoped_lock lock(s.mutex);
+        stop_locked(s);
+    }
+
+    bool is_active() noexcept { return active.load(std::memory_order_relaxed); }
+
+    void emit(const std::string_view name, const std::size_t index, //
+        const Clock::time_point begin, const Clock::time_point end) noexcept
+    try
+    {
+        const auto tid = thread_id();
+        auto& s = sink();
+        const std::scoped_lock lock(s.mutex);
+        // The trace may have been stopped or restarted while the zone was open
+        if (!active.load(std::memory_order_relaxed) || begin < s.epoch)
+            return;
+        const std::string event = fmt::format(
+            R"({{"name":"{}","cat":"hikari","ph":"X","ts":{:.3f},"dur":{:.3f},"pid":1,"tid":{}{}}})", //
+            name, microseconds(begin - s.epoch), microseconds(end - begin), tid,
+            index == no_index ? std::string() : fmt::format(R"(,"args":{{"index":{}}})", index));
+        if (s.file.is_open())
+        {
+            s.file << (s.first_event ? "\n" : ",\n") << event;
+            s.first_event = false;
+        }
+        else if (s.callback)
+            s.callback(event);
+    }
+    catch (...) // Tracing should never break the traced code
+    {
+    }
+} // namespace hkr::trace
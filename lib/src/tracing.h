@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <string_view>
+
+#include "hikari/tracing.h"
+
+// Trace zones only exist when the library is built with HIKARI_ENABLE_TRACING,
+// otherwise HIKARI_TRACE_ZONE expands to nothing and its arguments are not evaluated.
+#ifdef HIKARI_ENABLE_TRACING
+#   define HIKARI_TRACE_CONCAT_IMPL(a, b) a##b
+#   define HIKARI_TRACE_CONCAT(a, b) HIKARI_TRACE_CONCAT_IMPL(a, b)
+#   define HIKARI_TRACE_ZONE(...) \
+        const ::hkr::trace::Zone HIKARI_TRACE_CONCAT(hikari_trace_zone_, __LINE__)(__VA_ARGS__)
+#else
+#   define HIKARI_TRACE_ZONE(...) static_cast<void>(0)
+#endif
+
+namespace hkr::trace
+{
+    using Clock = std::chrono::steady_clock;
+
+    inline constexpr std::size_t no_index = std::numeric_limits<std::size_t>::max();
+
+    bool is_active() noexcept;
+    void emit(std::string_view name, std::size_t index, Clock::time_point begin, Clock::time_point end) noexcept;
+
+    // Emits a complete event spanning its lifetime, if a trace is running when it is created.
+    // The name must outlive the zone, it is expected to be a string literal.
+    class Zone
+    {
+    public:
+        explicit Zone(const std::string_view name, const std::size_t index = no_index) noexcept:
+            name_(name), index_(index), active_(is_active())
+        {
+            if (active_)
+                begin_ = Clock::now();
+        }
+
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+
+        ~Zone() noexcept
+        {
+            if (active_)
+                emit(name_, index_, begin_, Clock::now());
+        }
+
+    private:
+        std::string_view name_;
+        std::size_t index_;
+        bool active_;
+        Clock::time_point begin_{};
+    };
+} // namespace hkr::trace
@@ -0,0 +1,208 @@
+#include "hikari/transpose.h"
+
+#include <array>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <fmt/format.h>
+
+namespace hkr
+{
+    namespace
+    {
+        constexpr int min_accidental = -2;
+        constexpr int max_accidental = 2;
+        constexpr int values[]{0, 2, 4, 5, 7, 9, 11}; // C, D, E, F, G, A, B
+        constexpr int fifths[]{0, 2, 4, -1, 1, 3, 5}; // Positions of C, D, E, F, G, A, B on the line of fifths
+        constexpr int max_key_wraps = 2; // Respellings of the notes under wrapped keys that are kept in the table
+
+        int floor_div(const int lhs, const int rhs) noexcept
+        {
+            return lhs / rhs - (lhs % rhs != 0 && (lhs < 0) != (rhs < 0));
+        }
+
+        // The enharmonic spelling of a note moved by some fifths on the line of fifths, a multiple of 12
+        Note respelled(const Note note, const int shift) noexcept
+        {
+            if (shift == 0)
+                return note;
+            using enum NoteBase;
+            constexpr NoteBase bases[]{f, c, g, d, a, e, b}; // From the position -1 on the line of fifths
+            const int position = fifths[static_cast<int>(note.base)] + 7 * note.accidental + shift + 1;
+            const int accidental = floor_div(position, 7);
+            const NoteBase base = bases[position - 7 * accidental];
+            const int semitones = values[static_cast<int>(note.base)] + note.accidental - //
+                values[static_cast<int>(base)] - accidental; // A multiple of 12
+            return {.base = base, .octave = note.octave + semitones / 12, .accidental = accidental};
+        }
+
+        // More than two sharps or flats cannot be written, such notes are respelled by 12 fifths at a time,
+        // e.g. A### becomes B#
+        Note writable(Note note) noexcept
+        {
+            while (note.accidental > max_accidental)
+                note = respelled(note, -12);
+            while (note.accidental < min_accidental)
+                note = respelled(note, 12);
+            return note;
+        }
+
+        // Transposing a note only depends on its base and accidental, its octave is just offset,
+        // so the transposition of every spelling that the parser produces is computed beforehand,
+        // along with its respellings under the keys that wrap around to their enharmonic equivalents
+        class TranspositionTable
+        {
+        public:
+            template <typename F>
+            explicit TranspositionTable(F&& transpose_note)
+            {
+                for (int base = 0; base < 7; base++)
+                    for (int acc = min_accidental; acc <= max_accidental; acc++)
+                    {
+                        const Note note{.base = static_cast<NoteBase>(base), .octave = 0, .accidental = acc};
+                        const Note result = transpose_note(note);
+                        const int pitch_offset = values[static_cast<int>(result.base)] + (result.octave + 1) * 12;
+                        for (int wraps = -max_key_wraps; wraps <= max_key_wraps; wraps++)
+                            entries_[static_cast<std::size_t>(wraps + max_key_wraps)][index(note)] = {
+                                .note = writable(respelled(result, 12 * wraps)),
+                                .pitch_offset = pitch_offset //
+                            };
+                    }
+                const Note tonic =
+                    entries_[max_key_wraps][index({.base = NoteBase::c, .octave = 0, .accidental = 0})].note;
+                key_offset_ = fifths[static_cast<int>(tonic.base)] + 7 * tonic.accidental;
+            }
+
+            // Returns false if the note has an accidental or a respelling out of the table
+            bool transpose(Note& note, const int key_shift) const
+            {
+                const int wraps = key_shift / 12;
+                if (note.accidental < min_accidental || note.accidental > max_accidental || wraps < -max_key_wraps ||
+                    wraps > max_key_wraps)
+                    return false;
+                const Entry& entry = entries_[static_cast<std::size_t>(wraps + max_key_wraps)][index(note)];
+                // Same as Note::pitch_id, with the base and octave offset looked up from the table
+                if (const int pitch = entry.pitch_offset + note.octave * 12; pitch < 0 || pitch > 127)
+                    throw std::out_of_range(fmt::format("A transposed note gets the pitch id {}, which is out of "
+                                                        "the range 0 to 127",
+                        pitch));
+                note = {
+                    .base = entry.note.base,
+                    .octave = note.octave + entry.note.octave,
+                    .accidental = entry.note.accidental //
+                };
+                return true;
+            }
+
+            int transpose_key(const int key) const noexcept
+            {
+                int res = key + key_offset_;
+                // Use the enharmonic key for theoretical ones, e.g. A flat major instead of G sharp major
+                while (res > 7)
+                    res -= 12;
+                while (res < -7)
+                    res += 12;
+                return res;
+            }
+
+            // The notes under a wrapped key are respelled by the same number of fifths, so that they agree
+            // with the signature, e.g. D# F## A# become Eb G Bb under E flat major
+            int key_shift(const int key) const noexcept { return transpose_key(key) - key - key_offset_; }
+
+        private:
+            struct Entry
+            {
+                Note note; // The transposed note of octave 0
+                int pitch_offset = 0;
+            };
+
+            std::array<std::array<Entry, 7 * (max_accidental - min_accidental + 1)>, 2 * max_key_wraps + 1> entries_{};
+            int key_offset_ = 0;
+
+            static std::size_t index(const Note note) noexcept
+            {
+                return static_cast<std::size_t>(
+                    static_cast<int>(note.base) * (max_accidental - min_accidental + 1) + //
+                    note.accidental - min_accidental);
+            }
+        };
+
+        template <typename F>
+        void transpose_music(Music& music, F&& transpose_note)
+        {
+            constexpr ChordId unmapped = std::numeric_limits<ChordId>::max();
+            const TranspositionTable table(transpose_note);
+            int key_shift = 0; // Respelling under the current key signature, which lasts over the sections
+            bool is_first_measure = true;
+            // Every note set of a section is transposed once per key shift into a new pool, which then
+            // replaces the one of the section
+            ChordPool transposed;
+            std::vector<ChordId> ids; // IDs in the new pool of the note sets, under ids_key_shift
+            int ids_key_shift = 0;
+            std::vector<Note> notes;
+            for (Section& section : music)
+            {
+                // Validate the range first, so that a failure leaves the chords and the pool of the section agreeing
+                for (ChordId id = 0; id < section.chords.size(); id++)
+                    for (const Note note : section.chords[id])
+                        (void)transpose_note(note).pitch_id();
+                transposed.clear();
+                ids.assign(section.chords.size(), unmapped);
+                ids_key_shift = key_shift;
+                for (std::size_t i = 0; i < section.measures.size(); i++)
+                {
+                    auto& key = section.measures[i].attributes.key;
+                    // The music starts in C major without a key signature, which is transposed like any other key
+                    if (std::exchange(is_first_measure, false) && !key)
+                        key = 0;
+                    if (key)
+                    {
+                        key_shift = table.key_shift(*key);
+                        key = table.transpose_key(*key);
+                    }
+                    if (section.staves.empty())
+                        continue;
+                    if (key_shift != std::exchange(ids_key_shift, key_shift))
+                        ids.assign(section.chords.size(), unmapped);
+                    const auto [begin, end] = section.beat_index_range_of_measure(i);
+                    for (Staff& staff : section.staves)
+                        for (Beat& beat : std::span(staff).subspan(begin, end - begin))
+                            for (Voice& voice : beat)
+                                for (Chord& chord : voice)
+                                {
+                                    ChordId& id = ids[chord.notes];
+                                    if (id == unmapped)
+                                    {
+                                        const auto old_notes = section.chords[chord.notes];
+                                        notes.assign(old_notes.begin(), old_notes.end());
+                                        for (Note& note : notes)
+                                            if (!table.transpose(note, key_shift)) // Out of the table
+                                                note = writable(respelled(transpose_note(note), key_shift));
+                                        id = transposed.intern(notes);
+                                    }
+                                    chord.notes = id;
+                                }
+                }
+                std::swap(section.chords, transposed);
+            }
+        }
+    } // namespace
+
+    void transpose_up(Music& music, const Interval interval)
+    {
+        (void)interval.semitones(); // Validate the interval
+        transpose_music(music, [=](const Note note) { return note.transposed_up(interval); });
+    }
+
+    void transpose_down(Music& music, const Interval interval)
+    {
+        (void)interval.semitones();
+        transpose_music(music, [=](const Note note) { return note.transposed_down(interval); });
+    }
+
+    void transpose(Music& music, const int semitones)
+    {
+        transpose_music(music, [=](const Note note) { return note.transposed_up(semitones); });
+    }
+} // namespace hkr
@@ -1,5 +1,6 @@
 #include "hikari/types.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace hkr
@@ -87,7 +88,7 @@ namespace hkr
         result.octave -= semitones / 12;
         semitones %= 12;
         static constexpr int intervals[]{0, -1, -1, -2, -2, -3, -3, -4, -5, -5, -6, -6};
-        return transpose_up_impl(result, semitones, intervals[semitones]);
+        return transpose_up_impl(result, -semitones, intervals[semitones]);
     }
 
     Note Note::transposed_up(Interval interval) const noexcept
@@ -124,10 +125,35 @@ namespace hkr
             partial = other.partial;
     }
 
+    std::size_t Repeat::alternative_of_pass(const int pass) const noexcept
+    {
+        if (alternative_ends.empty())
+            return 0;
+        // The last endings are taken by the last passes, the extra early passes all take the first one
+        const int first_pass_of_others = times - static_cast<int>(alternative_ends.size()) + 1;
+        return pass < first_pass_of_others ? 0 : static_cast<std::size_t>(pass - first_pass_of_others + 1);
+    }
+
     std::pair<std::size_t, std::size_t> Section::beat_index_range_of_measure(const std::size_t measure) const
     {
         const auto start = measures[measure].start_beat;
         const auto stop = measures.size() == measure + 1 ? staves[0].size() : measures[measure + 1].start_beat;
         return {start, stop};
     }
+
+    const Chord::Attributes* Section::attributes_of(const ChordPosition& position) const noexcept
+    {
+        const auto iter = std::ranges::lower_bound(chord_attributes, position, std::less{}, &ChordAttributes::position);
+        return iter != chord_attributes.end() && iter->position == position ? &iter->attributes : nullptr;
+    }
+
+    std::optional<float> Section::tempo_at(const std::size_t beat) const noexcept
+    {
+        auto iter = std::ranges::upper_bound(chord_attributes, beat, std::less{},
+            [](const ChordAttributes& attrs) { return attrs.position.beat; });
+        while (iter != chord_attributes.begin())
+            if (const auto& tempo = (--iter)->attributes.tempo)
+                return tempo;
+        return std::nullopt;
+    }
 } // namespace hkr
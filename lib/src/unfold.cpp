@@ -0,0 +1,79 @@
+#include "hikari/unfold.h"
+
+namespace hkr
+{
+    UnfoldedMeasures::iterator::iterator(const std::span<const Repeat> repeats, const std::size_t n_measures) noexcept:
+        repeats_(repeats), n_measures_(n_measures)
+    {
+        enter_repeat();
+    }
+
+    UnfoldedMeasures::iterator& UnfoldedMeasures::iterator::operator++() noexcept
+    {
+        const std::size_t next = measure_ + 1;
+        if (pass_ == 0) // Not in a repeat
+        {
+            measure_ = next;
+            enter_repeat();
+            return *this;
+        }
+
+        const Repeat& repeat = repeats_[repeat_];
+        const auto next_pass = [&]
+        {
+            if (pass_ < repeat.times)
+            {
+                pass_++;
+                measure_ = repeat.begin_measure;
+                return;
+            }
+            // Leave the repeat after the last pass
+            pass_ = 0;
+            measure_ = repeat.end_of_alternatives();
+            repeat_++;
+            enter_repeat();
+        };
+
+        if (measure_ < repeat.end_measure) // In the body
+        {
+            if (next != repeat.end_measure)
+                measure_ = next;
+            else if (repeat.alternative_ends.empty())
+                next_pass();
+            else // Jump to the ending of this pass
+                measure_ = repeat.begin_of_alternative(repeat.alternative_of_pass(pass_ - 1));
+        }
+        else if (next != repeat.alternative_ends[repeat.alternative_of_pass(pass_ - 1)]) // In an ending
+            measure_ = next;
+        else
+            next_pass();
+        return *this;
+    }
+
+    void UnfoldedMeasures::iterator::enter_repeat() noexcept
+    {
+        if (repeat_ < repeats_.size() && measure_ == repeats_[repeat_].begin_measure)
+            pass_ = 1;
+    }
+
+    std::size_t UnfoldedMeasures::size() const noexcept
+    {
+        std::size_t res = n_measures_;
+        for (const Repeat& repeat : repeats_)
+        {
+            const auto times = static_cast<std::size_t>(repeat.times);
+            const std::size_t body = repeat.end_measure - repeat.begin_measure;
+            res += body * (times - 1);
+            if (repeat.alternative_ends.empty())
+                continue;
+            // Every pass takes an ending, the written ones are counted once already
+            res -= repeat.end_of_alternatives() - repeat.end_measure;
+            for (int pass = 0; pass < repeat.times; pass++)
+            {
+                const auto alt = repeat.alternative_of_pass(pass);
+                res += repeat.alternative_ends[alt] - repeat.begin_of_alternative(alt);
+            }
+        }
+        return res;
+    }
+} // namespace hkr
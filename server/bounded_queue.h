@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace hkr::server
+{
+    // A multi-producer multi-consumer queue of a fixed capacity. Pushing into a full queue blocks,
+    // which stops the connection readers from reading more requests and pushes back on the clients.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(const std::size_t capacity): capacity_(capacity == 0 ? 1 : capacity) {}
+
+        // Returns false if the queue is closed
+        bool push(T value)
+        {
+            std::unique_lock lock(mutex_);
+            not_full_.wait(lock, [this] { return items_.size() < capacity_ || closed_; });
+            if (closed_)
+                return false;
+            items_.push_back(std::move(value));
+            lock.unlock();
+            not_empty_.notify_one();
+            return true;
+        }
+
+        // Returns nullopt if the queue is closed and drained
+        std::optional<T> pop()
+        {
+            std::unique_lock lock(mutex_);
+            not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+            if (items_.empty())
+                return std::nullopt;
+            T value = std::move(items_.front());
+            items_.pop_front();
+            lock.unlock();
+            not_full_.notify_one();
+            return value;
+        }
+
+        void close()
+        {
+            {
+                const std::scoped_lock lock(mutex_);
+                closed_ = true;
+            }
+            not_full_.notify_all();
+            not_empty_.notify_all();
+        }
+
+        std::size_t size() const
+        {
+            const std::scoped_lock lock(mutex_);
+            return items_.size();
+        }
+
+        std::size_t capacity() const noexcept { return capacity_; }
+
+    private:
+        mutable std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+        std::deque<T> items_;
+        std::size_t capacity_;
+        bool closed_ = false;
+    };
+} // namespace hkr::server
@@ -0,0 +1,569 @@
+// A long-running conversion server, so that clients need not spawn a process per request.
+//
+// Usage: hkrd (--socket <path> | --stdio) [-j <workers>] [--queue <capacity>] [--max-connections <count>]
+//             [--max-request-bytes <bytes>] [--max-pending-bytes <bytes>] [--max-expanded-bytes <bytes>]
+//             [--max-notes <count>] [--max-measures <count>] [--max-voices <count>]
+//             [--max-subdivision <count>] [--max-allocated-bytes <bytes>]
+//
+// Requests are read from every client connection (or stdin) and converted on a fixed pool of
+// workers. See the "Server" section of the README for the protocol.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <semaphore>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+#include <hikari/api.h>
+#include <hikari/engine.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bounded_queue.h"
+#include "server_stats.h"
+
+namespace
+{
+    using namespace hkr::server;
+    using Clock = std::chrono::steady_clock;
+
+    enum class RequestKind : std::uint8_t
+    {
+        convert = 0,
+        stats = 1
+    };
+
+    enum class Format : std::uint8_t
+    {
+        lilypond = 0,
+        svg = 1,
+        piano_roll = 2
+    };
+
+    enum class Status : std::uint8_t
+    {
+        ok = 0,
+        error = 1
+    };
+
+    // Request: u32 length | u32 id | u8 kind | u8 format | input text (length - 6 bytes)
+    // Response: u32 length | u32 id | u8 status | output or diagnostic (length - 5 bytes)
+    constexpr std::size_t request_header_size = 6;
+    constexpr std::size_t response_header_size = 5;
+
+    struct Config
+    {
+        std::string socket_path;
+        bool stdio = false;
+        std::size_t n_workers = 0;
+        std::size_t queue_capacity = 0;
+        std::size_t max_request_bytes = 16 << 20;
+        std::size_t max_pending_bytes = 64 << 20; // Responses waiting for a client to read them
+        std::size_t max_connections = 256;
+        hkr::ParseOptions parse_options;
+        // A small input can still expand into a large score, e.g. through repeats, so exporting is bounded too
+        hkr::ExportOptions export_options{
+            .max_notes = 1 << 20,
+            .max_measures = 1 << 16,
+            .max_voices = 64,
+            .max_subdivision = 64,
+            .max_allocated_bytes = 256 << 20 //
+        };
+    };
+
+    std::uint32_t load_u32(const unsigned char* bytes) noexcept
+    {
+        return static_cast<std::uint32_t>(bytes[0]) | static_cast<std::uint32_t>(bytes[1]) << 8 |
+            static_cast<std::uint32_t>(bytes[2]) << 16 | static_cast<std::uint32_t>(bytes[3]) << 24;
+    }
+
+    void store_u32(unsigned char* bytes, const std::uint32_t value) noexcept
+    {
+        for (int i = 0; i < 4; i++)
+            bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    [[noreturn]] void throw_errno(const char* what) { throw std::system_error(errno, std::generic_category(), what); }
+
+    // A client connection, shared by its reader, its writer and the workers sending its responses.
+    // Responses are sent in the order of completion, clients match them by the request IDs. The workers
+    // only queue the responses, the writer thread of the connection is the one that blocks on the client,
+    // and a client that doesn't read its responses is dropped once they pile up beyond the limit.
+    class Connection
+    {
+    public:
+        Connection(
+            const int in_fd, const int out_fd, const bool owns_fds, const std::size_t max_pending_bytes) noexcept:
+            in_fd_(in_fd), out_fd_(out_fd), owns_fds_(owns_fds), max_pending_bytes_(max_pending_bytes)
+        {
+        }
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        ~Connection() noexcept
+        {
+            if (!owns_fds_)
+                return;
+            ::close(in_fd_);
+            if (out_fd_ != in_fd_)
+                ::close(out_fd_);
+        }
+
+        // Returns false on the end of the stream or an error
+        bool read_exact(void* buffer, std::size_t size) const
+        {
+            auto* ptr = static_cast<char*>(buffer);
+            while (size > 0)
+            {
+                const auto n = ::read(in_fd_, ptr, size);
+                if (n == 0)
+                    return false;
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                ptr += n;
+                size -= static_cast<std::size_t>(n);
+            }
+            return true;
+        }
+
+        // Queues a response for the writer, never blocks on the client
+        void send(const std::uint32_t id, const Status status, const std::string_view body)
+        {
+            std::string message(4 + response_header_size, '\0');
+            auto* header = reinterpret_cast<unsigned char*>(message.data());
+            store_u32(header, static_cast<std::uint32_t>(response_header_size + body.size()));
+            store_u32(header + 4, id);
+            header[8] = static_cast<unsigned char>(status);
+            message.append(body);
+            {
+                const std::scoped_lock lock(mutex_);
+                if (broken_)
+                    return;
+                // A single response is always accepted, so that large outputs reach the clients that read them
+                if (!outgoing_.empty() && pending_bytes_ + message.size() > max_pending_bytes_)
+                {
+                    drop();
+                    return;
+                }
+                pending_bytes_ += message.size();
+                outgoing_.push_back(std::move(message));
+            }
+            changed_.notify_all();
+        }
+
+        // A request is handed to the workers, the writer waits for its response before finishing
+        void start_request()
+        {
+            const std::scoped_lock lock(mutex_);
+            n_in_flight_++;
+        }
+
+        void finish_request()
+        {
+            {
+                const std::scoped_lock lock(mutex_);
+                n_in_flight_--;
+            }
+            changed_.notify_all();
+        }
+
+        void finish_reading()
+        {
+            {
+                const std::scoped_lock lock(mutex_);
+                reading_finished_ = true;
+            }
+            changed_.notify_all();
+        }
+
+        bool broken() const
+        {
+            const std::scoped_lock lock(mutex_);
+            return broken_;
+        }
+
+        // Runs on the writer thread of the connection, until every response is written or the client goes away
+        void write_responses()
+        {
+            std::unique_lock lock(mutex_);
+            while (true)
+            {
+                changed_.wait(lock,
+                    [this] { return broken_ || !outgoing_.empty() || (reading_finished_ && n_in_flight_ == 0); });
+                if (broken_ || outgoing_.empty())
+                    return;
+                const std::string message = std::move(outgoing_.front());
+                outgoing_.pop_front();
+                lock.unlock();
+                const bool written = write_all(message.data(), message.size());
+                lock.lock();
+                pending_bytes_ -= message.size();
+                if (!written)
+                {
+                    drop();
+                    return;
+                }
+            }
+        }
+
+    private:
+        int in_fd_;
+        int out_fd_;
+        bool owns_fds_;
+        std::size_t max_pending_bytes_;
+        mutable std::mutex mutex_;
+        std::condition_variable changed_;
+        std::deque<std::string> outgoing_;
+        std::size_t pending_bytes_ = 0; // Queued or being written
+        std::size_t n_in_flight_ = 0;
+        bool reading_finished_ = false;
+        bool broken_ = false; // The client went away or stopped reading, drop the remaining responses
+
+        // Called with the lock held. Shutting the socket down wakes up its reader and writer if they are
+        // blocked on the client, it fails harmlessly for the standard streams.
+        void drop() noexcept
+        {
+            broken_ = true;
+            outgoing_.clear();
+            ::shutdown(in_fd_, SHUT_RDWR);
+            changed_.notify_all();
+        }
+
+        bool write_all(const void* buffer, std::size_t size) const
+        {
+            const auto* ptr = static_cast<const char*>(buffer);
+            while (size > 0)
+            {
+                const auto n = ::write(out_fd_, ptr, size);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                ptr += n;
+                size -= static_cast<std::size_t>(n);
+            }
+            return true;
+        }
+    };
+
+    struct Job
+    {
+        std::shared_ptr<Connection> connection;
+        std::uint32_t id = 0;
+        std::string input;
+        Clock::time_point received;
+        Format format = Format::lilypond;
+    };
+
+    // Stream buffer appending to a string, which keeps its capacity between the requests
+    class StringAppendBuffer final : public std::streambuf
+    {
+    public:
+        explicit StringAppendBuffer(std::string& str) noexcept: str_(str) {}
+
+    protected:
+        std::streamsize xsputn(const char* str, const std::streamsize count) override
+        {
+            str_.append(str, static_cast<std::size_t>(count));
+            return count;
+        }
+
+        int_type overflow(const int_type ch) override
+        {
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                str_.push_back(traits_type::to_char_type(ch));
+            return ch;
+        }
+
+    private:
+        std::string& str_;
+    };
+
+    class Server
+    {
+    public:
+        explicit Server(const Config& config): config_(config), queue_(config.queue_capacity)
+        {
+            workers_.reserve(config.n_workers);
+            for (std::size_t i = 0; i < config.n_workers; i++)
+                workers_.emplace_back([this] { run_worker(); });
+        }
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        ~Server() noexcept
+        {
+            queue_.close();
+            for (auto& worker : workers_)
+                worker.join();
+        }
+
+        // Serve a connection until it is closed and every response to it is written
+        void serve(const std::shared_ptr<Connection>& connection)
+        {
+            std::thread writer([&connection] { connection->write_responses(); });
+            read_requests(connection);
+            connection->finish_reading();
+            writer.join();
+        }
+
+    private:
+        const Config& config_;
+        BoundedQueue<Job> queue_;
+        ServerStats stats_;
+        std::vector<std::thread> workers_;
+
+        // Read the requests of a connection until it is closed, blocking when the queue is full
+        void read_requests(const std::shared_ptr<Connection>& connection)
+        {
+            while (!connection->broken())
+            {
+                unsigned char length_bytes[4];
+                if (!connection->read_exact(length_bytes, sizeof(length_bytes)))
+                    return;
+                const std::size_t length = load_u32(length_bytes);
+                if (length < request_header_size || length > config_.max_request_bytes)
+                {
+                    connection->send(0, Status::error,
+                        fmt::format("Invalid request length {}, closing the connection", length));
+                    return;
+                }
+                unsigned char header[request_header_size];
+                std::string input(length - request_header_size, '\0');
+                if (!connection->read_exact(header, sizeof(header)) ||
+                    !connection->read_exact(input.data(), input.size()))
+                    return;
+                const auto received = Clock::now();
+                const std::uint32_t id = load_u32(header);
+                const auto kind = static_cast<RequestKind>(header[4]);
+                const auto format = static_cast<Format>(header[5]);
+
+                if (kind == RequestKind::stats)
+                    connection->send(id, Status::ok, stats_.to_json(queue_.size(), queue_.capacity()));
+                else if (kind != RequestKind::convert)
+                    connection->send(id, Status::error, fmt::format("Unknown request kind {}", header[4]));
+                else if (static_cast<std::uint8_t>(format) > static_cast<std::uint8_t>(Format::piano_roll))
+                    connection->send(id, Status::error, fmt::format("Unsupported output format {}", header[5]));
+                else
+                {
+                    connection->start_request();
+                    if (!queue_.push(Job{connection, id, std::move(input), received, format}))
+                    {
+                        connection->finish_request();
+                        return;
+                    }
+                }
+            }
+        }
+
+        void run_worker()
+        {
+            // Warm buffers, reused between the requests
+            hkr::Engine engine;
+            std::string output;
+            while (auto job = queue_.pop())
+            {
+                const std::size_t input_bytes = job->input.size();
+                bool succeeded = true;
+                output.clear();
+                try
+                {
+                    StringAppendBuffer buffer(output);
+                    std::ostream stream(&buffer);
+                    const auto& music = engine.parse(job->input, config_.parse_options);
+                    if (job->format == Format::svg)
+                        hkr::export_to_svg(stream, music, config_.export_options);
+                    else if (job->format == Format::piano_roll)
+                        hkr::export_to_piano_roll(stream, music, config_.export_options);
+                    else
+                        engine.export_to_lilypond(stream, music, config_.export_options);
+                }
+                catch (const std::exception& exc)
+                {
+                    succeeded = false;
+                    output = exc.what();
+                }
+                job->connection->send(job->id, succeeded ? Status::ok : Status::error, output);
+                job->connection->finish_request();
+                stats_.record(Clock::now() - job->received, succeeded, input_bytes, output.size());
+            }
+        }
+    };
+
+    int listen_on(const std::string& path)
+    {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::invalid_argument("The socket path is too long");
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.data(), path.size());
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw_errno("Failed to create the socket");
+        ::unlink(path.c_str()); // Remove a stale socket from a previous run
+        if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+            throw_errno("Failed to bind the socket");
+        if (::listen(fd, SOMAXCONN) < 0)
+            throw_errno("Failed to listen on the socket");
+        return fd;
+    }
+
+    // Accepting fails on running out of file descriptors or buffers, which is temporary as the other
+    // connections close, so the server waits a while instead of going down
+    bool is_temporary_accept_error(const int error) noexcept
+    {
+        return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+    }
+
+    constexpr auto accept_backoff = std::chrono::milliseconds(100);
+
+    Config parse_config(const int argc, const char** argv)
+    {
+        Config config;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string_view arg = argv[i];
+            const auto next = [&]() -> std::string
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(fmt::format("Missing value for option {}", arg));
+                return argv[++i];
+            };
+            if (arg == "--socket")
+                config.socket_path = next();
+            else if (arg == "--stdio")
+                config.stdio = true;
+            else if (arg == "-j")
+                config.n_workers = std::stoul(next());
+            else if (arg == "--queue")
+                config.queue_capacity = std::stoul(next());
+            else if (arg == "--max-request-bytes")
+                config.max_request_bytes = std::stoul(next());
+            else if (arg == "--max-pending-bytes")
+                config.max_pending_bytes = std::stoul(next());
+            else if (arg == "--max-connections")
+                config.max_connections = std::stoul(next());
+            else if (arg == "--max-expanded-bytes")
+                config.parse_options.max_expanded_bytes = std::stoul(next());
+            else if (arg == "--max-notes")
+                config.export_options.max_notes = std::stoul(next());
+            else if (arg == "--max-measures")
+                config.export_options.max_measures = std::stoul(next());
+            else if (arg == "--max-voices")
+                config.export_options.max_voices = std::stoul(next());
+            else if (arg == "--max-subdivision")
+                config.export_options.max_subdivision = std::stoul(next());
+            else if (arg == "--max-allocated-bytes")
+                config.export_options.max_allocated_bytes = std::stoul(next());
+            else
+                throw std::invalid_argument(fmt::format("Unknown option {}", arg));
+        }
+        if (config.stdio == !config.socket_path.empty())
+            throw std::invalid_argument("Exactly one of --socket and --stdio should be given");
+        if (config.n_workers == 0)
+            config.n_workers = std::max(std::thread::hardware_concurrency(), 1u);
+        if (config.queue_capacity == 0)
+            config.queue_capacity = 4 * config.n_workers;
+        if (config.max_connections == 0 ||
+            config.max_connections > static_cast<std::size_t>(std::counting_semaphore<>::max()))
+            throw std::invalid_argument("The maximum number of connections is out of range");
+        return config;
+    }
+} // namespace
+
+int main(const int argc, const char** argv)
+{
+    try
+    {
+        const Config config = parse_config(argc, argv);
+        std::signal(SIGPIPE, SIG_IGN); // Failed writes to closed clients are handled by the return values
+        Server server(config);
+        if (config.stdio)
+        {
+            server.serve(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false, config.max_pending_bytes));
+            return 0; // Serving returns once every response is written
+        }
+
+        const int listener = listen_on(config.socket_path);
+        std::cerr << "Listening on " << config.socket_path << " with " << config.n_workers << " workers\n";
+        // Every connection takes two threads, once the limit is reached the clients wait in the backlog
+        std::counting_semaphore<> connection_slots(static_cast<std::ptrdiff_t>(config.max_connections));
+        while (true)
+        {
+            connection_slots.acquire();
+            const int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0)
+            {
+                const int error = errno;
+                connection_slots.release();
+                if (error == EINTR || error == ECONNABORTED)
+                    continue;
+                if (!is_temporary_accept_error(error))
+                    throw std::system_error(error, std::generic_category(), "Failed to accept a connection");
+                std::cerr << "Failed to accept a connection: " << std::generic_category().message(error)
+                          << ", retrying\n";
+                std::this_thread::sleep_for(accept_backoff);
+                continue;
+            }
+            auto connection = std::make_shared<Connection>(fd, fd, true, config.max_pending_bytes);
+            try
+            {
+                std::thread(
+                    [&server, &connection_slots, connection]
+                    {
+                        try
+                        {
+                            server.serve(connection);
+                        }
+                        catch (const std::exception& exc) // Out of threads for the writer
+                        {
+                            std::cerr << "Failed to serve a connection: " << exc.what() << '\n';
+                        }
+                        connection_slots.release();
+                    })
+                    .detach();
+            }
+            catch (const std::system_error& exc) // Out of threads, the connection is closed with its last reference
+            {
+                connection_slots.release();
+                std::cerr << "Failed to serve a connection: " << exc.what() << ", retrying\n";
+                std::this_thread::sleep_for(accept_backoff);
+            }
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        std::cerr << exc.what() << '\n';
+        std::cerr << "Usage: hkrd (--socket <path> | --stdio) [-j <workers>] [--queue <capacity>] "
+                     "[--max-connections <count>]\n"
+                     "            [--max-request-bytes <bytes>] [--max-pending-bytes <bytes>] "
+                     "[--max-expanded-bytes <bytes>]\n"
+                     "            [--max-notes <count>] [--max-measures <count>] [--max-voices <count>] "
+                     "[--max-subdivision <count>] [--max-allocated-bytes <bytes>]\n";
+        return 1;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+namespace hkr::server
+{
+    // Counters of the served requests, and the latencies of the most recent ones for the percentiles
+    class ServerStats
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        void record(const Clock::duration latency, const bool succeeded, const std::size_t input_bytes,
+            const std::size_t output_bytes)
+        {
+            const auto us = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+            const std::scoped_lock lock(mutex_);
+            requests_++;
+            if (!succeeded)
+                errors_++;
+            input_bytes_ += input_bytes;
+            output_bytes_ += output_bytes;
+            if (latencies_.size() < window_size)
+                latencies_.push_back(us);
+            else
+                latencies_[requests_ % window_size] = us;
+        }
+
+        std::string to_json(const std::size_t queued, const std::size_t queue_capacity) const
+        {
+            const std::scoped_lock lock(mutex_);
+            const double seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+            std::vector<std::uint64_t> sorted = latencies_;
+            std::ranges::sort(sorted);
+            const auto percentile = [&](const double p) -> std::uint64_t
+            {
+                if (sorted.empty())
+                    return 0;
+                const auto idx = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+                return sorted[idx];
+            };
+            return fmt::format(R"({{"uptime_s": {:.3f}, "requests": {}, "errors": {}, "throughput_rps": {:.2f}, )"
+                               R"("input_bytes": {}, "output_bytes": {}, "queued": {}, "queue_capacity": {}, )"
+                               R"("latency_us": {{"samples": {}, "p50": {}, "p90": {}, "p99": {}, "max": {}}}}})",
+                seconds, requests_, errors_, seconds > 0 ? static_cast<double>(requests_) / seconds : 0.0,
+                input_bytes_, output_bytes_, queued, queue_capacity, sorted.size(), percentile(0.5),
+                percentile(0.9), percentile(0.99), sorted.empty() ? 0 : sorted.back());
+        }
+
+    private:
+        static constexpr std::size_t window_size = 8192;
+
+        mutable std::mutex mutex_;
+        Clock::time_point start_ = Clock::now();
+        std::uint64_t requests_ = 0;
+        std::uint64_t errors_ = 0;
+        std::uint64_t input_bytes_ = 0;
+        std::uint64_t output_bytes_ = 0;
+        std::vector<std::uint64_t> latencies_;
+    };
+} // namespace hkr::server
@@ -0,0 +1,151 @@
+// Parses hikari scores at build time and embeds them into a C++ header as binary archives.
+//
+// Usage: hkrembed -o <header> [--namespace <name>] [--max-expanded-bytes <bytes>] [<name>=]<file>...
+// Every score becomes a function returning an archive::MusicView over a constexpr byte array,
+// so that the program reads the music in place without parsing it at startup. Scores that
+// fail to parse fail the build with the parser's diagnostic. The name of a score defaults to
+// the stem of its file name.
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+#include <clu/file.h>
+#include <hikari/api.h>
+#include <hikari/archive.h>
+
+namespace
+{
+    namespace fs = std::filesystem;
+
+    struct Score
+    {
+        std::string name;
+        fs::path path;
+    };
+
+    struct Options
+    {
+        fs::path output;
+        std::string name_space = "scores";
+        hkr::ParseOptions parse_options;
+        std::vector<Score> scores;
+    };
+
+    std::string to_identifier(const std::string_view name)
+    {
+        std::string res;
+        for (const char ch : name)
+            res += std::isalnum(static_cast<unsigned char>(ch)) ? ch : '_';
+        if (res.empty() || std::isdigit(static_cast<unsigned char>(res[0])))
+            res.insert(0, 1, '_');
+        return res;
+    }
+
+    Options parse_options(const int argc, const char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string_view arg = argv[i];
+            const auto next = [&]() -> std::string
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(fmt::format("Missing value for option {}", arg));
+                return argv[++i];
+            };
+            if (arg == "-o")
+                options.output = next();
+            else if (arg == "--namespace")
+                options.name_space = next();
+            else if (arg == "--max-expanded-bytes")
+                options.parse_options.max_expanded_bytes = std::stoul(next());
+            else if (arg.starts_with('-'))
+                throw std::invalid_argument(fmt::format("Unknown option {}", arg));
+            else if (const auto eq = arg.find('='); eq != std::string_view::npos)
+                options.scores.push_back({to_identifier(arg.substr(0, eq)), fs::path(arg.substr(eq + 1))});
+            else
+                options.scores.push_back({to_identifier(fs::path(arg).stem().string()), fs::path(arg)});
+        }
+        if (options.output.empty())
+            throw std::invalid_argument("No output header is given");
+        return options;
+    }
+
+    void write_score(std::ostream& stream, const Score& score, const std::vector<std::byte>& archive)
+    {
+        // Archive views need their bytes aligned like the records in them
+        stream << fmt::format(
+            "    namespace detail\n    {{\n        alignas(8) inline constexpr unsigned char {}_archive[{}]{{",
+            score.name, archive.size());
+        for (std::size_t i = 0; i < archive.size(); i++)
+            stream << (i % 16 == 0 ? "\n            " : " ")
+                   << fmt::format("0x{:02x},", static_cast<unsigned>(archive[i]));
+        stream << "\n        };\n    } // namespace detail\n\n";
+        stream << fmt::format("    /// \\brief The score parsed from {}.\n", score.path.filename().string());
+        stream << fmt::format("    inline hkr::archive::MusicView {}()\n    {{\n"
+                              "        return hkr::archive::MusicView(std::as_bytes(std::span(detail::{}_archive)));\n"
+                              "    }}\n",
+            score.name, score.name);
+    }
+} // namespace
+
+int main(const int argc, const char** argv)
+{
+    Options options;
+    try
+    {
+        options = parse_options(argc, argv);
+    }
+    catch (const std::exception& exc)
+    {
+        std::cerr << exc.what() << '\n';
+        std::cerr << "Usage: hkrembed -o <header> [--namespace <name>] [--max-expanded-bytes <bytes>] "
+                     "[<name>=]<file>...\n";
+        return 1;
+    }
+
+    std::ostringstream header;
+    header << "// Generated by hkrembed, do not edit.\n\n#pragma once\n\n"
+              "#include <span>\n#include <hikari/archive.h>\n\n";
+    header << "namespace " << options.name_space << "\n{\n";
+    bool failed = false;
+    for (std::size_t i = 0; const auto& score : options.scores)
+    {
+        try
+        {
+            const auto archive = hkr::archive::serialize( //
+                hkr::parse_music(clu::read_all_text(score.path), options.parse_options));
+            if (i++ != 0)
+                header << '\n';
+            write_score(header, score, archive);
+        }
+        catch (const std::exception& exc)
+        {
+            // Report every malformed score before failing the build
+            std::cerr << score.path.string() << ": error: " << exc.what() << '\n';
+            failed = true;
+        }
+    }
+    header << "} // namespace " << options.name_space << '\n';
+    if (failed)
+        return 1;
+
+    // Keep the old header if nothing changed, so that its dependents are not rebuilt
+    const std::string content = std::move(header).str();
+    if (fs::exists(options.output) && clu::read_all_text(options.output) == content)
+        return 0;
+    std::ofstream file(options.output, std::ios::binary);
+    file << content;
+    if (!file)
+    {
+        std::cerr << "Failed to write " << options.output.string() << '\n';
+        return 1;
+    }
+    return 0;
+}
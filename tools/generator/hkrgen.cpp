@@ -0,0 +1,150 @@
+// Generates synthetic hikari scores for load and scaling tests.
+//
+// Usage: hkrgen [options] [-o <out_file>]
+// The score is written to stdout if no output file is given, and the expected number of
+// measures and beats is printed to stderr with --expect.
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <fmt/format.h>
+
+#include "score_generator.h"
+
+namespace
+{
+    struct Knob
+    {
+        std::string_view name;
+        std::string_view description;
+        std::function<void(hkr::gen::GeneratorOptions&, std::string_view)> set;
+    };
+
+    std::size_t parse_size(const std::string_view text)
+    {
+        std::size_t pos = 0;
+        const std::string str(text);
+        const auto value = std::stoull(str, &pos);
+        const std::string_view suffix = text.substr(pos);
+        if (suffix.empty())
+            return value;
+        if (suffix == "K" || suffix == "k")
+            return value << 10;
+        if (suffix == "M" || suffix == "m")
+            return value << 20;
+        if (suffix == "G" || suffix == "g")
+            return value << 30;
+        throw std::invalid_argument(fmt::format("Invalid size {}", text));
+    }
+
+    template <auto Member>
+    auto setter()
+    {
+        return [](hkr::gen::GeneratorOptions& options, const std::string_view text)
+        {
+            auto& member = options.*Member;
+            using T = std::remove_cvref_t<decltype(member)>;
+            const std::string str(text);
+            if constexpr (std::is_same_v<T, double>)
+                member = std::stod(str);
+            else if constexpr (std::is_same_v<T, int>)
+                member = std::stoi(str);
+            else
+                member = static_cast<T>(parse_size(text));
+        };
+    }
+
+    using Options = hkr::gen::GeneratorOptions;
+
+    const Knob knobs[]{
+        {"--seed", "Seed of the random number generator", setter<&Options::seed>()},
+        {"--sections", "Number of sections", setter<&Options::sections>()},
+        {"--measures", "Number of measures in each section", setter<&Options::measures_per_section>()},
+        {"--size", "Generate sections until the text reaches this size (e.g. 512K, 10M)",
+            setter<&Options::target_size>()},
+        {"--staves", "Number of staves", setter<&Options::staves>()},
+        {"--voices", "Maximum number of voices in a multi-voiced segment", setter<&Options::max_voices>()},
+        {"--voiced", "Probability of a measure being multi-voiced", setter<&Options::voiced_segment_probability>()},
+        {"--subdivision", "Maximum number of chords in a beat", setter<&Options::max_subdivision>()},
+        {"--tuplets", "Probability of a beat being a tuplet", setter<&Options::tuplet_probability>()},
+        {"--chord-density", "Probability of a chord having multiple notes", setter<&Options::chord_density>()},
+        {"--chord-size", "Maximum number of notes in a chord", setter<&Options::max_chord_size>()},
+        {"--rests", "Probability of a rest", setter<&Options::rest_probability>()},
+        {"--sustains", "Probability of a sustained chord", setter<&Options::sustain_probability>()},
+        {"--lowest", "Lowest pitch as a MIDI pitch ID", setter<&Options::lowest_pitch>()},
+        {"--highest", "Highest pitch as a MIDI pitch ID", setter<&Options::highest_pitch>()},
+        {"--time-changes", "Probability of a section changing the time and key signatures",
+            setter<&Options::time_change_probability>()},
+        {"--transpositions", "Probability of a section changing the transposition",
+            setter<&Options::transposition_probability>()},
+        {"--tempo-changes", "Probability of a beat changing the tempo", setter<&Options::tempo_change_probability>()},
+        {"--macros", "Number of macro definitions", setter<&Options::macro_definitions>()},
+        {"--macro-beats", "Length of every macro in beats", setter<&Options::macro_beats>()},
+        {"--macro-usage", "Probability of using a macro", setter<&Options::macro_usage_probability>()} //
+    };
+
+    void print_usage()
+    {
+        std::cerr << "Usage: hkrgen [options] [-o <out_file>] [--expect]\n"
+                     "  -o <out_file>          Write the score to a file instead of stdout\n"
+                     "  --expect               Print the expected measure and beat counts to stderr\n";
+        for (const auto& knob : knobs)
+            std::cerr << fmt::format("  {:<22} {}\n", fmt::format("{} <value>", knob.name), knob.description);
+    }
+} // namespace
+
+int main(const int argc, const char** argv)
+{
+    try
+    {
+        Options options;
+        std::string out;
+        bool expect = false;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string_view arg = argv[i];
+            const auto next = [&]() -> std::string_view
+            {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument(fmt::format("Missing value for option {}", arg));
+                return argv[++i];
+            };
+            if (arg == "-o")
+                out = next();
+            else if (arg == "--expect")
+                expect = true;
+            else if (arg == "-h" || arg == "--help")
+            {
+                print_usage();
+                return 0;
+            }
+            else if (const auto iter = std::ranges::find(knobs, arg, &Knob::name); iter != std::end(knobs))
+                iter->set(options, next());
+            else
+                throw std::invalid_argument(fmt::format("Unknown option {}", arg));
+        }
+
+        const auto score = hkr::gen::generate_score(options);
+        if (out.empty())
+            std::cout.write(score.text.data(), static_cast<std::streamsize>(score.text.size()));
+        else
+        {
+            std::ofstream file(out, std::ios::binary);
+            file.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+            file.write(score.text.data(), static_cast<std::streamsize>(score.text.size()));
+        }
+        if (expect)
+            std::cerr << fmt::format("measures: {}\nbeats: {}\n", score.n_measures, score.n_beats);
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        print_usage();
+        return 1;
+    }
+}
@@ -0,0 +1,256 @@
+#include "score_generator.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdlib>
+#include <random>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+namespace hkr::gen
+{
+    namespace
+    {
+        struct TimeSignature
+        {
+            int numerator;
+            int denominator;
+        };
+
+        struct Transposition
+        {
+            std::string_view text;
+            int semitones;
+        };
+
+        constexpr TimeSignature time_signatures[]{
+            {4, 4}, {3, 4}, {2, 4}, {6, 8}, {5, 4}, {7, 8}, {9, 8}, {12, 8}, {2, 2} //
+        };
+
+        constexpr Transposition transpositions[]{
+            {"+P1", 0}, {"+m2", 1}, {"+M2", 2}, {"+m3", 3}, {"+M3", 4}, {"+P4", 5}, {"+P5", 7}, {"+M6", 9},
+            {"+P8", 12}, {"-m2", -1}, {"-M2", -2}, {"-m3", -3}, {"-M3", -4}, {"-P4", -5}, {"-P5", -7},
+            {"-M6", -9}, {"-P8", -12} //
+        };
+
+        // Spellings of the 12 pitch classes, accidentals that would change the octave are avoided
+        constexpr std::array<std::array<std::string_view, 2>, 12> spellings{{
+            {"C", "C"}, {"C#", "Db"}, {"D", "D"}, {"D#", "Eb"}, {"E", "E"}, {"F", "F"}, //
+            {"F#", "Gb"}, {"G", "G"}, {"G#", "Ab"}, {"A", "A"}, {"A#", "Bb"}, {"B", "B"} //
+        }};
+
+        // Keep a margin from the MIDI range, so that transposed notes never leave it, and written
+        // notes never need negative octave specifiers
+        constexpr int max_transposition = 12;
+        constexpr int min_sounding_pitch = 12 + max_transposition;
+        constexpr int max_sounding_pitch = 127 - max_transposition;
+
+        class Generator
+        {
+        public:
+            explicit Generator(const GeneratorOptions& options): opt_(options), rng_(options.seed)
+            {
+                low_ = std::clamp(opt_.lowest_pitch, min_sounding_pitch, max_sounding_pitch);
+                high_ = std::clamp(opt_.highest_pitch, low_, max_sounding_pitch);
+            }
+
+            GeneratedScore generate()
+            {
+                const std::size_t estimated = opt_.target_size != 0
+                    ? opt_.target_size
+                    : opt_.sections * opt_.measures_per_section * opt_.staves * 48;
+                res_.text.reserve(estimated + estimated / 8);
+
+                define_macros();
+                for (std::size_t i = 0;; i++)
+                {
+                    const bool enough = opt_.target_size != 0 //
+                        ? res_.text.size() >= opt_.target_size
+                        : i >= opt_.sections;
+                    if (enough)
+                        break;
+                    write_section(i == 0);
+                }
+                return std::move(res_);
+            }
+
+        private:
+            const GeneratorOptions& opt_;
+            std::mt19937_64 rng_;
+            GeneratedScore res_;
+            int low_ = 0;
+            int high_ = 0;
+            int transposition_ = 0;
+            TimeSignature time_{4, 4};
+            std::vector<std::string> macros_;
+
+            bool chance(const double probability) { return std::bernoulli_distribution(probability)(rng_); }
+
+            template <typename T>
+            T uniform(const T min, const T max)
+            {
+                if constexpr (std::is_integral_v<T>)
+                    return std::uniform_int_distribution<T>(min, max)(rng_);
+                else
+                    return std::uniform_real_distribution<T>(min, max)(rng_);
+            }
+
+            template <typename T, std::size_t N>
+            const T& pick(const T (&array)[N])
+            {
+                return array[uniform<std::size_t>(0, N - 1)];
+            }
+
+            void append(const std::string_view text) { res_.text += text; }
+
+            void define_macros()
+            {
+                for (std::size_t i = 0; i < opt_.macro_definitions; i++)
+                {
+                    std::string name = fmt::format("m{}", i);
+                    append(fmt::format("!{}:", name));
+                    // Macros are expanded under any transposition, so they keep away from the range limits
+                    const int saved = std::exchange(transposition_, 0);
+                    for (std::size_t j = 0; j < opt_.macro_beats; j++)
+                        write_beat();
+                    transposition_ = saved;
+                    append("!\n");
+                    macros_.push_back(std::move(name));
+                }
+            }
+
+            void write_section(const bool first)
+            {
+                std::vector<std::string> attrs;
+                if (first || chance(opt_.time_change_probability))
+                {
+                    time_ = first ? TimeSignature{4, 4} : pick(time_signatures);
+                    attrs.push_back(fmt::format("{}/{}", time_.numerator, time_.denominator));
+                    const int key = uniform(-7, 7);
+                    attrs.push_back(fmt::format("{}{}", std::abs(key), key < 0 ? 'f' : 's'));
+                }
+                if (chance(opt_.transposition_probability))
+                {
+                    const auto& trans = pick(transpositions);
+                    transposition_ = trans.semitones;
+                    attrs.emplace_back(trans.text);
+                }
+                if (!attrs.empty())
+                    append(fmt::format("%{}%\n", fmt::join(attrs, ", ")));
+
+                const std::size_t n_beats = opt_.measures_per_section * static_cast<std::size_t>(time_.numerator);
+                res_.n_measures += opt_.measures_per_section;
+                res_.n_beats += n_beats;
+
+                append("{");
+                for (std::size_t i = 0; i < std::max(opt_.staves, std::size_t{1}); i++)
+                {
+                    if (i != 0)
+                        append(";\n");
+                    write_staff(n_beats);
+                }
+                append("}\n");
+            }
+
+            void write_staff(const std::size_t n_beats)
+            {
+                const auto beats_per_measure = static_cast<std::size_t>(time_.numerator);
+                std::size_t beat = 0;
+                while (beat < n_beats)
+                {
+                    if (beat % beats_per_measure == 0 && beat != 0)
+                        append("\n");
+                    const std::size_t remaining = n_beats - beat;
+                    if (!macros_.empty() && opt_.macro_beats != 0 && remaining >= opt_.macro_beats &&
+                        chance(opt_.macro_usage_probability))
+                    {
+                        append(fmt::format("*{}*", macros_[uniform<std::size_t>(0, macros_.size() - 1)]));
+                        beat += opt_.macro_beats;
+                        continue;
+                    }
+                    if (opt_.max_voices > 1 && remaining >= beats_per_measure && chance(opt_.voiced_segment_probability))
+                    {
+                        write_voiced_segment(beats_per_measure);
+                        beat += beats_per_measure;
+                        continue;
+                    }
+                    if (chance(opt_.tempo_change_probability))
+                        append(fmt::format("%{}%", uniform(40, 240)));
+                    write_beat();
+                    beat++;
+                }
+            }
+
+            void write_voiced_segment(const std::size_t n_beats)
+            {
+                const auto n_voices = uniform<std::size_t>(2, opt_.max_voices);
+                append("[");
+                for (std::size_t i = 0; i < n_voices; i++)
+                {
+                    if (i != 0)
+                        append(";");
+                    for (std::size_t j = 0; j < n_beats; j++)
+                        write_beat();
+                }
+                append("]");
+            }
+
+            void write_beat()
+            {
+                const std::size_t max_subdivision = std::max(opt_.max_subdivision, std::size_t{1});
+                std::size_t subdivision = 1;
+                if (max_subdivision >= 3 && chance(opt_.tuplet_probability))
+                {
+                    do
+                        subdivision = uniform<std::size_t>(3, max_subdivision);
+                    while (std::has_single_bit(subdivision));
+                }
+                else
+                {
+                    const auto max_exp = static_cast<std::size_t>(std::bit_width(max_subdivision) - 1);
+                    subdivision = std::size_t{1} << uniform<std::size_t>(0, max_exp);
+                }
+
+                for (std::size_t i = 0; i < subdivision; i++)
+                {
+                    if (chance(opt_.rest_probability))
+                        append(".");
+                    else if (chance(opt_.sustain_probability))
+                        append("-");
+                    else
+                        write_chord();
+                }
+                append(",");
+            }
+
+            void write_chord()
+            {
+                const std::size_t size = chance(opt_.chord_density) //
+                    ? uniform<std::size_t>(2, std::max(opt_.max_chord_size, std::size_t{2}))
+                    : 1;
+                if (size > 1)
+                    append("(");
+                for (std::size_t i = 0; i < size; i++)
+                    write_note();
+                if (size > 1)
+                    append(")");
+            }
+
+            void write_note()
+            {
+                const int sounding = uniform(low_, high_);
+                const int written = sounding - transposition_;
+                const auto pitch_class = static_cast<std::size_t>(written % 12);
+                const auto& spelling = spellings[pitch_class][uniform<std::size_t>(0, 1)];
+                append(fmt::format("{}{}", spelling, written / 12 - 1));
+            }
+        };
+    } // namespace
+
+    GeneratedScore generate_score(const GeneratorOptions& options) { return Generator(options).generate(); }
+} // namespace hkr::gen
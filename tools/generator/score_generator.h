@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace hkr::gen
+{
+    // Knobs for the synthetic score generator. Probabilities are in [0, 1], pitches are MIDI pitch IDs.
+    struct GeneratorOptions
+    {
+        std::uint64_t seed = 0;
+
+        // Size of the score. If target_size is not zero, more sections are generated until
+        // the text reaches at least that many bytes
+        std::size_t sections = 4;
+        std::size_t measures_per_section = 16;
+        std::size_t target_size = 0;
+
+        // Structure
+        std::size_t staves = 2;
+        std::size_t max_voices = 3; // Voices in a multi-voiced segment
+        double voiced_segment_probability = 0.1; // Per measure
+        std::size_t max_subdivision = 4; // Maximum number of chords in a beat
+        double tuplet_probability = 0.1; // Probability of a beat being divided irregularly (3, 5, 6, 7...)
+
+        // Contents of the beats
+        double chord_density = 0.3; // Probability of a chord having more than one note
+        std::size_t max_chord_size = 4;
+        double rest_probability = 0.05;
+        double sustain_probability = 0.1;
+        int lowest_pitch = 36;
+        int highest_pitch = 96;
+
+        // Attributes
+        double time_change_probability = 0.3; // Per section, also changes the key signature
+        double transposition_probability = 0.1; // Per section
+        double tempo_change_probability = 0.01; // Per beat
+
+        // Macros
+        std::size_t macro_definitions = 0;
+        std::size_t macro_beats = 4; // Length of every macro in beats
+        double macro_usage_probability = 0.2; // Per measure
+    };
+
+    struct GeneratedScore
+    {
+        std::string text;
+        std::size_t n_measures = 0; // Expected total number of measures in the parsed music
+        std::size_t n_beats = 0; // Expected total number of beats in each staff
+    };
+
+    GeneratedScore generate_score(const GeneratorOptions& options);
+} // namespace hkr::gen